@@ -0,0 +1,413 @@
+#!/usr/bin/env python
+
+"""
+Benchmark suite for cbor2.
+
+Every combination of implementation (the C extension and the pure Python
+version), operation (``dumps`` and ``loads``), corpus (see corpora.py) and
+option set (see OPTIONS below) is a separate benchmark named like
+``loads/api_responses/canonical/c``.
+
+If pyperf is installed it is used to run the benchmarks, so all of its options
+apply; for example::
+
+    python benchmarks/bench.py -o baseline.json
+    python benchmarks/bench.py -o new.json
+    python -m pyperf compare_to baseline.json new.json
+
+Without pyperf (or with --no-pyperf) a simpler built-in harness is used which
+writes its own JSON format and can compare against a stored baseline itself::
+
+    python benchmarks/bench.py --no-pyperf -o baseline.json
+    python benchmarks/bench.py --no-pyperf --compare baseline.json
+
+Use --filter to select benchmarks by regular expression and --list to see
+their names.
+
+With --memory (which always uses the built-in harness) each benchmark is
+measured for memory rather than time. The figures reported for a single call
+are:
+
+peak
+    the peak memory allocated (as seen by tracemalloc) during the call
+retained
+    memory still held once the call returns, i.e. by the result
+blocks
+    net memory blocks allocated by the call (sys.getallocatedblocks); CPython
+    has no cumulative allocation counter, so this counts the allocations that
+    are still alive
+leaked
+    memory still held per call, after repeated calls, once the results have
+    been released; anything non-zero points at a leak
+rss
+    the peak resident set size of a fresh process which built the input and
+    made the call; this includes the interpreter itself, so it's only useful
+    for comparisons (disabled with --no-rss and where the resource module is
+    unavailable)
+
+--compare works with memory results too, comparing the peak, retained and rss
+figures.
+"""
+
+import argparse
+import gc
+import json
+import multiprocessing
+import platform
+import re
+import statistics
+import sys
+import time
+import tracemalloc
+from functools import partial
+
+import corpora
+
+try:
+    import pyperf
+except ImportError:
+    pyperf = None
+
+try:
+    import resource
+except ImportError:
+    resource = None
+
+
+def import_cbor2():
+    # Similar hack to that used in tests/conftest to get separate C and Python
+    # implementations
+    import cbor2
+    import cbor2.decoder
+    import cbor2.encoder
+    import cbor2.types
+
+    class Module:
+        # Mock module class
+        pass
+
+    py_cbor2 = Module()
+    for source in (cbor2.types, cbor2.encoder, cbor2.decoder):
+        for name in dir(source):
+            setattr(py_cbor2, name, getattr(source, name))
+    try:
+        import _cbor2
+    except ImportError:
+        _cbor2 = None
+    return cbor2, {"c": _cbor2, "python": py_cbor2}
+
+
+cbor2, IMPLEMENTATIONS = import_cbor2()
+
+
+def tag_hook(decoder, tag):
+    return tag
+
+
+def object_hook(decoder, value):
+    return value
+
+
+# name: (encoder options, decoder options)
+OPTIONS = {
+    "default": ({}, {}),
+    "canonical": ({"canonical": True}, {}),
+    "string_referencing": ({"string_referencing": True}, {}),
+    "value_sharing": ({"value_sharing": True}, {}),
+    "hooks": ({}, {"tag_hook": tag_hook, "object_hook": object_hook}),
+    "immutable": ({}, {"immutable": True}),
+}
+
+
+class Benchmark:
+    __slots__ = ("name", "op", "corpus", "option", "impl", "func")
+
+    def __init__(self, op, corpus, option, impl, func):
+        self.name = "/".join((op, corpus, option, impl))
+        self.op = op
+        self.corpus = corpus
+        self.option = option
+        self.impl = impl
+        self.func = func
+
+
+def iter_benchmarks(pattern=None):
+    """
+    Yield a :class:`Benchmark` for every combination whose name matches the
+    regular expression *pattern* (if given).
+    """
+    regex = re.compile(pattern) if pattern else None
+    built = {}
+    for corpus in corpora.CORPORA:
+        for option, (encode_kwargs, decode_kwargs) in OPTIONS.items():
+            encode_kwargs = dict(encode_kwargs, timezone=corpora.UTC)
+            for impl_name, impl in IMPLEMENTATIONS.items():
+                if impl is None:
+                    continue
+                for op in ("dumps", "loads"):
+                    name = "/".join((op, corpus, option, impl_name))
+                    if regex and not regex.search(name):
+                        continue
+                    if corpus not in built:
+                        built[corpus] = corpora.build(corpus)
+                    value = built[corpus]
+                    if op == "dumps":
+                        func = partial(impl.dumps, value, **encode_kwargs)
+                    else:
+                        data = impl.dumps(value, **encode_kwargs)
+                        func = partial(impl.loads, data, **decode_kwargs)
+                    yield Benchmark(op, corpus, option, impl_name, func)
+
+
+def add_arguments(parser):
+    parser.add_argument(
+        "--filter", metavar="REGEX", help="only run benchmarks whose names match REGEX"
+    )
+    parser.add_argument(
+        "--list", action="store_true", help="list the benchmark names and exit"
+    )
+
+
+def metadata():
+    return {
+        "python": sys.version,
+        "implementation": platform.python_implementation(),
+        "platform": platform.platform(),
+        "cbor2_c_extension": IMPLEMENTATIONS["c"] is not None,
+        "date": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+    }
+
+
+# Built-in harness ///////////////////////////////////////////////////////////
+
+
+def calibrate(func, min_time):
+    "Return the number of loops needed for one sample to take at least min_time"
+    loops = 1
+    while True:
+        start = time.perf_counter()
+        for _ in range(loops):
+            func()
+        if time.perf_counter() - start >= min_time:
+            return loops
+        loops *= 2
+
+
+def run_timing(bench, samples, min_time):
+    loops = calibrate(bench.func, min_time)
+    values = []
+    for _ in range(samples):
+        start = time.perf_counter()
+        for _ in range(loops):
+            bench.func()
+        values.append((time.perf_counter() - start) / loops)
+    return {"loops": loops, "values": values}
+
+
+def measure_memory(bench, repeat=10):
+    # the first call may initialize caches and lazily imported modules which
+    # would otherwise be charged to the benchmark
+    bench.func()
+    gc.collect()
+    tracemalloc.start()
+    try:
+        base, _ = tracemalloc.get_traced_memory()
+        blocks = sys.getallocatedblocks()
+        result = bench.func()
+        retained, peak = tracemalloc.get_traced_memory()
+        blocks = sys.getallocatedblocks() - blocks
+        del result
+        gc.collect()
+        before, _ = tracemalloc.get_traced_memory()
+        for _ in range(repeat):
+            bench.func()
+        gc.collect()
+        after, _ = tracemalloc.get_traced_memory()
+    finally:
+        tracemalloc.stop()
+    return {
+        "peak": peak - base,
+        "retained": retained - base,
+        "blocks": blocks,
+        "leaked": max(0, after - before) // repeat,
+    }
+
+
+def _rss_worker(name, queue):
+    (bench,) = iter_benchmarks("^%s$" % re.escape(name))
+    bench.func()
+    maxrss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    # ru_maxrss is in bytes on macOS and kilobytes everywhere else
+    queue.put(maxrss * (1 if sys.platform == "darwin" else 1024))
+
+
+def measure_rss(bench):
+    # The peak RSS of a process can't be reset, so each measurement needs a
+    # fresh process
+    context = multiprocessing.get_context("spawn")
+    queue = context.Queue()
+    process = context.Process(target=_rss_worker, args=(bench.name, queue))
+    process.start()
+    try:
+        return queue.get(timeout=600)
+    finally:
+        process.join()
+
+
+def format_size(size):
+    for unit, scale in (("MiB", 1 << 20), ("KiB", 1 << 10)):
+        if abs(size) >= scale:
+            return "%.1f %s" % (size / scale, unit)
+    return "%d B" % size
+
+
+def format_memory(result):
+    return "  ".join(
+        "%s %9s" % (key, format_size(result[key]) if key != "blocks" else result[key])
+        for key in ("peak", "retained", "blocks", "leaked", "rss")
+        if result.get(key) is not None
+    )
+
+
+def format_time(seconds):
+    for unit, scale in (("s", 1), ("ms", 1e3), ("us", 1e6)):
+        if seconds * scale >= 1:
+            return "%.2f %s" % (seconds * scale, unit)
+    return "%.0f ns" % (seconds * 1e9)
+
+
+def compare(results, baseline, threshold):
+    """
+    Print a comparison of the mean times (or memory figures) in *results*
+    against *baseline* and return the number of figures which got worse by
+    more than *threshold*.
+    """
+    regressions = 0
+    for name, result in results["benchmarks"].items():
+        base = baseline["benchmarks"].get(name)
+        if not base:
+            continue
+        if "values" in result and "values" in base:
+            old = statistics.mean(base["values"])
+            new = statistics.mean(result["values"])
+            rows = [(name, old, new, format_time)]
+        elif "memory" in result and "memory" in base:
+            rows = [
+                ("%s [%s]" % (name, key), base["memory"][key], result["memory"][key], format_size)
+                for key in ("peak", "retained", "rss")
+                if base["memory"].get(key) is not None and result["memory"].get(key) is not None
+            ]
+        else:
+            continue
+        for label, old, new, formatter in rows:
+            ratio = new / old if old else (1.0 if new == old else float("inf"))
+            flag = ""
+            if ratio > 1 + threshold:
+                flag = "  REGRESSION"
+                regressions += 1
+            elif ratio < 1 - threshold:
+                flag = "  improvement"
+            print(
+                "%-66s %10s -> %10s  %5.2fx%s"
+                % (label, formatter(old), formatter(new), ratio, flag)
+            )
+    return regressions
+
+
+def run_builtin(argv):
+    parser = argparse.ArgumentParser(description="cbor2 benchmark suite")
+    add_arguments(parser)
+    parser.add_argument("--no-pyperf", action="store_true", help="don't use pyperf")
+    parser.add_argument(
+        "--memory", action="store_true", help="measure memory usage instead of time"
+    )
+    parser.add_argument(
+        "--no-rss", action="store_true", help="skip the (slow) RSS measurements of --memory"
+    )
+    parser.add_argument("-o", "--output", help="write the results to this JSON file")
+    parser.add_argument(
+        "--compare", metavar="BASELINE", help="compare the results against a JSON file"
+    )
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.1,
+        help="relative slowdown reported as a regression by --compare (default: 0.1)",
+    )
+    parser.add_argument(
+        "--samples", type=int, default=5, help="number of timed samples per benchmark"
+    )
+    parser.add_argument(
+        "--min-time",
+        type=float,
+        default=0.05,
+        help="minimum duration of each sample in seconds (default: 0.05)",
+    )
+    args = parser.parse_args(argv)
+
+    benchmarks = iter_benchmarks(args.filter)
+    if args.list:
+        for bench in benchmarks:
+            print(bench.name)
+        return 0
+
+    results = {"version": 1, "metadata": metadata(), "benchmarks": {}}
+    for bench in benchmarks:
+        if args.memory:
+            memory = measure_memory(bench)
+            memory["rss"] = None if args.no_rss or resource is None else measure_rss(bench)
+            result = {"memory": memory}
+            summary = format_memory(memory)
+        else:
+            result = run_timing(bench, args.samples, args.min_time)
+            summary = "%10s +- %s" % (
+                format_time(statistics.mean(result["values"])),
+                format_time(statistics.pstdev(result["values"])),
+            )
+        results["benchmarks"][bench.name] = result
+        if not args.compare:
+            print("%-55s %s" % (bench.name, summary))
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+        if compare(results, baseline, args.threshold):
+            return 1
+    return 0
+
+
+# pyperf harness /////////////////////////////////////////////////////////////
+
+
+def add_worker_args(cmd, args):
+    if args.filter:
+        cmd.extend(("--filter", args.filter))
+
+
+def run_pyperf():
+    runner = pyperf.Runner(add_cmdline_args=add_worker_args)
+    add_arguments(runner.argparser)
+    args = runner.parse_args()
+    if args.list:
+        for bench in iter_benchmarks(args.filter):
+            print(bench.name)
+        return 0
+    runner.metadata.update(
+        ("cbor2_" + key, str(value)) for key, value in metadata().items() if key != "date"
+    )
+    for bench in iter_benchmarks(args.filter):
+        runner.bench_func(bench.name, bench.func)
+    return 0
+
+
+def main():
+    if pyperf is None or {"--no-pyperf", "--memory"} & set(sys.argv[1:]):
+        return run_builtin(sys.argv[1:])
+    return run_pyperf()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,126 @@
+"""
+Deterministic corpora for the benchmark suite.
+
+Each corpus is built from a seeded random generator so that every run (and
+every pyperf worker process) benchmarks exactly the same data. The shapes are
+modelled on real workloads rather than single values, since that's where
+differences between the implementations and encoder options actually show up.
+"""
+
+import random
+from datetime import datetime, timedelta, timezone
+from decimal import Decimal
+
+UTC = timezone.utc
+EPOCH = datetime(2023, 1, 1, tzinfo=UTC)
+
+WORDS = (
+    "alpha bravo charlie delta echo foxtrot golf hotel india juliet kilo lima "
+    "mike november oscar papa quebec romeo sierra tango uniform victor whiskey "
+    "xray yankee zulu"
+).split()
+
+
+def api_responses(rng, count=200):
+    "Paginated REST-style responses: nested maps with repeated key names"
+
+    def user(i):
+        return {
+            "id": rng.randrange(1 << 40),
+            "username": "-".join(rng.sample(WORDS, 2)),
+            "email": "%s@example.com" % rng.choice(WORDS),
+            "active": rng.random() < 0.9,
+            "score": round(rng.uniform(0, 100), 2),
+            "roles": rng.sample(["admin", "editor", "viewer", "owner"], rng.randint(1, 3)),
+            "profile": {
+                "bio": " ".join(rng.choices(WORDS, k=rng.randint(0, 20))),
+                "location": {"lat": rng.uniform(-90, 90), "lon": rng.uniform(-180, 180)},
+                "links": ["https://example.com/%s" % w for w in rng.sample(WORDS, 2)],
+            },
+            "created": (EPOCH + timedelta(seconds=rng.randrange(10**8))).isoformat(),
+        }
+
+    return {
+        "page": 1,
+        "per_page": count,
+        "total": count * 17,
+        "data": [user(i) for i in range(count)],
+    }
+
+
+def telemetry(rng, count=2000):
+    "A sequence of small, flat, numeric-heavy sensor readings"
+    sensors = ["sensor-%03d" % i for i in range(20)]
+    return [
+        {
+            "ts": 1672531200 + i,
+            "sensor": rng.choice(sensors),
+            "temp": rng.gauss(21.0, 3.0),
+            "humidity": rng.randint(0, 100),
+            "battery": rng.random(),
+            "ok": rng.random() < 0.99,
+        }
+        for i in range(count)
+    ]
+
+
+def _randbytes(rng, length):
+    return rng.getrandbits(length * 8).to_bytes(length, "little")
+
+
+def blobs(rng, count=20):
+    "Documents dominated by large byte strings"
+    return [
+        {
+            "name": "file-%d.bin" % i,
+            "mime": rng.choice(["image/png", "application/octet-stream"]),
+            "data": _randbytes(rng, rng.randint(1 << 12, 1 << 17)),
+            "thumbnail": _randbytes(rng, 1024),
+        }
+        for i in range(count)
+    ]
+
+
+def financial(rng, count=1000):
+    "Ledger entries with Decimal amounts and timestamps"
+    return [
+        {
+            "txid": rng.randrange(1 << 62),
+            "account": "ACC%08d" % rng.randrange(10**8),
+            "amount": Decimal(rng.randrange(-(10**9), 10**9)).scaleb(-2),
+            "fee": Decimal("0.%04d" % rng.randrange(10**4)),
+            "currency": rng.choice(["EUR", "USD", "GBP", "JPY"]),
+            "time": EPOCH + timedelta(microseconds=rng.randrange(10**13)),
+        }
+        for i in range(count)
+    ]
+
+
+def deep_tree(rng, depth=100, breadth=3):
+    "A deeply nested spine of arrays and maps with a few leaves at each level"
+
+    def node(level):
+        if level == depth:
+            return rng.randrange(1000)
+        children = [node(level + 1)] + [rng.randrange(1000) for _ in range(breadth)]
+        if level % 2:
+            return {"level": level, "children": children}
+        return children
+
+    return node(0)
+
+
+CORPORA = {
+    "api_responses": api_responses,
+    "telemetry": telemetry,
+    "blobs": blobs,
+    "financial": financial,
+    "deep_tree": deep_tree,
+}
+
+
+def build(name, seed=0):
+    """
+    Return the named corpus, built from a generator seeded with *seed*.
+    """
+    return CORPORA[name](random.Random(seed))
@@ -0,0 +1,450 @@
+// Microbenchmarks of the byte-level kernels used by the C extension (see
+// source/codec.h, source/halffloat.c, source/scanner.c and source/emitter.c),
+// measured without
+// the interpreter in the way. Build and run with:
+//
+//     make -C benchmarks kernels
+//     benchmarks/kernels [NAME...]
+//
+// Each kernel runs over a batch of pseudo-random inputs; the fastest of
+// several repetitions is reported per operation, in nanoseconds and (on x86)
+// in time stamp counter cycles.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+#include "codec.h"
+#include "emitter.h"
+#include "halffloat.h"
+#include "scanner.h"
+
+#define BATCH 4096
+#define REPEAT 200
+#define TEXT_SIZE 65536
+
+static uint64_t values[BATCH];
+static uint64_t indexes[BATCH];
+static float floats[BATCH];
+static uint16_t halves[BATCH];
+static uint8_t heads[BATCH * CBOR_MAX_HEAD_SIZE];
+static size_t heads_length;
+static uint8_t out[BATCH * CBOR_MAX_HEAD_SIZE];
+static uint8_t ascii_text[TEXT_SIZE];
+static uint8_t mixed_text[TEXT_SIZE];
+static uint8_t ucs1_text[TEXT_SIZE];
+static uint16_t ucs2_text[TEXT_SIZE];
+static uint32_t ucs4_text[TEXT_SIZE];
+static uint8_t utf8_out[TEXT_SIZE * 4];
+static uint8_t *document;
+static size_t document_length;
+static size_t document_tokens;
+static CBOREmitter emitter;
+
+// keeps the compiler from optimizing the kernels away
+static volatile uint64_t sink;
+
+static uint64_t bench_transcode(void);
+
+
+// Setup /////////////////////////////////////////////////////////////////////
+
+static uint64_t rng_state = 0x853c49e6748fea9bULL;
+
+static uint64_t
+rng(void)
+{
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+
+static void
+setup(void)
+{
+    static const char *samples[] = {"a", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80"};
+    static const uint32_t code_points[] = {'a', 0xe9, 0x20ac, 0x1f600};
+    size_t i, pos, len;
+    uint8_t *p;
+
+    for (i = 0; i < BATCH; ++i) {
+        // spread the values over all head widths
+        values[i] = rng() >> (rng() % 64);
+        indexes[i] = rng() >> (rng() % 64);
+        floats[i] = (float) ((double) (int64_t) rng() / (double) (1ULL << (rng() % 64)));
+        halves[i] = (uint16_t) rng();
+    }
+    heads_length = 0;
+    for (i = 0; i < BATCH; ++i)
+        heads_length += cbor_encode_head(heads + heads_length, i % 8, values[i]);
+
+    for (i = 0; i < TEXT_SIZE; ++i)
+        ascii_text[i] = 0x20 + rng() % 0x5f;
+    for (pos = 0; pos < TEXT_SIZE; pos += len) {
+        const char *sample = samples[rng() % 8 < 5 ? 0 : rng() % 4];
+        len = strlen(sample);
+        if (pos + len > TEXT_SIZE)
+            len = 1, sample = "a";
+        memcpy(mixed_text + pos, sample, len);
+    }
+    // mostly ASCII with some of each wider character the string kind allows,
+    // as in mixed_text
+    for (i = 0; i < TEXT_SIZE; ++i) {
+        ucs4_text[i] = code_points[rng() % 8 < 5 ? 0 : rng() % 4];
+        ucs2_text[i] = ucs4_text[i] > 0xffff ? 0x20ac : (uint16_t) ucs4_text[i];
+        ucs1_text[i] = ucs2_text[i] > 0xff ? 0xe9 : (uint8_t) ucs2_text[i];
+    }
+
+    // an array of record-like maps: {"id": uint, "name": text, "score": float}
+    document = malloc(BATCH * 64);
+    p = document;
+    p += cbor_encode_head(p, 4, BATCH);
+    document_tokens = 1;
+    for (i = 0; i < BATCH; ++i) {
+        p += cbor_encode_head(p, 5, 3);
+        p += cbor_encode_head(p, 3, 2);
+        memcpy(p, "id", 2), p += 2;
+        p += cbor_encode_head(p, 0, values[i] >> 32);
+        p += cbor_encode_head(p, 3, 4);
+        memcpy(p, "name", 4), p += 4;
+        p += cbor_encode_head(p, 3, 8);
+        memcpy(p, ascii_text + i, 8), p += 8;
+        p += cbor_encode_head(p, 3, 5);
+        memcpy(p, "score", 5), p += 5;
+        *p++ = 0xfb;
+        memcpy(p, &values[i], 8), p += 8;
+        document_tokens += 7;
+    }
+    document_length = p - document;
+
+    // the document is in its shortest form already, so it must come out of
+    // the transcoder unchanged
+    cbor_emitter_init(&emitter, NULL, NULL, document_length);
+    if (bench_transcode() != document_length ||
+            memcmp(emitter.buf, document, document_length)) {
+        fprintf(stderr, "transcoded document differs from the original\n");
+        exit(1);
+    }
+
+    // likewise the UTF-8 produced from each string kind must be valid and of
+    // the predicted length
+    for (i = 0; i < 3; ++i) {
+        const void *texts[] = {ucs1_text, ucs2_text, ucs4_text};
+        int kind = 1 << i;
+
+        len = cbor_utf8_encode(utf8_out, kind, texts[i], TEXT_SIZE);
+        if (len != cbor_utf8_length(kind, texts[i], TEXT_SIZE) ||
+                !cbor_utf8_valid(utf8_out, len)) {
+            fprintf(stderr, "invalid UTF-8 transcoded from UCS%d\n", kind);
+            exit(1);
+        }
+    }
+}
+
+
+// Kernels ///////////////////////////////////////////////////////////////////
+
+static uint64_t
+bench_encode_head(void)
+{
+    size_t i, pos = 0;
+
+    for (i = 0; i < BATCH; ++i)
+        pos += cbor_encode_head(out + pos, i % 8, values[i]);
+    return pos + out[pos / 2];
+}
+
+
+static uint64_t
+bench_head_size(void)
+{
+    size_t i;
+    uint64_t ret = 0;
+
+    for (i = 0; i < BATCH; ++i)
+        ret += cbor_head_size(values[i]);
+    return ret;
+}
+
+
+static uint64_t
+bench_decode_head(void)
+{
+    const uint8_t *p = heads, *end = heads + heads_length;
+    uint64_t ret = 0;
+    int size;
+
+    while (p < end) {
+        size = cbor_argument_size(*p & 0x1f);
+        if (size == 0)
+            ret += *p++ & 0x1f;
+        else {
+            ret += cbor_read_argument(p + 1, size);
+            p += size + 1;
+        }
+    }
+    return ret;
+}
+
+
+static uint64_t
+bench_stringref_min_length(void)
+{
+    size_t i;
+    uint64_t ret = 0;
+
+    for (i = 0; i < BATCH; ++i)
+        ret += (values[i] & 0xff) >= cbor_stringref_min_length(indexes[i]);
+    return ret;
+}
+
+
+static uint64_t
+bench_pack_float16(void)
+{
+    size_t i;
+    uint64_t ret = 0;
+
+    for (i = 0; i < BATCH; ++i)
+        ret += pack_float16(floats[i]);
+    return ret;
+}
+
+
+static uint64_t
+bench_unpack_float16(void)
+{
+    size_t i;
+    float ret = 0;
+
+    for (i = 0; i < BATCH; ++i)
+        ret += unpack_float16(halves[i]);
+    return (uint64_t) ret;
+}
+
+
+static uint64_t
+bench_utf8_ascii(void)
+{
+    return cbor_utf8_valid(ascii_text, TEXT_SIZE);
+}
+
+
+static uint64_t
+bench_utf8_mixed(void)
+{
+    return cbor_utf8_valid(mixed_text, TEXT_SIZE);
+}
+
+
+static uint64_t
+bench_utf8_length_ucs1(void)
+{
+    return cbor_utf8_length(1, ucs1_text, TEXT_SIZE);
+}
+
+
+static uint64_t
+bench_utf8_length_ucs2(void)
+{
+    return cbor_utf8_length(2, ucs2_text, TEXT_SIZE);
+}
+
+
+static uint64_t
+bench_utf8_length_ucs4(void)
+{
+    return cbor_utf8_length(4, ucs4_text, TEXT_SIZE);
+}
+
+
+static uint64_t
+bench_utf8_encode_ascii(void)
+{
+    return cbor_utf8_encode(utf8_out, 1, ascii_text, TEXT_SIZE);
+}
+
+
+static uint64_t
+bench_utf8_encode_ucs1(void)
+{
+    return cbor_utf8_encode(utf8_out, 1, ucs1_text, TEXT_SIZE);
+}
+
+
+static uint64_t
+bench_utf8_encode_ucs2(void)
+{
+    return cbor_utf8_encode(utf8_out, 2, ucs2_text, TEXT_SIZE);
+}
+
+
+static uint64_t
+bench_utf8_encode_ucs4(void)
+{
+    return cbor_utf8_encode(utf8_out, 4, ucs4_text, TEXT_SIZE);
+}
+
+
+static int
+count_token(void *ctx, const CBORToken *tok)
+{
+    (*(uint64_t *) ctx)++;
+    return 0;
+}
+
+static const CBORVisitor counter = {
+    count_token, count_token, count_token, count_token, count_token,
+    count_token, count_token, count_token, count_token, count_token,
+    count_token, count_token,
+};
+
+
+static uint64_t
+walk(const CBORVisitor *visitor, void *ctx)
+{
+    CBORScanner scanner;
+    int ret;
+
+    cbor_scanner_init(&scanner, document, document_length);
+    while ((ret = cbor_scanner_walk(&scanner, visitor, ctx)) == 1);
+    cbor_scanner_free(&scanner);
+    return ret;
+}
+
+
+static uint64_t
+bench_walk(void)
+{
+    uint64_t count = 0;
+
+    walk(&counter, &count);
+    return count;
+}
+
+
+static uint64_t
+bench_transcode(void)
+{
+    emitter.length = 0;
+    walk(&cbor_emitter_visitor, &emitter);
+    return emitter.length;
+}
+
+
+static uint64_t
+bench_scan(void)
+{
+    CBORScanner scanner;
+    CBORToken tok;
+    uint64_t ret = 0;
+
+    cbor_scanner_init(&scanner, document, document_length);
+    while (cbor_scanner_next(&scanner, &tok) == 1)
+        ret += tok.value;
+    cbor_scanner_free(&scanner);
+    return ret;
+}
+
+
+// Harness ///////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const char *name;
+    uint64_t (*run)(void);
+    const char *unit;
+    size_t *ops;
+} Kernel;
+
+static size_t batch = BATCH;
+static size_t text_size = TEXT_SIZE;
+
+static const Kernel kernels[] = {
+    {"encode_head", bench_encode_head, "head", &batch},
+    {"head_size", bench_head_size, "value", &batch},
+    {"decode_head", bench_decode_head, "head", &batch},
+    {"stringref_min_length", bench_stringref_min_length, "string", &batch},
+    {"pack_float16", bench_pack_float16, "float", &batch},
+    {"unpack_float16", bench_unpack_float16, "float", &batch},
+    {"utf8_valid_ascii", bench_utf8_ascii, "byte", &text_size},
+    {"utf8_valid_mixed", bench_utf8_mixed, "byte", &text_size},
+    {"utf8_length_ucs1", bench_utf8_length_ucs1, "char", &text_size},
+    {"utf8_length_ucs2", bench_utf8_length_ucs2, "char", &text_size},
+    {"utf8_length_ucs4", bench_utf8_length_ucs4, "char", &text_size},
+    {"utf8_encode_ascii", bench_utf8_encode_ascii, "char", &text_size},
+    {"utf8_encode_ucs1", bench_utf8_encode_ucs1, "char", &text_size},
+    {"utf8_encode_ucs2", bench_utf8_encode_ucs2, "char", &text_size},
+    {"utf8_encode_ucs4", bench_utf8_encode_ucs4, "char", &text_size},
+    {"scan", bench_scan, "token", &document_tokens},
+    {"walk", bench_walk, "token", &document_tokens},
+    {"transcode", bench_transcode, "token", &document_tokens},
+};
+
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void
+run_kernel(const Kernel *k)
+{
+    double start, elapsed, best_ns = 1e300;
+    int i;
+#ifdef HAVE_TSC
+    uint64_t tsc, best_tsc = UINT64_MAX;
+#endif
+
+    for (i = 0; i < REPEAT; ++i) {
+        start = now_ns();
+#ifdef HAVE_TSC
+        tsc = __rdtsc();
+#endif
+        sink += k->run();
+#ifdef HAVE_TSC
+        tsc = __rdtsc() - tsc;
+        if (tsc < best_tsc)
+            best_tsc = tsc;
+#endif
+        elapsed = now_ns() - start;
+        if (elapsed < best_ns)
+            best_ns = elapsed;
+    }
+    printf("%-22s %9.3f ns/%s", k->name, best_ns / *k->ops, k->unit);
+#ifdef HAVE_TSC
+    printf("  %8.2f cycles/%s", (double) best_tsc / *k->ops, k->unit);
+#endif
+    printf("\n");
+}
+
+
+int
+main(int argc, char **argv)
+{
+    size_t i;
+    int j, selected;
+
+    setup();
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        selected = argc < 2;
+        for (j = 1; j < argc; ++j)
+            selected |= strstr(kernels[i].name, argv[j]) != NULL;
+        if (selected)
+            run_kernel(&kernels[i]);
+    }
+    cbor_emitter_free(&emitter);
+    free(document);
+    return 0;
+}
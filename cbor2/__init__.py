@@ -1,5 +1,8 @@
 from .decoder import CBORDecoder, load, loads  # noqa: F401
+from .diagnostic import diagnose  # noqa: F401
 from .encoder import CBOREncoder, dump, dumps, shareable_encoder  # noqa: F401
+from .index import index_items  # noqa: F401
+from .stats import scan_stats  # noqa: F401
 from .types import (  # noqa: F401
     CBORDecodeEOF,
     CBORDecodeError,
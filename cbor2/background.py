@@ -0,0 +1,204 @@
+"""
+Encoding to, and decoding from, files with the I/O done on a background thread.
+
+The encoder and decoder normally call the ``write()`` or ``read()`` method of
+their file object themselves, so encoding the next chunk of output (or
+decoding the last chunk of input) waits for each call to complete. The file
+objects here hand that work to a thread of their own instead: output is
+collected in a buffer which is passed to the thread to write once full, while
+the next one is filled, and input is read ahead by the thread a chunk at a
+time.
+
+The file and socket objects of the standard library release the GIL while
+they wait on the operating system, so the encoder or decoder keeps running
+meanwhile. The overlap is lost on file objects whose ``write()`` or ``read()``
+is implemented in Python and keeps the GIL busy.
+
+Either kind of wrapper is used in place of the file object it wraps::
+
+    with BackgroundWriter(fp) as out:
+        for record in records:
+            dump(record, out)
+
+    with BackgroundReader(fp) as src:
+        decoder = CBORDecoder(src)
+        ...
+
+Closing a wrapper doesn't close the file object it wraps.
+"""
+import io
+import threading
+from queue import Queue
+
+# Buffers are passed between threads this many bytes at a time
+CHUNK_SIZE = 256 * 1024
+
+
+class _RawWriter(io.RawIOBase):
+    def __init__(self, fp, depth):
+        self._fp = fp
+        self._queue = Queue(depth)
+        self._error = None
+        self._thread = threading.Thread(target=self._run, name="cbor2 writer", daemon=True)
+        self._thread.start()
+
+    def _run(self):
+        while True:
+            data = self._queue.get()
+            try:
+                if data is None:
+                    return
+                # after a failure, keep draining the queue so that write()
+                # never blocks, but write nothing more
+                if self._error is None:
+                    self._write_all(data)
+            except BaseException as exc:
+                self._error = exc
+            finally:
+                self._queue.task_done()
+
+    def _write_all(self, data):
+        # raw streams and sockets may write only part of the data, or nothing
+        # at all (returning None) if they're non-blocking
+        view = memoryview(data)
+        while view:
+            written = self._fp.write(view)
+            if written is not None:
+                view = view[written:]
+
+    def _check_error(self):
+        if self._error is not None:
+            raise self._error
+
+    def writable(self):
+        return True
+
+    def write(self, b):
+        self._check_error()
+        # the buffer passed in is reused by the caller once this returns
+        data = bytes(b)
+        self._queue.put(data)
+        return len(data)
+
+    def flush(self):
+        if not self.closed:
+            self._queue.join()
+            self._check_error()
+            if hasattr(self._fp, "flush"):
+                self._fp.flush()
+
+    def close(self):
+        if not self.closed:
+            try:
+                self.flush()
+            finally:
+                self._queue.put(None)
+                self._thread.join()
+                super().close()
+
+
+class BackgroundWriter(io.BufferedWriter):
+    """
+    A file object passing what is written to it to ``fp.write()`` on a
+    background thread.
+
+    Output is collected into chunks of *chunk_size* bytes. Up to *depth*
+    chunks wait to be written while the next one is filled; beyond that,
+    :meth:`write` blocks until the thread catches up. Once ``fp.write()``
+    raises an error, nothing more is written and every later call to
+    :meth:`write`, :meth:`flush` or :meth:`close` raises it again.
+
+    :meth:`flush` (and :meth:`close`) wait for everything written so far to be
+    passed to ``fp.write()``, then call ``fp.flush()``. If ``fp.write()``
+    writes only part of a chunk, it's called again with the rest.
+
+    :param fp: a file-like object with a ``write()`` method
+    :param int chunk_size: the number of bytes passed to each ``fp.write()``
+    :param int depth: the number of chunks that can wait to be written
+    """
+
+    def __init__(self, fp, chunk_size=CHUNK_SIZE, depth=2):
+        super().__init__(_RawWriter(fp, depth), chunk_size)
+
+    def flush(self):
+        # BufferedWriter.flush() only passes the buffer on to the raw stream
+        super().flush()
+        self.raw.flush()
+
+
+class _RawReader(io.RawIOBase):
+    def __init__(self, fp, chunk_size, depth):
+        self._fp = fp
+        self._chunk_size = chunk_size
+        self._queue = Queue(depth)
+        self._stop = threading.Event()
+        self._pending = b""
+        self._pos = 0
+        self._eof = False
+        self._thread = threading.Thread(target=self._run, name="cbor2 reader", daemon=True)
+        self._thread.start()
+
+    def _run(self):
+        while not self._stop.is_set():
+            try:
+                data = self._fp.read(self._chunk_size)
+            except BaseException as exc:
+                self._queue.put(exc)
+                return
+            self._queue.put(data)
+            if not data:
+                return
+
+    def readable(self):
+        return True
+
+    def readinto(self, b):
+        if self._pos == len(self._pending):
+            if self._eof:
+                return 0
+            data = self._queue.get()
+            if isinstance(data, BaseException):
+                self._eof = True
+                raise data
+            if not data:
+                self._eof = True
+                return 0
+            self._pending = data
+            self._pos = 0
+        n = min(len(b), len(self._pending) - self._pos)
+        b[:n] = self._pending[self._pos : self._pos + n]
+        self._pos += n
+        return n
+
+    def close(self):
+        if not self.closed:
+            # unblock the thread if it's waiting for room in the queue; a
+            # read() already in progress is waited for
+            self._stop.set()
+            while self._thread.is_alive():
+                while not self._queue.empty():
+                    self._queue.get_nowait()
+                self._thread.join(0.01)
+            super().close()
+
+
+class BackgroundReader(io.BufferedReader):
+    """
+    A file object whose input is read ahead from ``fp.read()`` on a
+    background thread.
+
+    The thread reads chunks of *chunk_size* bytes, keeping up to *depth* of
+    them ready until they're needed. An error raised by ``fp.read()`` is
+    raised by the :meth:`read` call reaching the point where it occurred.
+
+    As with any buffered reader, input beyond what has been read from the
+    wrapper is consumed from *fp*; data following the CBOR items decoded
+    from it should be read through the wrapper too.
+
+    :param fp: a file-like object with a ``read()`` method
+    :param int chunk_size: the number of bytes requested by each ``fp.read()``
+    :param int depth: the number of chunks read ahead
+    """
+
+    def __init__(self, fp, chunk_size=CHUNK_SIZE, depth=2):
+        super().__init__(_RawReader(fp, chunk_size, depth), chunk_size)
@@ -0,0 +1,352 @@
+"""
+An indexed container format for large collections of CBOR records.
+
+Records are grouped into blocks of a fixed number of records, each of which
+is optionally compressed with zlib. An index of the blocks is written at the
+end of the file, which allows a reader to locate any record by number without
+decoding the records before it, and to decode separate blocks in parallel.
+
+The file layout is:
+
+* the 8 byte magic ``b"CBOR2BLK"``
+* the blocks, one after the other
+* the index: a CBOR map (see below)
+* an 8 byte trailer holding the offset of the index as a big-endian unsigned
+  integer, followed by the 8 byte magic ``b"CBOR2IDX"``
+
+The index is a map with the keys ``"version"`` (currently 1),
+``"records_per_block"``, ``"records"`` (the total number of records) and
+``"blocks"``. The last is an array holding ``[offset, length, records,
+compressed]`` for each block.
+
+Once uncompressed, a block holds a table of the offsets of its records
+(relative to the start of the block) as 4 byte big-endian unsigned integers,
+followed by the encoded records themselves.
+"""
+import mmap
+import os
+import struct
+import zlib
+from collections import deque
+from io import BytesIO
+
+from . import dumps, loads
+from .types import CBORDecodeValueError
+
+MAGIC = b"CBOR2BLK"
+INDEX_MAGIC = b"CBOR2IDX"
+VERSION = 1
+
+_offset_struct = struct.Struct(">Q")
+_trailer_size = _offset_struct.size + len(INDEX_MAGIC)
+
+
+def decode_block(data, compressed, **kwargs):
+    """
+    Decode all the records held in the raw contents of a block.
+
+    This is a module level function so that it can be handed to any kind of
+    :class:`~concurrent.futures.Executor` (including process pools).
+
+    :param data: the raw (possibly compressed) contents of the block
+    :param bool compressed: whether the block is compressed
+    :param kwargs: keyword arguments passed to :func:`~cbor2.loads`
+    :rtype: list
+    """
+    return [loads(record, **kwargs) for record in _split_block(data, compressed)]
+
+
+def _is_count(value):
+    return isinstance(value, int) and not isinstance(value, bool) and value >= 0
+
+
+def _split_block(data, compressed):
+    if compressed:
+        data = zlib.decompress(data)
+    data = memoryview(data)
+    if len(data) < 4:
+        raise CBORDecodeValueError("truncated block")
+    # the first offset also gives the size of the offset table
+    (first,) = struct.unpack_from(">I", data)
+    if not first or first % 4 or first > len(data):
+        raise CBORDecodeValueError("invalid block offset table")
+    offsets = struct.unpack_from(">%dI" % (first // 4), data)
+    ends = offsets[1:] + (len(data),)
+    if any(start > end for start, end in zip(offsets, ends)):
+        raise CBORDecodeValueError("invalid block offset table")
+    return [data[start:end] for start, end in zip(offsets, ends)]
+
+
+class BlockWriter:
+    """
+    Write records into a block container.
+
+    :param fp: a binary file-like object, opened for writing
+    :param int records_per_block:
+        the number of records to collect in each block; larger blocks
+        compress better while smaller blocks make random access cheaper
+    :param bool compress: compress each block with zlib
+    :param int compresslevel: the zlib compression level
+    :param kwargs: keyword arguments passed to :func:`~cbor2.dumps`
+    """
+
+    def __init__(self, fp, records_per_block=1000, compress=True, compresslevel=6, **kwargs):
+        if records_per_block < 1:
+            raise ValueError("records_per_block must be at least 1")
+        self.fp = fp
+        self.records_per_block = records_per_block
+        self.compress = compress
+        self.compresslevel = compresslevel
+        self._encoder_kwargs = kwargs
+        self._blocks = []
+        self._records = []
+        self._count = 0
+        self._offset = len(MAGIC)
+        self._closed = False
+        fp.write(MAGIC)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    def __len__(self):
+        return self._count + len(self._records)
+
+    def write(self, obj):
+        """
+        Encode *obj* and append it as the next record.
+        """
+        self.write_encoded(dumps(obj, **self._encoder_kwargs))
+
+    def write_encoded(self, data):
+        """
+        Append the already encoded CBOR item in *data* as the next record.
+        """
+        if self._closed:
+            raise ValueError("write to closed BlockWriter")
+        self._records.append(data)
+        if len(self._records) == self.records_per_block:
+            self._write_block()
+
+    def _write_block(self):
+        records = self._records
+        offsets = []
+        offset = 4 * len(records)
+        for record in records:
+            offsets.append(offset)
+            offset += len(record)
+        if offset > 0xFFFFFFFF:
+            raise ValueError("block too large; use a smaller records_per_block")
+        data = b"".join([struct.pack(">%dI" % len(offsets), *offsets)] + records)
+        if self.compress:
+            data = zlib.compress(data, self.compresslevel)
+        self.fp.write(data)
+        self._blocks.append([self._offset, len(data), len(records), self.compress])
+        self._offset += len(data)
+        self._count += len(records)
+        self._records = []
+
+    def close(self):
+        """
+        Write out any buffered records followed by the index. The underlying
+        file is not closed.
+        """
+        if self._closed:
+            return
+        if self._records:
+            self._write_block()
+        index = dumps(
+            {
+                "version": VERSION,
+                "records_per_block": self.records_per_block,
+                "records": self._count,
+                "blocks": self._blocks,
+            }
+        )
+        self.fp.write(index)
+        self.fp.write(_offset_struct.pack(self._offset) + INDEX_MAGIC)
+        self._closed = True
+
+
+class BlockReader:
+    """
+    Read records from a block container.
+
+    Records can be accessed by number (``reader[n]``), iterated over in
+    order, or decoded a block at a time, optionally in parallel with
+    :meth:`iter_parallel`.
+
+    :param source:
+        the path of the file, a binary file-like object or a bytes-like object
+        holding the whole container; regular files are memory mapped
+    :param kwargs: keyword arguments passed to :func:`~cbor2.loads`
+    """
+
+    def __init__(self, source, **kwargs):
+        self._decoder_kwargs = kwargs
+        self._mmap = self._file = self._buf = None
+        if isinstance(source, (str, os.PathLike)):
+            source = self._file = open(source, "rb")
+        if hasattr(source, "read"):
+            try:
+                self._mmap = mmap.mmap(source.fileno(), 0, access=mmap.ACCESS_READ)
+                self._buf = memoryview(self._mmap)
+            except (AttributeError, OSError, ValueError):
+                source.seek(0)
+                self._buf = memoryview(source.read())
+        else:
+            self._buf = memoryview(source)
+        try:
+            self._read_index()
+        except BaseException:
+            self.close()
+            raise
+
+    def _read_index(self):
+        buf = self._buf
+        if len(buf) < len(MAGIC) + _trailer_size or buf[: len(MAGIC)] != MAGIC:
+            raise CBORDecodeValueError("not a CBOR block container")
+        if buf[-len(INDEX_MAGIC) :] != INDEX_MAGIC:
+            raise CBORDecodeValueError("block container index is missing")
+        (index_offset,) = _offset_struct.unpack_from(buf, len(buf) - _trailer_size)
+        if not len(MAGIC) <= index_offset <= len(buf) - _trailer_size:
+            raise CBORDecodeValueError("invalid block container index offset")
+        index = loads(bytes(buf[index_offset : len(buf) - _trailer_size]))
+        if not isinstance(index, dict) or index.get("version") != VERSION:
+            raise CBORDecodeValueError("unsupported block container version")
+        self.records_per_block = index.get("records_per_block")
+        self._length = index.get("records")
+        self._blocks = index.get("blocks")
+        if not _is_count(self.records_per_block) or self.records_per_block == 0:
+            raise CBORDecodeValueError("invalid records_per_block in block container index")
+        if not _is_count(self._length):
+            raise CBORDecodeValueError("invalid record count in block container index")
+        if not isinstance(self._blocks, list):
+            raise CBORDecodeValueError("invalid block list in block container index")
+        for block, entry in enumerate(self._blocks):
+            if not (
+                isinstance(entry, list)
+                and len(entry) == 4
+                and all(_is_count(field) for field in entry[:3])
+                and isinstance(entry[3], bool)
+            ):
+                raise CBORDecodeValueError("invalid index entry for block {}".format(block))
+            offset, length, count, compressed = entry
+            if offset < len(MAGIC) or offset + length > index_offset:
+                raise CBORDecodeValueError("block {} lies outside the container".format(block))
+            # every block but the last must be full for records to be located
+            # by division alone
+            if not (
+                count == self.records_per_block
+                or 0 < count < self.records_per_block
+                and block == len(self._blocks) - 1
+            ):
+                raise CBORDecodeValueError("block {} holds {} records".format(block, count))
+        if sum(block[2] for block in self._blocks) != self._length:
+            raise CBORDecodeValueError("block record counts do not match the index")
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    def close(self):
+        """
+        Release the underlying buffer, unmapping and closing the file if it
+        was opened by the reader.
+        """
+        if self._buf is not None:
+            self._buf.release()
+            self._buf = None
+        if self._mmap is not None:
+            self._mmap.close()
+            self._mmap = None
+        if self._file is not None:
+            self._file.close()
+            self._file = None
+
+    def __len__(self):
+        return self._length
+
+    @property
+    def block_count(self):
+        return len(self._blocks)
+
+    def _locate(self, n):
+        if n < 0:
+            n += self._length
+        if not 0 <= n < self._length:
+            raise IndexError("record index out of range")
+        return divmod(n, self.records_per_block)
+
+    def read_block(self, block):
+        """
+        Return the raw (possibly compressed) contents of a block along with a
+        flag indicating whether it is compressed.
+        """
+        offset, length, count, compressed = self._blocks[block]
+        return self._buf[offset : offset + length], compressed
+
+    def read_encoded(self, n):
+        """
+        Return the encoded form of record *n* without decoding it.
+        """
+        block, position = self._locate(n)
+        return bytes(_split_block(*self.read_block(block))[position])
+
+    def __getitem__(self, n):
+        return loads(self.read_encoded(n), **self._decoder_kwargs)
+
+    def decode_block(self, block):
+        """
+        Decode all the records of the given block and return them as a list.
+        """
+        return decode_block(*self.read_block(block), **self._decoder_kwargs)
+
+    def __iter__(self):
+        for block in range(len(self._blocks)):
+            yield from self.decode_block(block)
+
+    def iter_parallel(self, executor, prefetch=None):
+        """
+        Iterate over all the records, decoding the blocks in parallel.
+
+        Records are yielded in order. Decompression releases the GIL, so a
+        :class:`~concurrent.futures.ThreadPoolExecutor` helps even with the
+        decoding itself running under the GIL; a
+        :class:`~concurrent.futures.ProcessPoolExecutor` parallelizes
+        everything, provided the decoder options can be pickled.
+
+        :param executor: a :class:`~concurrent.futures.Executor`
+        :param int prefetch:
+            the maximum number of blocks being decoded ahead of the consumer
+            (defaults to twice the number of CPUs)
+        """
+        prefetch = prefetch or 2 * (os.cpu_count() or 1)
+        pending = deque()
+        for block in range(len(self._blocks)):
+            if len(pending) >= prefetch:
+                yield from pending.popleft().result()
+            data, compressed = self.read_block(block)
+            pending.append(
+                executor.submit(decode_block, bytes(data), compressed, **self._decoder_kwargs)
+            )
+        while pending:
+            yield from pending.popleft().result()
+
+
+def dumps_blocks(objects, **kwargs):
+    """
+    Write the given objects to a block container in memory and return it.
+
+    :param kwargs: keyword arguments passed to :class:`BlockWriter`
+    :rtype: bytes
+    """
+    fp = BytesIO()
+    with BlockWriter(fp, **kwargs) as writer:
+        for obj in objects:
+            writer.write(obj)
+    return fp.getvalue()
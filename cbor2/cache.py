@@ -0,0 +1,83 @@
+"""
+Memoized decoding of byte-identical inputs.
+
+Services often decode the same payloads over and over again (configuration
+blobs, schema descriptors, documents embedded in larger ones). A
+:class:`DecodeCache` keeps the results of the most recently decoded inputs
+and hands out the same object again when one of them comes around.
+
+The results are shared between everyone decoding the same input, so they are
+always decoded with ``immutable=True``: arrays become tuples, maps
+:class:`~cbor2.types.FrozenDict` instances and sets frozensets. Objects made
+by hooks, and the :class:`~cbor2.types.CBORTag` instances of unknown tags,
+are shared too and must not be modified.
+"""
+from functools import lru_cache, partial
+
+from . import loads
+
+
+class DecodeCache:
+    """
+    A least recently used cache of decoded CBOR inputs.
+
+    The inputs themselves are the keys, so a hit costs hashing the input
+    (which :class:`bytes` objects only do once) and, when a match is found,
+    comparing it byte for byte with the stored one; different inputs never
+    share a result. Errors aren't cached.
+
+    The cache can be used from several threads at once.
+
+    :param int maxsize: the number of results kept (or ``None`` for no limit)
+    :param kwargs:
+        keyword arguments passed to :func:`~cbor2.loads` (``immutable`` is
+        always set)
+    """
+
+    def __init__(self, maxsize=1024, **kwargs):
+        kwargs["immutable"] = True
+        self._loads = lru_cache(maxsize)(partial(loads, **kwargs))
+
+    def loads(self, data):
+        """
+        Deserialize an object from a bytestring, or return the object it was
+        deserialized to last time.
+
+        :param data: a bytes-like object holding the encoded data
+        """
+        if type(data) is not bytes:
+            data = bytes(data)
+        return self._loads(data)
+
+    def tag_hook(self, decoder, tag):
+        """
+        A ``tag_hook`` decoding embedded CBOR data items (semantic tag 24)
+        through the cache; other tags are returned as they are.
+        """
+        if tag.tag == 24 and isinstance(tag.value, bytes):
+            return self.loads(tag.value)
+        return tag
+
+    @property
+    def hits(self):
+        "The number of calls answered from the cache."
+        return self._loads.cache_info().hits
+
+    @property
+    def misses(self):
+        "The number of calls that had to decode their input."
+        return self._loads.cache_info().misses
+
+    @property
+    def hit_rate(self):
+        "The fraction of calls answered from the cache (0.0 before any calls)."
+        info = self._loads.cache_info()
+        total = info.hits + info.misses
+        return info.hits / total if total else 0.0
+
+    def __len__(self):
+        return self._loads.cache_info().currsize
+
+    def clear(self):
+        "Forget every stored result, and reset the statistics."
+        self._loads.cache_clear()
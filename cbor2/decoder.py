@@ -5,6 +5,22 @@ from collections.abc import Mapping
 from datetime import datetime, timedelta, timezone
 from io import BytesIO
 
+from .scanner import (
+    ARRAY,
+    BYTES,
+    BYTES_INDEF,
+    END,
+    FLOAT,
+    MAP,
+    NEGINT,
+    SIMPLE,
+    TAG,
+    TEXT,
+    TEXT_INDEF,
+    UINT,
+    _ffi,
+    _lib,
+)
 from .types import (
     CBORDecodeEOF,
     CBORDecodeValueError,
@@ -15,12 +31,35 @@ from .types import (
     undefined,
 )
 
+# Lengths claimed by the input are only trusted up to this size; beyond it
+# strings are read in growing chunks so a few bytes of input can't make the
+# decoder allocate gigabytes
+READ_CHUNK_SIZE = 1 << 20
+# Chunks of indefinite length strings are joined in batches of this many so
+# that lots of tiny chunks don't cost much more memory than the result
+JOIN_BATCH_SIZE = 1024
+# Simple values are immutable, so decoding returns one shared instance of each
+_simple_value_instances = tuple(CBORSimpleValue(i) for i in range(256))
+
 timestamp_re = re.compile(
     r"^(\d{4})-(\d\d)-(\d\d)T(\d\d):(\d\d):(\d\d)"
     r"(?:\.(\d{1,6})\d*)?(?:Z|([+-]\d\d):(\d\d))$"
 )
 
 
+def _check_decimal_digits(*values):
+    # Converting an int to a Decimal takes time quadratic in its size so,
+    # like int to str conversions, only ints of up to
+    # sys.get_int_max_str_digits() digits (4300 by default) are accepted
+    for value in values:
+        if isinstance(value, int) and value.bit_length() > 64:
+            limit = getattr(sys, "get_int_max_str_digits", lambda: 4300)()
+            if limit and value.bit_length() // 10 * 3 > limit:
+                raise CBORDecodeValueError(
+                    "%d bit integer is too large to convert to a Decimal" % value.bit_length()
+                )
+
+
 class CBORDecoder:
     """
     The CBORDecoder class implements a fully featured `CBOR`_ decoder with
@@ -41,7 +80,19 @@ class CBORDecoder:
         callable that takes 2 arguments: the decoder instance, and a
         dictionary. This callback is invoked for each deserialized
         :class:`dict` object. The return value is substituted for the dict in
-        the deserialized output.
+        the deserialized output. The hook gets a plain dict even where the
+        result has to be immutable (see :attr:`immutable`).
+    :param map_type:
+        ``"dict"`` (the default) to decode maps as dicts, or ``"pairs"`` to
+        decode them as lists of ``(key, value)`` tuples in the order they were
+        encoded. Pairs keep duplicate keys, and their keys don't need to be
+        hashable (so arrays in them are decoded as lists). With ``"pairs"``,
+        ``object_hook`` is called with the list instead of a dict.
+    :param bool immutable:
+        if ``True``, the whole document is decoded as it would be for a map
+        key: arrays as tuples, maps as :class:`FrozenDict` (or tuples of
+        pairs) and sets as frozensets. Like map keys, containers can't then
+        hold shared references to themselves.
 
     .. _CBOR: https://cbor.io/
     """
@@ -54,18 +105,28 @@ class CBORDecoder:
         "_fp_read",
         "_immutable",
         "_str_errors",
+        "_map_pairs",
         "_stringref_namespace",
     )
 
-    def __init__(self, fp, tag_hook=None, object_hook=None, str_errors="strict"):
+    def __init__(
+        self,
+        fp,
+        tag_hook=None,
+        object_hook=None,
+        str_errors="strict",
+        map_type="dict",
+        immutable=False,
+    ):
         self.fp = fp
         self.tag_hook = tag_hook
         self.object_hook = object_hook
         self.str_errors = str_errors
+        self.map_type = map_type
         self._share_index = None
         self._shareables = []
         self._stringref_namespace = None
-        self._immutable = False
+        self._immutable = bool(immutable)
 
     @property
     def immutable(self):
@@ -126,6 +187,19 @@ class CBORDecoder:
                 "'error', or 'replace')".format(value)
             )
 
+    @property
+    def map_type(self):
+        return "pairs" if self._map_pairs else "dict"
+
+    @map_type.setter
+    def map_type(self, value):
+        if value in ("dict", "pairs"):
+            self._map_pairs = value == "pairs"
+        else:
+            raise ValueError(
+                "invalid map_type value {!r} (must be 'dict' or 'pairs')".format(value)
+            )
+
     def set_shareable(self, value):
         """
         Set the shareable value for the last encountered shared value marker,
@@ -161,7 +235,24 @@ class CBORDecoder:
 
         :param int amount: the number of bytes to read
         """
-        data = self._fp_read(amount)
+        if amount <= READ_CHUNK_SIZE:
+            data = self._fp_read(amount)
+        else:
+            # file objects allocate the full amount requested up front, so read
+            # in chunks (each as large as everything read so far)
+            chunks = []
+            read = 0
+            size = READ_CHUNK_SIZE
+            while read < amount:
+                chunk = self._fp_read(size)
+                chunks.append(chunk)
+                read += len(chunk)
+                if len(chunk) < size:
+                    break
+
+                size = min(read, amount - read)
+
+            data = b"".join(chunks)
         if len(data) < amount:
             raise CBORDecodeEOF(
                 "premature end of stream (expected to read {} bytes, got {} "
@@ -244,11 +335,11 @@ class CBORDecoder:
         length = self._decode_length(subtype, allow_indefinite=True)
         if length is None:
             # Indefinite length
-            buf = []
+            buf = bytearray()
             while True:
                 initial_byte = self.read(1)[0]
                 if initial_byte == 0xFF:
-                    result = b"".join(buf)
+                    result = bytes(buf)
                     break
                 elif initial_byte >> 5 == 2:
                     length = self._decode_length(initial_byte & 0x1F)
@@ -257,8 +348,7 @@ class CBORDecoder:
                             "invalid length for indefinite bytestring chunk 0x%x"
                             % length
                         )
-                    value = self.read(length)
-                    buf.append(value)
+                    buf += self.read(length)
                 else:
                     raise CBORDecodeValueError(
                         "non-bytestring found in indefinite length bytestring"
@@ -291,9 +381,11 @@ class CBORDecoder:
             # This precludes using the indefinite bytestring decoder above as
             # that would happily ignore UTF-8 characters split across chunks.
             buf = []
+            batch = []
             while True:
                 initial_byte = self.read(1)[0]
                 if initial_byte == 0xFF:
+                    buf.append("".join(batch))
                     result = "".join(buf)
                     break
                 elif initial_byte >> 5 == 3:
@@ -303,7 +395,10 @@ class CBORDecoder:
                             "invalid length for indefinite string chunk 0x%x" % length
                         )
                     value = self.read(length).decode("utf-8", self._str_errors)
-                    buf.append(value)
+                    batch.append(value)
+                    if len(batch) == JOIN_BATCH_SIZE:
+                        buf.append("".join(batch))
+                        batch = []
                 else:
                     raise CBORDecodeValueError(
                         "non-string found in indefinite length string"
@@ -346,7 +441,9 @@ class CBORDecoder:
     def decode_map(self, subtype):
         # Major tag 5
         length = self._decode_length(subtype, allow_indefinite=True)
-        if length is None:
+        if self._map_pairs:
+            return self._decode_pairs(length)
+        elif length is None:
             # Indefinite length
             dictionary = {}
             self.set_shareable(dictionary)
@@ -371,6 +468,31 @@ class CBORDecoder:
             self.set_shareable(dictionary)
         return dictionary
 
+    def _decode_pairs(self, length):
+        # Major tag 5 with map_type="pairs"; nothing is hashed, so the keys
+        # needn't be immutable
+        pairs = []
+        self.set_shareable(pairs)
+        if length is None:
+            while True:
+                key = self._decode(unshared=True)
+                if key is break_marker:
+                    break
+                else:
+                    pairs.append((key, self._decode(unshared=True)))
+        else:
+            for _ in range(length):
+                key = self._decode(unshared=True)
+                pairs.append((key, self._decode(unshared=True)))
+
+        if self._object_hook:
+            pairs = self._object_hook(self, pairs)
+            self.set_shareable(pairs)
+        elif self._immutable:
+            pairs = tuple(pairs)
+            self.set_shareable(pairs)
+        return pairs
+
     def decode_semantic(self, subtype):
         # Major tag 6
         tagnum = self._decode_length(subtype)
@@ -389,11 +511,11 @@ class CBORDecoder:
         # Simple value
         if subtype < 20:
             # XXX Set shareable?
-            return CBORSimpleValue(subtype)
+            return _simple_value_instances[subtype]
 
         # Major tag 7
         try:
-            return special_decoders[subtype](self)
+            return self._special_decoders[subtype](self)
         except KeyError as e:
             raise CBORDecodeValueError(
                 "Undefined Reserved major type 7 subtype 0x%x" % subtype
@@ -470,6 +592,7 @@ class CBORDecoder:
             exp, sig = self._decode()
         except (TypeError, ValueError) as e:
             raise CBORDecodeValueError("Incorrect tag 4 payload") from e
+        _check_decimal_digits(exp, sig)
         tmp = Decimal(sig).as_tuple()
         return self.set_shareable(Decimal((tmp.sign, tmp.digits, exp)))
 
@@ -481,6 +604,7 @@ class CBORDecoder:
             exp, sig = self._decode()
         except (TypeError, ValueError) as e:
             raise CBORDecodeValueError("Incorrect tag 5 payload") from e
+        _check_decimal_digits(exp, sig)
         return self.set_shareable(Decimal(sig) * (2 ** Decimal(exp)))
 
     def decode_stringref(self):
@@ -575,7 +699,13 @@ class CBORDecoder:
         # Semantic tag 261
         from ipaddress import ip_network
 
-        net_map = self.decode()
+        # the prefix is given as a map, whatever map_type is
+        old_map_pairs = self._map_pairs
+        self._map_pairs = False
+        try:
+            net_map = self.decode()
+        finally:
+            self._map_pairs = old_map_pairs
         if isinstance(net_map, Mapping) and len(net_map) == 1:
             for net in net_map.items():
                 try:
@@ -584,6 +714,19 @@ class CBORDecoder:
                     break
         raise CBORDecodeValueError("invalid ipnetwork value %r" % net_map)
 
+    def decode_extended_time(self):
+        # Semantic tag 1001
+        old_map_pairs = self._map_pairs
+        self._map_pairs = False
+        try:
+            fields = self._decode(unshared=True)
+        finally:
+            self._map_pairs = old_map_pairs
+        value = _extended_time(fields) if isinstance(fields, Mapping) else None
+        if value is None:
+            raise CBORDecodeValueError("invalid extended time value %r" % (fields,))
+        return self.set_shareable(value)
+
     def decode_self_describe_cbor(self):
         # Semantic tag 55799
         return self._decode()
@@ -594,7 +737,7 @@ class CBORDecoder:
 
     def decode_simple_value(self):
         # XXX Set shareable?
-        return CBORSimpleValue(self.read(1)[0])
+        return _simple_value_instances[self.read(1)[0]]
 
     def decode_float16(self):
         payload = self.read(2)
@@ -608,6 +751,164 @@ class CBORDecoder:
         return self.set_shareable(struct.unpack(">d", self.read(8))[0])
 
 
+class _BytesDecoder(CBORDecoder):
+    """
+    A :class:`CBORDecoder` specialised for data already in memory, as used by
+    :func:`loads`. Rather than calling ``read()`` on a file object for every
+    head, it walks a byte view of the buffer with an index. It has no ``fp``,
+    so :func:`loads` only uses it when there are no hooks that could ask for
+    one.
+    """
+
+    __slots__ = ("_buf", "_pos")
+
+    def __init__(
+        self,
+        buf,
+        tag_hook=None,
+        object_hook=None,
+        str_errors="strict",
+        map_type="dict",
+        immutable=False,
+    ):
+        self._buf = memoryview(buf).cast("B")
+        self._pos = 0
+        self.tag_hook = tag_hook
+        self.object_hook = object_hook
+        self.str_errors = str_errors
+        self.map_type = map_type
+        self._share_index = None
+        self._shareables = []
+        self._stringref_namespace = None
+        self._immutable = bool(immutable)
+
+    def _eof(self, amount):
+        return CBORDecodeEOF(
+            "premature end of stream (expected to read {} bytes, got {} "
+            "instead)".format(amount, max(len(self._buf) - self._pos, 0))
+        )
+
+    def _advance(self, amount):
+        # Move past the next amount bytes, returning their offset
+        pos = self._pos
+        end = pos + amount
+        if end > len(self._buf):
+            raise self._eof(amount)
+        self._pos = end
+        return pos
+
+    def read(self, amount):
+        pos = self._advance(amount)
+        return bytes(self._buf[pos : pos + amount])
+
+    def _decode(self, immutable=False, unshared=False):
+        if immutable:
+            old_immutable = self._immutable
+            self._immutable = True
+        if unshared:
+            old_index = self._share_index
+            self._share_index = None
+        try:
+            pos = self._pos
+            if pos >= len(self._buf):
+                raise self._eof(1)
+            initial_byte = self._buf[pos]
+            self._pos = pos + 1
+            return _bytes_major_decoders[initial_byte >> 5](self, initial_byte & 31)
+        finally:
+            if immutable:
+                self._immutable = old_immutable
+            if unshared:
+                self._share_index = old_index
+
+    def decode_from_bytes(self, buf):
+        old_buf, old_pos = self._buf, self._pos
+        self._buf, self._pos = memoryview(buf).cast("B"), 0
+        try:
+            return self._decode()
+        finally:
+            self._buf, self._pos = old_buf, old_pos
+
+    def _decode_length(self, subtype, allow_indefinite=False):
+        if subtype < 24:
+            return subtype
+        elif subtype == 24:
+            return self._buf[self._advance(1)]
+        elif subtype < 28:
+            unpacker = _length_structs[subtype]
+            return unpacker.unpack_from(self._buf, self._advance(unpacker.size))[0]
+        elif subtype == 31 and allow_indefinite:
+            return None
+        else:
+            raise CBORDecodeValueError(
+                "unknown unsigned integer subtype 0x%x" % subtype
+            )
+
+    def decode_uint(self, subtype):
+        # Major tag 0
+        value = subtype if subtype < 24 else self._decode_length(subtype)
+        if self._share_index is not None:
+            self._shareables[self._share_index] = value
+        return value
+
+    def decode_negint(self, subtype):
+        # Major tag 1
+        value = -1 - (subtype if subtype < 24 else self._decode_length(subtype))
+        if self._share_index is not None:
+            self._shareables[self._share_index] = value
+        return value
+
+    def decode_bytestring(self, subtype):
+        # Major tag 2
+        if subtype == 31:
+            return CBORDecoder.decode_bytestring(self, subtype)
+
+        length = subtype if subtype < 24 else self._decode_length(subtype)
+        if length > sys.maxsize:
+            raise CBORDecodeValueError("invalid length for bytestring 0x%x" % length)
+        pos = self._advance(length)
+        result = bytes(self._buf[pos : pos + length])
+        if self._stringref_namespace is not None:
+            self._stringref_namespace_add(result, length)
+        return self.set_shareable(result)
+
+    def decode_string(self, subtype):
+        # Major tag 3
+        if subtype == 31:
+            return CBORDecoder.decode_string(self, subtype)
+
+        length = subtype if subtype < 24 else self._decode_length(subtype)
+        if length > sys.maxsize:
+            raise CBORDecodeValueError("invalid length for string 0x%x" % length)
+        pos = self._advance(length)
+        result = str(self._buf[pos : pos + length], "utf-8", self._str_errors)
+        if self._stringref_namespace is not None:
+            self._stringref_namespace_add(result, length)
+        return self.set_shareable(result)
+
+    def decode_simple_value(self):
+        return _simple_value_instances[self._buf[self._advance(1)]]
+
+    def decode_float16(self):
+        return self.set_shareable(_float16.unpack_from(self._buf, self._advance(2))[0])
+
+    def decode_float32(self):
+        return self.set_shareable(_float32.unpack_from(self._buf, self._advance(4))[0])
+
+    def decode_float64(self):
+        return self.set_shareable(_float64.unpack_from(self._buf, self._advance(8))[0])
+
+
+_length_structs = {
+    25: struct.Struct(">H"),
+    26: struct.Struct(">L"),
+    27: struct.Struct(">Q"),
+}
+_float16 = struct.Struct(">e")
+_float32 = struct.Struct(">f")
+_float64 = struct.Struct(">d")
+
+
 major_decoders = {
     0: CBORDecoder.decode_uint,
     1: CBORDecoder.decode_negint,
@@ -631,6 +932,23 @@ special_decoders = {
     31: lambda self: break_marker,
 }
 
+_bytes_major_decoders = {
+    **major_decoders,
+    0: _BytesDecoder.decode_uint,
+    1: _BytesDecoder.decode_negint,
+    2: _BytesDecoder.decode_bytestring,
+    3: _BytesDecoder.decode_string,
+}
+
+CBORDecoder._special_decoders = special_decoders
+_BytesDecoder._special_decoders = {
+    **special_decoders,
+    24: _BytesDecoder.decode_simple_value,
+    25: _BytesDecoder.decode_float16,
+    26: _BytesDecoder.decode_float32,
+    27: _BytesDecoder.decode_float64,
+}
+
 semantic_decoders = {
     0: CBORDecoder.decode_datetime_string,
     1: CBORDecoder.decode_epoch_datetime,
@@ -649,10 +967,134 @@ semantic_decoders = {
     258: CBORDecoder.decode_set,
     260: CBORDecoder.decode_ipaddress,
     261: CBORDecoder.decode_ipnetwork,
+    1001: CBORDecoder.decode_extended_time,
     55799: CBORDecoder.decode_self_describe_cbor,
 }
 
 
+_EPOCH = datetime(1970, 1, 1, tzinfo=timezone.utc)
+# The keys of the fraction of a second in an extended time, and the
+# corresponding divisors
+_extended_time_fractions = {-key: 10**key for key in range(3, 19, 3)}
+
+
+def _extended_time(fields):
+    """
+    Return the datetime for the map of an extended time (semantic tag 1001),
+    or ``None`` if it's invalid or uses features not supported here.
+
+    The base time (key 1) is a number of seconds since the epoch, to which an
+    integer fraction of a second (in units of 10**key for a key from -3 to
+    -18) may be added when it's an integer. Other negative keys are critical
+    (they change the meaning of the value), so can't be ignored; positive
+    ones are elective, so they are. Digits beyond microseconds are dropped.
+    """
+    seconds = fields.get(1)
+    fraction = [key for key in fields if type(key) is int and key < 0]
+    try:
+        if type(seconds) is float and not fraction:
+            return datetime.fromtimestamp(seconds, timezone.utc)
+        elif type(seconds) is not int or len(fraction) > 1:
+            return None
+        microseconds = 0
+        if fraction:
+            divisor = _extended_time_fractions.get(fraction[0])
+            value = fields[fraction[0]]
+            if divisor is None or type(value) is not int or not 0 <= value < divisor:
+                return None
+            microseconds = value * 1000000 // divisor
+        return _EPOCH + timedelta(seconds=seconds, microseconds=microseconds)
+    except (OverflowError, ValueError, OSError):
+        return None
+
+
+class _Unsupported(Exception):
+    "Raised by :func:`_loads_native` for input it leaves to :class:`CBORDecoder`"
+
+
+_simple_values = {20: False, 21: True, 22: None, 23: undefined}
+
+
+def _loads_native(s, str_errors, top_immutable=False):
+    """
+    Decode the first item in *s* by building it straight from the tokens of the
+    native scanner, rather than reading it a head at a time. Only untagged
+    items of the basic types are handled; anything else (including malformed
+    data) raises :exc:`_Unsupported` for :class:`CBORDecoder` to deal with, so
+    the results and errors are the same either way. With *top_immutable*, the
+    item is built as it would be for a map key.
+    """
+    try:
+        buf = _ffi.from_buffer(s)
+    except (TypeError, ValueError):
+        raise _Unsupported
+
+    scanner = _ffi.new("CBORScanner *")
+    tok = _ffi.new("CBORToken *")
+    _lib.cbor_scanner_init(scanner, buf, len(buf))
+    # leave anything nested deeply enough to trouble the recursive decoder to
+    # it, so it fails the same way
+    scanner.max_depth = sys.getrecursionlimit() // 4
+    scanner_next = _lib.cbor_scanner_next
+    # Each frame is (type, immutable, items)
+    stack = []
+    try:
+        while True:
+            if scanner_next(scanner, tok) != 1:
+                raise _Unsupported
+
+            type_ = tok.type
+            if type_ == UINT:
+                value = tok.value
+            elif type_ == NEGINT:
+                value = -1 - tok.value
+            elif type_ == BYTES:
+                value = _ffi.buffer(tok.data, tok.value)[:]
+            elif type_ == TEXT:
+                try:
+                    value = _ffi.buffer(tok.data, tok.value)[:].decode("utf-8", str_errors)
+                except UnicodeDecodeError:
+                    raise _Unsupported
+            elif type_ == FLOAT:
+                value = tok.fvalue
+            elif type_ == SIMPLE:
+                value = tok.value
+                if value in _simple_values:
+                    value = _simple_values[value]
+                else:
+                    value = _simple_value_instances[value]
+            elif type_ == END:
+                type_, immutable, items = stack.pop()
+                if type_ == ARRAY:
+                    value = tuple(items) if immutable else items
+                elif type_ == MAP:
+                    value = dict(zip(items[::2], items[1::2]))
+                    if immutable:
+                        value = FrozenDict(value)
+                elif type_ == BYTES_INDEF:
+                    value = b"".join(items)
+                else:
+                    value = "".join(items)
+            elif type_ == TAG:
+                raise _Unsupported
+            else:
+                # the start of a container or indefinite length string; map
+                # keys and everything within them must be immutable
+                if stack:
+                    parent = stack[-1]
+                    immutable = parent[1] or (parent[0] == MAP and not tok.index % 2)
+                else:
+                    immutable = top_immutable
+                stack.append((type_, immutable, []))
+                continue
+
+            if not stack:
+                return value
+            stack[-1][2].append(value)
+    finally:
+        _lib.cbor_scanner_free(scanner)
+
+
 def loads(s, **kwargs):
     """
     Deserialize an object from a bytestring.
@@ -664,6 +1106,18 @@ def loads(s, **kwargs):
     :return:
         the deserialized object
     """
+    if _lib is not None and kwargs.keys() <= {"str_errors", "immutable"}:
+        str_errors = kwargs.get("str_errors", "strict")
+        if str_errors in ("strict", "replace"):
+            try:
+                return _loads_native(s, str_errors, bool(kwargs.get("immutable")))
+            except _Unsupported:
+                pass
+
+    if kwargs.get("tag_hook") is None and kwargs.get("object_hook") is None:
+        return _BytesDecoder(s, **kwargs).decode()
+
+    # hooks get the decoder, and may want its fp
     with BytesIO(s) as fp:
         return CBORDecoder(fp, **kwargs).decode()
 
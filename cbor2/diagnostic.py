@@ -0,0 +1,168 @@
+import math
+import re
+
+from .scanner import (
+    ARRAY,
+    BYTES,
+    BYTES_INDEF,
+    END,
+    FLOAT,
+    MAP,
+    NEGINT,
+    SIMPLE,
+    TAG,
+    TEXT,
+    TEXT_INDEF,
+    UINT,
+    CBORScanner,
+)
+from .types import CBORDecodeEOF, CBORDecodeValueError
+
+# Output is flushed to fp.write() (if given) whenever the buffer grows past
+# this size
+FLUSH_SIZE = 65536
+
+_text_escapes = {
+    ord('"'): b'\\"',
+    ord("\\"): b"\\\\",
+    ord("\b"): b"\\b",
+    ord("\f"): b"\\f",
+    ord("\n"): b"\\n",
+    ord("\r"): b"\\r",
+    ord("\t"): b"\\t",
+}
+_text_escape_re = re.compile(rb'["\\\x00-\x1f]')
+_simple_names = {20: b"false", 21: b"true", 22: b"null", 23: b"undefined"}
+_closers = {ARRAY: b"]", MAP: b"}"}
+
+
+def _escape_char(match):
+    char = match.group()[0]
+    return _text_escapes.get(char) or b"\\u%04x" % char
+
+
+def _indicator(tok):
+    # The encoding indicator (RFC 8610, appendix G.2) for heads that don't use
+    # the preferred (shortest) serialization of their argument
+    if not 24 <= tok.ai <= 27:
+        return b""
+    value = tok.value
+    if value < 24:
+        preferred = value
+    elif value < 0x100:
+        preferred = 24
+    elif value < 0x10000:
+        preferred = 25
+    elif value < 0x100000000:
+        preferred = 26
+    else:
+        preferred = 27
+    return b"" if tok.ai == preferred else b"_%d" % (tok.ai - 24)
+
+
+def _format_token(tok):
+    type_ = tok.type
+    if type_ == UINT:
+        return b"%d" % tok.value + _indicator(tok)
+    elif type_ == NEGINT:
+        return b"%d" % (-1 - tok.value) + _indicator(tok)
+    elif type_ == BYTES:
+        return b"h'" + tok.data.hex().encode("ascii") + b"'" + _indicator(tok)
+    elif type_ == TEXT:
+        text = _text_escape_re.sub(_escape_char, tok.data)
+        return b'"' + text + b'"' + _indicator(tok)
+    elif type_ in (BYTES_INDEF, TEXT_INDEF):
+        return b"(_ "
+    elif type_ in (ARRAY, MAP):
+        bracket = b"[" if type_ == ARRAY else b"{"
+        if tok.indefinite:
+            return bracket + b"_ "
+        indicator = _indicator(tok)
+        if indicator and tok.value:
+            # separate the indicator from the first item
+            indicator += b" "
+        return bracket + indicator
+    elif type_ == TAG:
+        return b"%d" % tok.value + _indicator(tok) + b"("
+    elif type_ == SIMPLE:
+        return _simple_names.get(tok.value) or b"simple(%d)" % tok.value
+    elif type_ == FLOAT:
+        value = tok.value
+        if math.isnan(value):
+            text = b"NaN"
+        elif math.isinf(value):
+            text = b"Infinity" if value > 0 else b"-Infinity"
+        else:
+            text = repr(value).encode("ascii")
+        return text + b"_%d" % (tok.ai - 24)
+    else:
+        return _closers.get(tok.closes, b")")
+
+
+def _separator(tok):
+    parent = tok.parent
+    if parent in (ARRAY, BYTES_INDEF, TEXT_INDEF):
+        return b", " if tok.index else b""
+    elif parent == MAP:
+        if tok.index % 2:
+            return b": "
+        return b", " if tok.index else b""
+    return b""
+
+
+def _decode_output(out):
+    # Text strings are copied through verbatim so the output may contain
+    # invalid UTF-8; it's better to show that than to fail
+    return out.decode("utf-8", errors="backslashreplace")
+
+
+def diagnose(data, sequence=False, fp=None):
+    """
+    Render the CBOR encoded *data* in the extended diagnostic notation
+    described by :rfc:`8949#section-8` and :rfc:`8610#appendix-G`.
+
+    The data is only tokenized, never decoded into Python objects, so any
+    well-formed input can be rendered regardless of its tags or its size.
+
+    :param data: a bytes-like object holding the encoded data
+    :param bool sequence:
+        if ``True``, treat *data* as a CBOR sequence (:rfc:`8742`) and render
+        each item on its own line; otherwise *data* must hold exactly one item
+    :param fp:
+        if given, the output is written to ``fp.write()`` in chunks as it is
+        produced (and ``None`` is returned) rather than being accumulated in
+        memory
+    :return: the diagnostic notation as a :class:`str`
+    :raises CBORDecodeError: if *data* is not well-formed
+    """
+    scanner = CBORScanner(data)
+    out = bytearray()
+    write = fp.write if fp is not None else None
+    found = False
+    for tok in scanner:
+        found = True
+        if tok.type != END:
+            out += _separator(tok)
+        out += _format_token(tok)
+        if scanner.item_done:
+            if sequence:
+                out += b"\n"
+            elif not scanner.at_end:
+                raise CBORDecodeValueError(
+                    "{} bytes of trailing data after the first item".format(
+                        scanner.length - scanner.pos
+                    )
+                )
+        if write and len(out) >= FLUSH_SIZE:
+            write(_decode_output(out))
+            del out[:]
+
+    if not (found or sequence):
+        raise CBORDecodeEOF("premature end of stream at offset 0")
+
+    if write:
+        if out:
+            write(_decode_output(out))
+        return None
+
+    return _decode_output(out)
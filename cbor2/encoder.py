@@ -3,7 +3,7 @@ import re
 import struct
 from collections import OrderedDict, defaultdict
 from contextlib import contextmanager
-from datetime import date, datetime, time, tzinfo
+from datetime import date, datetime, time, timezone, tzinfo
 from functools import wraps
 from io import BytesIO
 from sys import modules
@@ -17,6 +17,19 @@ from .types import (
     undefined,
 )
 
+# Output is collected in a buffer which is passed to fp.write() whenever it
+# grows past this size (and at the end of each encode() call); strings at least
+# this large are written directly
+FLUSH_SIZE = 8192
+
+_EPOCH = datetime(1970, 1, 1, tzinfo=timezone.utc)
+
+_head_uint8 = struct.Struct(">BB")
+_head_uint16 = struct.Struct(">BH")
+_head_uint32 = struct.Struct(">BL")
+_head_uint64 = struct.Struct(">BQ")
+_head_float64 = struct.Struct(">Bd")
+
 
 def shareable_encoder(func):
     """
@@ -72,6 +85,29 @@ def container_encoder(func):
     return wrapper
 
 
+class _WriteThrough:
+    """
+    Takes the place of the output buffer outside of :meth:`CBOREncoder.encode`
+    (e.g. when ``encode_length()`` is called directly), passing everything
+    straight on to the file.
+    """
+
+    __slots__ = ("write",)
+
+    def __init__(self, write):
+        self.write = write
+
+    def __len__(self):
+        return 0
+
+    def __iadd__(self, data):
+        self.write(data)
+        return self
+
+    def append(self, byte):
+        self.write(bytes((byte,)))
+
+
 class CBOREncoder:
     """
     The CBOREncoder class implements a fully featured `CBOR`_ encoder with
@@ -109,16 +145,27 @@ class CBOREncoder:
     :param bool string_referencing:
         set to ``True`` to allow more efficient serializing of repeated
         string values
+    :param bool datetime_as_extended_time:
+        set to ``True`` to serialize datetimes as extended times (CBOR tag
+        1001): integer seconds since the epoch plus, if needed, an integer
+        number of microseconds, so they're exact but as concise as
+        timestamps (this takes precedence over ``datetime_as_timestamp``,
+        and also loses the timezone information)
 
     .. _CBOR: https://cbor.io/
     """
 
     __slots__ = (
         "datetime_as_timestamp",
+        "datetime_as_extended_time",
         "_timezone",
         "_default",
         "value_sharing",
         "_fp_write",
+        "_write_through",
+        "_buffer",
+        "_encoding",
+        "_capture",
         "_shared_containers",
         "_encoders",
         "_canonical",
@@ -137,9 +184,13 @@ class CBOREncoder:
         canonical=False,
         date_as_datetime=False,
         string_referencing=False,
+        datetime_as_extended_time=False,
     ):
+        self._encoding = False  # true while inside encode()
+        self._capture = False  # true while inside encode_to_bytes()
         self.fp = fp
         self.datetime_as_timestamp = datetime_as_timestamp
+        self.datetime_as_extended_time = datetime_as_extended_time
         self.timezone = timezone
         self.value_sharing = value_sharing
         self.string_referencing = string_referencing
@@ -191,7 +242,13 @@ class CBOREncoder:
         except AttributeError:
             raise ValueError("fp object has no write method")
         else:
+            if self._encoding:
+                # anything already encoded belongs to the old file
+                self._flush()
             self._fp_write = value.write
+            self._write_through = _WriteThrough(value.write)
+            if not self._encoding:
+                self._buffer = self._write_through
 
     @property
     def timezone(self):
@@ -259,7 +316,23 @@ class CBOREncoder:
         :param bytes data:
             the bytes to write
         """
-        self._fp_write(data)
+        self._buffer += data
+
+    def _flush(self):
+        # Pass the buffered output to fp.write(), unless it's being collected
+        # by encode_to_bytes()
+        if self._buffer and not self._capture:
+            data = bytes(self._buffer)
+            del self._buffer[:]
+            self._fp_write(data)
+
+    def _write_payload(self, data):
+        if len(data) < FLUSH_SIZE or self._capture:
+            self._buffer += data
+        else:
+            # large enough to be worth passing on without a copy
+            self._flush()
+            self._fp_write(data)
 
     def encode(self, obj):
         """
@@ -268,6 +341,19 @@ class CBOREncoder:
         :param obj:
             the object to encode
         """
+        if not self._encoding:
+            # Output is buffered until the outermost call is done, and thrown
+            # away if it fails
+            self._encoding = True
+            self._buffer = bytearray()
+            try:
+                self.encode(obj)
+                self._flush()
+            finally:
+                self._encoding = False
+                self._buffer = self._write_through
+            return
+
         obj_type = obj.__class__
         encoder = (
             self._encoders.get(obj_type)
@@ -287,12 +373,18 @@ class CBOREncoder:
         object needs to be encoded separately from the rest but while still
         taking advantage of the shared value registry.
         """
-        with BytesIO() as fp:
-            old_fp = self.fp
-            self.fp = fp
+        old_buffer = self._buffer
+        old_encoding = self._encoding
+        old_capture = self._capture
+        self._buffer = bytearray()
+        self._encoding = self._capture = True
+        try:
             self.encode(obj)
-            self.fp = old_fp
-            return fp.getvalue()
+            return bytes(self._buffer)
+        finally:
+            self._buffer = old_buffer
+            self._encoding = old_encoding
+            self._capture = old_capture
 
     def encode_container(self, encoder, value):
         if self.string_namespacing:
@@ -365,15 +457,15 @@ class CBOREncoder:
     def encode_length(self, major_tag, length):
         major_tag <<= 5
         if length < 24:
-            self._fp_write(struct.pack(">B", major_tag | length))
+            self._buffer.append(major_tag | length)
         elif length < 256:
-            self._fp_write(struct.pack(">BB", major_tag | 24, length))
+            self._buffer += _head_uint8.pack(major_tag | 24, length)
         elif length < 65536:
-            self._fp_write(struct.pack(">BH", major_tag | 25, length))
+            self._buffer += _head_uint16.pack(major_tag | 25, length)
         elif length < 4294967296:
-            self._fp_write(struct.pack(">BL", major_tag | 26, length))
+            self._buffer += _head_uint32.pack(major_tag | 26, length)
         else:
-            self._fp_write(struct.pack(">BQ", major_tag | 27, length))
+            self._buffer += _head_uint64.pack(major_tag | 27, length)
 
     def encode_int(self, value):
         # Big integers (2 ** 64 and over)
@@ -397,11 +489,26 @@ class CBOREncoder:
                 return
 
         self.encode_length(2, len(value))
-        self._fp_write(value)
+        self._write_payload(value)
 
     def encode_bytearray(self, value):
         self.encode_bytestring(bytes(value))
 
+    def encode_buffer(self, value):
+        with memoryview(value) as view:
+            if not view.c_contiguous:
+                raise CBOREncodeValueError(f"cannot serialize non-contiguous buffer {value!r}")
+
+            if self.string_referencing:
+                # references are keyed by value, which needs something hashable
+                self.encode_bytestring(view.tobytes())
+                return
+
+            # not released here, as write() may hold on to it
+            data = view.cast("B")
+            self.encode_length(2, len(data))
+            self._write_payload(data)
+
     def encode_string(self, value):
         if self.string_referencing:
             if self._stringref(value):
@@ -409,20 +516,30 @@ class CBOREncoder:
 
         encoded = value.encode("utf-8")
         self.encode_length(3, len(encoded))
-        self._fp_write(encoded)
+        self._write_payload(encoded)
 
     @container_encoder
     def encode_array(self, value):
         self.encode_length(4, len(value))
         for item in value:
             self.encode(item)
+            if len(self._buffer) >= FLUSH_SIZE:
+                self._flush()
 
     @container_encoder
     def encode_map(self, value):
-        self.encode_length(5, len(value))
+        length = len(value)
+        self.encode_length(5, length)
+        count = 0
         for key, val in value.items():
             self.encode(key)
             self.encode(val)
+            count += 1
+            if len(self._buffer) >= FLUSH_SIZE:
+                self._flush()
+
+        if count != length:
+            raise CBOREncodeValueError(f"{type(value)!r} changed size during encoding")
 
     def encode_sortable_key(self, value):
         """
@@ -440,15 +557,20 @@ class CBOREncoder:
         keyed_keys = (
             (self.encode_sortable_key(key), key, value) for key, value in value.items()
         )
-        self.encode_length(5, len(value))
-        for sortkey, realkey, value in sorted(keyed_keys):
+        length = len(value)
+        keyed_keys = sorted(keyed_keys)
+        if len(keyed_keys) != length:
+            raise CBOREncodeValueError(f"{type(value)!r} changed size during encoding")
+
+        self.encode_length(5, length)
+        for sortkey, realkey, value in keyed_keys:
             if self.string_referencing:
                 # String referencing requires that the order encoded is
                 # the same as the order emitted so string references are
                 # generated after an order is determined
                 self.encode(realkey)
             else:
-                self._fp_write(sortkey[1])
+                self._buffer += sortkey[1]
             self.encode(value)
 
     def encode_semantic(self, value):
@@ -480,7 +602,16 @@ class CBOREncoder:
                     "has been set".format(value)
                 )
 
-        if self.datetime_as_timestamp:
+        if self.datetime_as_extended_time:
+            # Semantic tag 1001, with the fraction of a second in microseconds
+            # (key -6)
+            delta = value - _EPOCH
+            fields = {1: delta.days * 86400 + delta.seconds}
+            if delta.microseconds:
+                fields[-6] = delta.microseconds
+            with self.disable_value_sharing():
+                self.encode_semantic(CBORTag(1001, fields))
+        elif self.datetime_as_timestamp:
             from calendar import timegm
 
             if not value.microsecond:
@@ -499,9 +630,9 @@ class CBOREncoder:
     def encode_decimal(self, value):
         # Semantic tag 4
         if value.is_nan():
-            self._fp_write(b"\xf9\x7e\x00")
+            self._buffer += b"\xf9\x7e\x00"
         elif value.is_infinite():
-            self._fp_write(b"\xf9\x7c\x00" if value > 0 else b"\xf9\xfc\x00")
+            self._buffer += b"\xf9\x7c\x00" if value > 0 else b"\xf9\xfc\x00"
         else:
             dt = value.as_tuple()
             sig = 0
@@ -564,25 +695,25 @@ class CBOREncoder:
 
     def encode_simple_value(self, value):
         if value.value < 20:
-            self._fp_write(struct.pack(">B", 0xE0 | value.value))
+            self._buffer.append(0xE0 | value.value)
         else:
-            self._fp_write(struct.pack(">BB", 0xF8, value.value))
+            self._buffer += _head_uint8.pack(0xF8, value.value)
 
     def encode_float(self, value):
         # Handle special values efficiently
         if math.isnan(value):
-            self._fp_write(b"\xf9\x7e\x00")
+            self._buffer += b"\xf9\x7e\x00"
         elif math.isinf(value):
-            self._fp_write(b"\xf9\x7c\x00" if value > 0 else b"\xf9\xfc\x00")
+            self._buffer += b"\xf9\x7c\x00" if value > 0 else b"\xf9\xfc\x00"
         else:
-            self._fp_write(struct.pack(">Bd", 0xFB, value))
+            self._buffer += _head_float64.pack(0xFB, value)
 
     def encode_minimal_float(self, value):
         # Handle special values efficiently
         if math.isnan(value):
-            self._fp_write(b"\xf9\x7e\x00")
+            self._buffer += b"\xf9\x7e\x00"
         elif math.isinf(value):
-            self._fp_write(b"\xf9\x7c\x00" if value > 0 else b"\xf9\xfc\x00")
+            self._buffer += b"\xf9\x7c\x00" if value > 0 else b"\xf9\xfc\x00"
         else:
             # Try each encoding in turn from longest to shortest
             encoded = struct.pack(">Bd", 0xFB, value)
@@ -597,22 +728,25 @@ class CBOREncoder:
                 except OverflowError:
                     break
 
-            self._fp_write(encoded)
+            self._buffer += encoded
 
     def encode_boolean(self, value):
-        self._fp_write(b"\xf5" if value else b"\xf4")
+        self._buffer += b"\xf5" if value else b"\xf4"
 
     def encode_none(self, value):
-        self._fp_write(b"\xf6")
+        self._buffer += b"\xf6"
 
     def encode_undefined(self, value):
-        self._fp_write(b"\xf7")
+        self._buffer += b"\xf7"
 
 
 default_encoders = OrderedDict(
     [
         (bytes, CBOREncoder.encode_bytestring),
         (bytearray, CBOREncoder.encode_bytearray),
+        (memoryview, CBOREncoder.encode_buffer),
+        (("array", "array"), CBOREncoder.encode_buffer),
+        (("mmap", "mmap"), CBOREncoder.encode_buffer),
         (str, CBOREncoder.encode_string),
         (int, CBOREncoder.encode_int),
         (float, CBOREncoder.encode_float),
@@ -667,8 +801,7 @@ def dumps(obj, **kwargs):
 
     """
     with BytesIO() as fp:
-        dump(obj, fp, **kwargs)
-        return fp.getvalue()
+        return CBOREncoder(fp, **kwargs).encode_to_bytes(obj)
 
 
 def dump(obj, fp, **kwargs):
@@ -0,0 +1,66 @@
+"""
+Indexing of large documents, for decoding them in parts.
+
+A document whose top-level item is a big array or map can be indexed: a scan
+of its structure finds the offset of every item in it without decoding
+anything. :func:`cbor2.index_items` runs the scan in the C extension (without
+holding the GIL) where available. Each item can then be decoded on its own,
+from a slice of the document, in whatever order or by whichever worker the
+application likes::
+
+    type_, offsets, shared = cbor2.index_items(data)
+    data = memoryview(data)
+    for start, end in zip(offsets, offsets[1:]):
+        item = cbor2.loads(data[start:end])
+
+Shared values (tags 28 and 29) can refer to one another across items, so
+documents containing them must be decoded in one go instead.
+"""
+from .scanner import ARRAY, END, MAP, TAG, CBORScanner
+from .types import CBORDecodeEOF, CBORDecodeValueError
+
+
+def index_items(data):
+    """
+    Find the items of the array or map at the top of the CBOR encoded *data*
+    (looking through a self-describe tag, if any) without decoding them.
+
+    The result is a tuple of the type of the container (``"array"`` or
+    ``"map"``), a list holding the offset of each item in it (for maps, of
+    each key and value in turn) followed by the offset at which the last of
+    them ends, and whether any shared values (tags 28 or 29) were seen.
+
+    :param data: a bytes-like object holding the encoded data
+    :rtype: tuple
+    :raises CBORDecodeError: if *data* is not well-formed, or the top-level
+        item is not an array or map
+    """
+    scanner = CBORScanner(data)
+    depth = 0
+    tok = next(scanner, None)
+    if tok is not None and tok.type == TAG and tok.value == 55799:
+        depth = 1
+        tok = next(scanner, None)
+    if tok is None:
+        raise CBORDecodeEOF("premature end of stream at offset 0")
+    if tok.type == ARRAY:
+        type_ = "array"
+    elif tok.type == MAP:
+        type_ = "map"
+    else:
+        raise CBORDecodeValueError("the top-level item is not an array or map")
+
+    offsets = []
+    shared = False
+    for tok in scanner:
+        if tok.type == END:
+            if tok.depth == depth:
+                offsets.append(tok.offset)
+                break
+        else:
+            if tok.type == TAG and tok.value in (28, 29):
+                shared = True
+            if tok.depth == depth + 1:
+                offsets.append(tok.offset)
+
+    return type_, offsets, shared
@@ -0,0 +1,370 @@
+"""
+A pull-style tokenizer for CBOR data held in memory. This mirrors the
+tokenizer in ``source/scanner.c`` and is used by the pure Python versions of
+the tools which only need the structure of an encoded item rather than the
+decoded objects themselves.
+"""
+import struct
+
+from .types import CBORDecodeEOF, CBORDecodeValueError
+
+# Token types
+UINT = 0
+NEGINT = 1
+BYTES = 2
+TEXT = 3
+BYTES_INDEF = 4
+TEXT_INDEF = 5
+ARRAY = 6
+MAP = 7
+TAG = 8
+SIMPLE = 9
+FLOAT = 10
+END = 11
+
+PARENT_NONE = None
+
+_float_structs = {
+    25: struct.Struct(">e"),
+    26: struct.Struct(">f"),
+    27: struct.Struct(">d"),
+}
+
+
+class CBORToken:
+    """
+    A single token produced by :class:`CBORScanner`.
+
+    ``value`` holds the integer, length, tag number or simple value of the
+    head; for :data:`FLOAT` tokens it holds the decoded float, and for
+    :data:`END` tokens it holds the number of items in the container being
+    closed (whose type is given by ``closes``).
+    """
+
+    __slots__ = (
+        "type",
+        "ai",
+        "indefinite",
+        "parent",
+        "closes",
+        "value",
+        "index",
+        "data",
+        "offset",
+        "depth",
+    )
+
+    def __repr__(self):
+        return "CBORToken(type={}, value={!r}, offset={})".format(
+            self.type, self.value, self.offset
+        )
+
+
+class CBORScanner:
+    """
+    Iterate over the tokens of the CBOR data in *buf*. Iteration stops
+    cleanly only at the boundary between two top-level items.
+
+    :param buf: a bytes-like object holding the encoded data
+    :param int max_depth: maximum nesting depth of containers (0 for no limit)
+    """
+
+    __slots__ = ("_buf", "length", "pos", "_stack", "max_depth")
+
+    def __init__(self, buf, max_depth=0):
+        self._buf = memoryview(buf).cast("B")
+        self.length = len(self._buf)
+        self.pos = 0
+        # Each frame is [type, indefinite, remaining, count]
+        self._stack = []
+        self.max_depth = max_depth
+
+    @property
+    def depth(self):
+        return len(self._stack)
+
+    @property
+    def item_done(self):
+        "True if the last token returned completed a top-level item"
+        return not self._stack
+
+    @property
+    def at_end(self):
+        "True if the entire buffer has been consumed"
+        return self.pos >= self.length
+
+    def _eof(self, pos):
+        raise CBORDecodeEOF(f"premature end of stream at offset {pos}")
+
+    def _invalid(self, pos):
+        raise CBORDecodeValueError(f"invalid CBOR data at offset {pos}")
+
+    def _push(self, type_, indefinite, remaining):
+        if self.max_depth and len(self._stack) >= self.max_depth:
+            raise CBORDecodeValueError(
+                f"maximum nesting depth exceeded at offset {self.pos}"
+            )
+        self._stack.append([type_, indefinite, remaining, 0])
+
+    def _pop(self, tok):
+        frame = self._stack.pop()
+        tok.type = END
+        tok.closes = frame[0]
+        tok.indefinite = frame[1]
+        tok.value = frame[3]
+        tok.ai = 0
+        tok.data = None
+        tok.depth = len(self._stack)
+        tok.offset = self.pos
+        if self._stack:
+            tok.parent = self._stack[-1][0]
+            tok.index = self._stack[-1][3] - 1
+        else:
+            tok.parent = PARENT_NONE
+            tok.index = 0
+        return tok
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        stack = self._stack
+        buf = self._buf
+        tok = CBORToken()
+
+        # Close any definite containers which have received all their items
+        if stack:
+            parent = stack[-1]
+            if not parent[1] and parent[2] == 0:
+                return self._pop(tok)
+        else:
+            parent = None
+            if self.pos >= self.length:
+                raise StopIteration
+
+        start = self.pos
+        if start >= self.length:
+            self._eof(start)
+        lead = buf[start]
+        major = lead >> 5
+        ai = lead & 0x1F
+
+        if lead == 0xFF:
+            # break code
+            if not (parent and parent[1]):
+                self._invalid(start)
+            # an indefinite map must not end between a key and its value
+            if parent[0] == MAP and parent[3] % 2:
+                self._invalid(start)
+            self.pos += 1
+            self._pop(tok)
+            tok.offset = start
+            return tok
+
+        if ai < 24:
+            value = ai
+            arg_len = 0
+        elif ai < 28:
+            arg_len = 1 << (ai - 24)
+            if self.length - start - 1 < arg_len:
+                self._eof(start)
+            value = int.from_bytes(buf[start + 1 : start + 1 + arg_len], "big")
+        elif ai == 31 and 2 <= major <= 5:
+            value = 0
+            arg_len = 0
+        else:
+            self._invalid(start)
+
+        if parent and parent[0] in (BYTES_INDEF, TEXT_INDEF):
+            # chunks of indefinite length strings must be definite length
+            # strings of the same major type
+            if ai == 31 or major != (2 if parent[0] == BYTES_INDEF else 3):
+                self._invalid(start)
+
+        tok.ai = ai
+        tok.value = value
+        tok.offset = start
+        tok.depth = len(stack)
+        tok.indefinite = False
+        tok.closes = None
+        tok.data = None
+        if parent:
+            tok.parent = parent[0]
+            tok.index = parent[3]
+            parent[3] += 1
+            if not parent[1]:
+                parent[2] -= 1
+        else:
+            tok.parent = PARENT_NONE
+            tok.index = 0
+        self.pos = start + 1 + arg_len
+
+        if major == 0:
+            tok.type = UINT
+        elif major == 1:
+            tok.type = NEGINT
+        elif major in (2, 3):
+            if ai == 31:
+                tok.type = BYTES_INDEF if major == 2 else TEXT_INDEF
+                tok.indefinite = True
+                self._push(tok.type, True, 0)
+            else:
+                if value > self.length - self.pos:
+                    self._eof(start)
+                tok.type = BYTES if major == 2 else TEXT
+                tok.data = buf[self.pos : self.pos + value]
+                self.pos += value
+        elif major in (4, 5):
+            tok.type = ARRAY if major == 4 else MAP
+            tok.indefinite = ai == 31
+            if major == 5:
+                # the item count of the map must fit in 64 bits
+                if value > 0x7FFFFFFFFFFFFFFF:
+                    self._invalid(start)
+                value *= 2
+            self._push(tok.type, tok.indefinite, value)
+        elif major == 6:
+            tok.type = TAG
+            self._push(TAG, False, 1)
+        elif ai <= 24:
+            # two byte simple values below 32 are not well-formed
+            if ai == 24 and value < 32:
+                self._invalid(start)
+            tok.type = SIMPLE
+        else:
+            tok.type = FLOAT
+            tok.value = _float_structs[ai].unpack_from(buf, start + 1)[0]
+        return tok
+
+    def skip(self):
+        """
+        Skip over the next complete item (and all of its children). Returns
+        ``False`` if the end of the buffer was reached instead.
+        """
+        depth = len(self._stack)
+        try:
+            next(self)
+            while len(self._stack) > depth:
+                next(self)
+        except StopIteration:
+            return False
+        return True
+
+
+try:
+    from _cbor2_cffi import ffi as _ffi
+    from _cbor2_cffi import lib as _lib
+except ImportError:
+    _ffi = _lib = None
+
+
+class NativeCBORScanner:
+    """
+    A drop-in replacement for :class:`CBORScanner` running the tokenizer in
+    ``source/scanner.c`` through the ``_cbor2_cffi`` binding. This is only
+    built where the ``_cbor2`` extension isn't (i.e. on PyPy), and replaces
+    :class:`CBORScanner` when available.
+    """
+
+    __slots__ = ("_buf", "_cbuf", "_scanner", "_tok")
+
+    def __init__(self, buf, max_depth=0):
+        self._buf = memoryview(buf).cast("B")
+        self._cbuf = _ffi.from_buffer(self._buf)
+        scanner = _ffi.new("CBORScanner *")
+        _lib.cbor_scanner_init(scanner, self._cbuf, len(self._buf))
+        scanner.max_depth = max_depth
+        self._scanner = _ffi.gc(scanner, _lib.cbor_scanner_free)
+        self._tok = _ffi.new("CBORToken *")
+
+    @property
+    def length(self):
+        return self._scanner.length
+
+    @property
+    def pos(self):
+        return self._scanner.pos
+
+    @property
+    def max_depth(self):
+        return self._scanner.max_depth
+
+    @max_depth.setter
+    def max_depth(self, value):
+        self._scanner.max_depth = value
+
+    @property
+    def depth(self):
+        return self._scanner.depth
+
+    @property
+    def item_done(self):
+        "True if the last token returned completed a top-level item"
+        return self._scanner.depth == 0
+
+    @property
+    def at_end(self):
+        "True if the entire buffer has been consumed"
+        return self._scanner.pos >= self._scanner.length
+
+    def _raise(self):
+        scanner = self._scanner
+        if scanner.error == _lib.CBOR_SCAN_EOF:
+            raise CBORDecodeEOF(f"premature end of stream at offset {scanner.error_pos}")
+        elif scanner.error == _lib.CBOR_SCAN_TOO_DEEP:
+            raise CBORDecodeValueError(
+                f"maximum nesting depth exceeded at offset {scanner.error_pos}"
+            )
+        elif scanner.error == _lib.CBOR_SCAN_NOMEM:
+            raise MemoryError
+        else:
+            raise CBORDecodeValueError(f"invalid CBOR data at offset {scanner.error_pos}")
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        ctok = self._tok
+        ret = _lib.cbor_scanner_next(self._scanner, ctok)
+        if ret == 0:
+            raise StopIteration
+        elif ret == -1:
+            self._raise()
+
+        tok = CBORToken()
+        tok.type = type_ = ctok.type
+        tok.indefinite = ctok.indefinite
+        tok.parent = PARENT_NONE if ctok.parent == 0xFF else ctok.parent
+        tok.index = ctok.index
+        tok.offset = offset = ctok.offset
+        tok.depth = ctok.depth
+        tok.data = None
+        if type_ == END:
+            tok.ai = 0
+            tok.closes = ctok.closes
+        else:
+            tok.ai = ai = ctok.ai
+            tok.closes = None
+        if type_ == FLOAT:
+            tok.value = ctok.fvalue
+        else:
+            tok.value = value = ctok.value
+            if type_ in (BYTES, TEXT):
+                start = offset + 1 + (1 << (ai - 24) if ai >= 24 else 0)
+                tok.data = self._buf[start : start + value]
+        return tok
+
+    def skip(self):
+        """
+        Skip over the next complete item (and all of its children). Returns
+        ``False`` if the end of the buffer was reached instead.
+        """
+        ret = _lib.cbor_scanner_skip(self._scanner)
+        if ret == -1:
+            self._raise()
+        return ret == 1
+
+
+if _lib is not None:
+    PyCBORScanner = CBORScanner
+    CBORScanner = NativeCBORScanner
@@ -0,0 +1,251 @@
+import math
+import struct
+
+from .scanner import (
+    ARRAY,
+    BYTES,
+    BYTES_INDEF,
+    END,
+    FLOAT,
+    MAP,
+    NEGINT,
+    SIMPLE,
+    TAG,
+    TEXT,
+    TEXT_INDEF,
+    UINT,
+    CBORScanner,
+)
+from .types import CBORDecodeEOF, CBORDecodeValueError
+
+_major_names = {
+    UINT: "unsigned",
+    NEGINT: "negative",
+    BYTES: "bytes",
+    TEXT: "text",
+    BYTES_INDEF: "bytes",
+    TEXT_INDEF: "text",
+    ARRAY: "array",
+    MAP: "map",
+    TAG: "tag",
+    SIMPLE: "simple",
+    FLOAT: "float",
+}
+_size_names = {
+    BYTES: "bytes_sizes",
+    TEXT: "text_sizes",
+    BYTES_INDEF: "bytes_sizes",
+    TEXT_INDEF: "text_sizes",
+    ARRAY: "array_sizes",
+    MAP: "map_sizes",
+}
+_float_names = {25: "half", 26: "single", 27: "double"}
+_float_sizes = {25: 3, 26: 5, 27: 9}
+
+ROLE_NONE = 0
+ROLE_KEY = 1
+ROLE_VALUE = 2
+
+# Rough cost of a reference to a shared item in packed CBOR
+PACKED_REF_SIZE = 2
+# Size of the tag 256 head which opens a stringref namespace
+STRINGREF_NAMESPACE_SIZE = 3
+# Size of the tag 25 head of a stringref
+STRINGREF_TAG_SIZE = 2
+
+
+def _head_size(value):
+    if value < 24:
+        return 1
+    elif value < 0x100:
+        return 2
+    elif value < 0x10000:
+        return 3
+    elif value < 0x100000000:
+        return 5
+    else:
+        return 9
+
+
+def _stringref_threshold(index):
+    # Minimum length of a string which will be added to a stringref namespace
+    # already holding index strings (see CBORDecoder._stringref_namespace_add)
+    if index < 24:
+        return 3
+    elif index < 256:
+        return 4
+    elif index < 65536:
+        return 5
+    elif index < 4294967296:
+        return 7
+    else:
+        return 11
+
+
+def _add_size(histogram, value):
+    # Sizes are grouped into power of two buckets keyed by their lower bound
+    bucket = 1 << (value.bit_length() - 1) if value else 0
+    histogram[bucket] = histogram.get(bucket, 0) + 1
+
+
+def _minimum_float_width(value):
+    if math.isnan(value) or math.isinf(value):
+        return 25
+    for ai, format in ((25, ">e"), (26, ">f")):
+        try:
+            if struct.unpack(format, struct.pack(format, value))[0] == value:
+                return ai
+        except OverflowError:
+            pass
+    return 27
+
+
+def scan_stats(data, sequence=False):
+    """
+    Profile the structure of the CBOR encoded *data* without decoding it.
+
+    The result is a :class:`dict` holding the number of top-level ``items``
+    and input ``bytes``, a count of items by major type (``major_types``)
+    and tag number (``tags``), the number of ``indefinite`` length items, the
+    ``max_depth`` of nested containers and tags, and histograms of the lengths
+    of byte strings, text strings, arrays and maps. Each histogram maps the
+    lower bound of a power of two sized bucket to the number of items whose
+    length falls into it.
+
+    ``key_bytes`` and ``value_bytes`` hold the number of bytes spent on map
+    keys and values (attributed to the innermost map), and ``floats`` counts
+    floats by width along with how many of them could be encoded at a smaller
+    width without loss of precision.
+
+    Finally, ``repeated_strings`` is the number of distinct strings appearing
+    more than once, ``stringref_savings`` is the number of bytes that
+    encoding with ``string_referencing=True`` would save (negative if it
+    would cost more than it saves) and ``packed_savings`` is a rough estimate
+    of what sharing the repeated strings in a packed CBOR table would save.
+
+    :param data: a bytes-like object holding the encoded data
+    :param bool sequence:
+        if ``True``, treat *data* as a CBOR sequence (:rfc:`8742`); otherwise
+        *data* must hold exactly one item
+    :rtype: dict
+    :raises CBORDecodeError: if *data* is not well-formed
+    """
+    scanner = CBORScanner(data)
+    majors = dict.fromkeys(
+        ["unsigned", "negative", "bytes", "text", "array", "map", "tag", "simple", "float"],
+        0,
+    )
+    tags = {}
+    sizes = {"bytes_sizes": {}, "text_sizes": {}, "array_sizes": {}, "map_sizes": {}}
+    floats = dict.fromkeys(["half", "single", "double", "shrinkable", "shrink_savings"], 0)
+    items = indefinite = max_depth = key_bytes = value_bytes = 0
+    stringref_savings = 0
+    # Maps (major type, string) to [count, namespace, index]
+    strings = {}
+    namespace = namespace_size = 0
+    indef_length = 0
+    roles = []
+    pos = 0
+    for tok in scanner:
+        used = scanner.pos - pos
+        pos = scanner.pos
+        type_ = tok.type
+        if type_ == END:
+            role = roles.pop()
+        elif tok.parent == MAP:
+            role = ROLE_VALUE if tok.index % 2 else ROLE_KEY
+        elif tok.depth:
+            role = roles[-1]
+        else:
+            # start of a new top-level item (and stringref namespace)
+            role = ROLE_NONE
+            items += 1
+            namespace += 1
+            namespace_size = 0
+            stringref_savings -= STRINGREF_NAMESPACE_SIZE
+
+        if role == ROLE_KEY:
+            key_bytes += used
+        elif role == ROLE_VALUE:
+            value_bytes += used
+        max_depth = max(max_depth, scanner.depth)
+
+        if type_ == END:
+            if tok.closes in (BYTES_INDEF, TEXT_INDEF):
+                _add_size(sizes[_size_names[tok.closes]], indef_length)
+            elif tok.indefinite:
+                # the width of indefinite containers is only known now
+                width = tok.value // 2 if tok.closes == MAP else tok.value
+                _add_size(sizes[_size_names[tok.closes]], width)
+        elif type_ in (BYTES, TEXT) and tok.parent in (BYTES_INDEF, TEXT_INDEF):
+            indef_length += tok.value
+        else:
+            majors[_major_names[type_]] += 1
+            if tok.indefinite:
+                indefinite += 1
+            if type_ in (BYTES, TEXT):
+                length = tok.value
+                _add_size(sizes[_size_names[type_]], length)
+                entry = strings.setdefault((type_, bytes(tok.data)), [0, 0, 0])
+                entry[0] += 1
+                if entry[1] == namespace:
+                    stringref_savings += (
+                        _head_size(length) + length - STRINGREF_TAG_SIZE - _head_size(entry[2])
+                    )
+                elif length >= _stringref_threshold(namespace_size):
+                    entry[1] = namespace
+                    entry[2] = namespace_size
+                    namespace_size += 1
+            elif type_ in (BYTES_INDEF, TEXT_INDEF):
+                indef_length = 0
+            elif type_ in (ARRAY, MAP):
+                if not tok.indefinite:
+                    _add_size(sizes[_size_names[type_]], tok.value)
+            elif type_ == TAG:
+                tags[tok.value] = tags.get(tok.value, 0) + 1
+            elif type_ == FLOAT:
+                floats[_float_names[tok.ai]] += 1
+                minimum = _minimum_float_width(tok.value)
+                if minimum < tok.ai:
+                    floats["shrinkable"] += 1
+                    floats["shrink_savings"] += _float_sizes[tok.ai] - _float_sizes[minimum]
+
+            # remember the role of any container just opened for its children
+            if scanner.depth > tok.depth:
+                roles.append(role)
+
+        if scanner.item_done and not sequence and not scanner.at_end:
+            raise CBORDecodeValueError(
+                "{} bytes of trailing data after the first item".format(
+                    scanner.length - scanner.pos
+                )
+            )
+
+    if not (items or sequence):
+        raise CBORDecodeEOF("premature end of stream at offset 0")
+
+    repeated_strings = packed_savings = 0
+    for (type_, string), (count, _, _) in strings.items():
+        if count > 1:
+            repeated_strings += 1
+            size = _head_size(len(string)) + len(string)
+            packed_savings += max(0, size * count - size - count * PACKED_REF_SIZE)
+
+    return {
+        "items": items,
+        "bytes": scanner.length,
+        "major_types": majors,
+        "tags": dict(sorted(tags.items())),
+        "indefinite": indefinite,
+        "max_depth": max_depth,
+        "bytes_sizes": dict(sorted(sizes["bytes_sizes"].items())),
+        "text_sizes": dict(sorted(sizes["text_sizes"].items())),
+        "array_sizes": dict(sorted(sizes["array_sizes"].items())),
+        "map_sizes": dict(sorted(sizes["map_sizes"].items())),
+        "key_bytes": key_bytes,
+        "value_bytes": value_bytes,
+        "floats": floats,
+        "repeated_strings": repeated_strings,
+        "stringref_savings": stringref_savings,
+        "packed_savings": packed_savings,
+    }
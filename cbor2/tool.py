@@ -6,6 +6,7 @@ import fractions
 import io
 import ipaddress
 import json
+import mmap
 import re
 import sys
 import uuid
@@ -13,7 +14,7 @@ from collections import OrderedDict
 from datetime import datetime
 from functools import partial
 
-from . import CBORDecoder, load
+from . import CBORDecoder, diagnose, load, scan_stats
 from .types import FrozenDict
 
 try:
@@ -110,6 +111,43 @@ def key_to_str(d, dict_ids=None):
     return rval
 
 
+def read_input(infile, decode):
+    if decode:
+        return base64.b64decode(infile.read())
+    try:
+        # Map regular files instead of reading them so that large captures
+        # don't need to be copied into memory first
+        return mmap.mmap(infile.fileno(), 0, access=mmap.ACCESS_READ)
+    except (AttributeError, OSError, ValueError, io.UnsupportedOperation):
+        return infile.read()
+
+
+def write_diag(infile, outfile, sequence, decode):
+    data = read_input(infile, decode)
+    try:
+        diagnose(data, sequence=sequence, fp=outfile)
+        if not sequence:
+            outfile.write("\n")
+    except (ValueError, EOFError) as e:
+        raise SystemExit(e)
+    finally:
+        if isinstance(data, mmap.mmap):
+            data.close()
+
+
+def write_stats(infile, outfile, sequence, decode, pretty):
+    data = read_input(infile, decode)
+    try:
+        stats = scan_stats(data, sequence=sequence)
+    except (ValueError, EOFError) as e:
+        raise SystemExit(e)
+    finally:
+        if isinstance(data, mmap.mmap):
+            data.close()
+    json.dump(stats, outfile, indent=(None, 4)[pretty])
+    outfile.write("\n")
+
+
 def main():
     prog = "python -m cbor2.tool"
     description = (
@@ -152,6 +190,18 @@ def main():
         default=False,
         help="CBOR data is base64 encoded (handy for stdin)",
     )
+    parser.add_argument(
+        "--diag",
+        action="store_true",
+        default=False,
+        help="output extended diagnostic notation instead of JSON",
+    )
+    parser.add_argument(
+        "--stats",
+        action="store_true",
+        default=False,
+        help="output statistics on the structure of the data instead of the data itself",
+    )
     parser.add_argument(
         "-i",
         "--tag-ignore",
@@ -190,6 +240,12 @@ def main():
             if hasattr(infile, "buffer") and not decode:
                 infile = infile.buffer
             with infile:
+                if options.diag:
+                    write_diag(infile, outfile, sequence, decode)
+                    continue
+                elif options.stats:
+                    write_stats(infile, outfile, sequence, decode, pretty)
+                    continue
                 if decode:
                     infile = io.BytesIO(base64.b64decode(infile.read()))
                 try:
@@ -28,6 +28,7 @@ def check_libc():
 
 
 cpython = platform.python_implementation() == "CPython"
+pypy = platform.python_implementation() == "PyPy"
 windows = sys.platform.startswith("win")
 use_c_ext = os.environ.get("CBOR2_BUILD_C_EXTENSION", None)
 if use_c_ext == "1":
@@ -37,6 +38,10 @@ elif use_c_ext == "0":
 else:
     build_c_ext = cpython and (windows or check_libc())
 
+# PyPy gets a cffi binding of the scanner instead, which it runs much faster
+# than it can the C extension (through its CPython API emulation)
+build_cffi_ext = pypy and use_c_ext != "0"
+
 # Enable GNU features for libc's like musl, should have no effect
 # on Apple/BSDs
 if build_c_ext and not windows:
@@ -56,6 +61,11 @@ if build_c_ext:
             "source/decoder.c",
             "source/tags.c",
             "source/halffloat.c",
+            "source/scanner.c",
+            "source/emitter.c",
+            "source/diagnose.c",
+            "source/stats.c",
+            "source/index.c",
         ],
         optional=True,
     )
@@ -63,6 +73,14 @@ if build_c_ext:
 else:
     kwargs = {}
 
+if build_cffi_ext:
+    import runpy
+
+    ffibuilder = runpy.run_path("source/cffi_build.py")["ffibuilder"]
+    _cbor2_cffi = ffibuilder.distutils_extension(tmpdir="build")
+    _cbor2_cffi.optional = True
+    kwargs.setdefault("ext_modules", []).append(_cbor2_cffi)
+
 
 setup(
     use_scm_version={"version_scheme": "guess-next-dev", "local_scheme": "dirty-tag"},
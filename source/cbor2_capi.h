@@ -0,0 +1,81 @@
+#ifndef CBOR2_CAPI_H
+#define CBOR2_CAPI_H
+
+// The C API of the _cbor2 extension, for use by other extension modules
+// without going through Python calls. Copy this header into your project and
+// fetch the API once, typically in the module's init function:
+//
+//     static CBOR2_CAPI *cbor2_api;
+//
+//     cbor2_api = CBOR2_Import();
+//     if (!cbor2_api)
+//         return NULL;
+//
+//     bytes = cbor2_api->Dumps(value, NULL);
+//
+// Functions return a new reference (or 0) on success and NULL (or -1) with an
+// exception set on failure. Where they take kwargs, it may be NULL, None or a
+// dict of the keyword arguments accepted by cbor2.dumps() or cbor2.loads()
+// (other than the value and the file object).
+
+#include <Python.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CBOR2_CAPI_NAME "_cbor2._C_API"
+#define CBOR2_CAPI_VERSION 1
+
+// Receives the encoded output in chunks; returns 0 on success or -1 with an
+// exception set
+typedef int (*CBOR2_WriteFunc)(void *ctx, const uint8_t *buf, size_t length);
+
+typedef struct {
+    // the CBOR2_CAPI_VERSION _cbor2 was built with; newer versions only ever
+    // add members to the end of this structure
+    int version;
+
+    PyTypeObject *EncoderType;
+    PyTypeObject *DecoderType;
+    PyTypeObject *TagType;
+
+    // Encode obj, returning the result as a bytes object
+    PyObject *(*Dumps)(PyObject *obj, PyObject *kwargs);
+    // Encode obj, passing the output to write (with ctx)
+    int (*DumpTo)(PyObject *obj, PyObject *kwargs, CBOR2_WriteFunc write,
+                  void *ctx);
+    // Decode the item held in the length bytes at buf; the decoder reads
+    // them in place, so buf only needs to stay valid during the call
+    PyObject *(*Loads)(const char *buf, Py_ssize_t length, PyObject *kwargs);
+    // Create a CBORTag; value may be NULL, leaving it None
+    PyObject *(*Tag_New)(uint64_t tag, PyObject *value);
+    // Encode obj to the file object of an existing CBOREncoder
+    int (*Encoder_Encode)(PyObject *encoder, PyObject *obj);
+    // Decode the next item from an existing CBORDecoder
+    PyObject *(*Decoder_Decode)(PyObject *decoder);
+} CBOR2_CAPI;
+
+
+// Import cbor2 and return its C API, or NULL if it's unavailable (e.g. the
+// extension wasn't built) or older than this header
+static inline CBOR2_CAPI *
+CBOR2_Import(void)
+{
+    PyObject *cbor2;
+    CBOR2_CAPI *api;
+
+    // the extension relies on the cbor2 package having initialized it
+    cbor2 = PyImport_ImportModule("cbor2");
+    if (!cbor2)
+        return NULL;
+    Py_DECREF(cbor2);
+    api = (CBOR2_CAPI *) PyCapsule_Import(CBOR2_CAPI_NAME, 0);
+    if (api && api->version < CBOR2_CAPI_VERSION) {
+        PyErr_Format(PyExc_ImportError,
+                     "_cbor2 C API version %d is older than required (%d)",
+                     api->version, CBOR2_CAPI_VERSION);
+        return NULL;
+    }
+    return api;
+}
+
+#endif
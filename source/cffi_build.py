@@ -0,0 +1,62 @@
+"""
+cffi binding of the scanner, for Python implementations (like PyPy) which
+can't load the _cbor2 extension efficiently. setup.py builds this on PyPy;
+run it directly to build the ``_cbor2_cffi`` module in the current directory
+(with the intermediate files under ``build``).
+"""
+import os
+import sys
+
+from cffi import FFI
+
+here = os.path.dirname(os.path.abspath(__file__))
+windows = sys.platform.startswith("win")
+
+ffibuilder = FFI()
+ffibuilder.cdef(
+    """
+    typedef struct {
+        uint8_t type;
+        uint8_t ai;
+        bool indefinite;
+        uint8_t parent;
+        uint8_t closes;
+        uint64_t value;
+        uint64_t index;
+        double fvalue;
+        const uint8_t *data;
+        size_t offset;
+        size_t depth;
+        ...;
+    } CBORToken;
+
+    typedef struct {
+        size_t length;
+        size_t pos;
+        size_t depth;
+        size_t max_depth;
+        int error;
+        size_t error_pos;
+        ...;
+    } CBORScanner;
+
+    #define CBOR_SCAN_EOF ...
+    #define CBOR_SCAN_NOMEM ...
+    #define CBOR_SCAN_TOO_DEEP ...
+
+    void cbor_scanner_init(CBORScanner *, const uint8_t *, size_t);
+    void cbor_scanner_free(CBORScanner *);
+    int cbor_scanner_next(CBORScanner *, CBORToken *);
+    int cbor_scanner_skip(CBORScanner *);
+    """
+)
+ffibuilder.set_source(
+    "_cbor2_cffi",
+    '#include "scanner.h"',
+    sources=[os.path.join(here, "scanner.c")],
+    include_dirs=[here],
+    extra_compile_args=[] if windows else ["-std=c99", "-D_GNU_SOURCE"],
+)
+
+if __name__ == "__main__":
+    ffibuilder.compile(tmpdir="build", target=os.path.join(os.getcwd(), "_cbor2_cffi.*"))
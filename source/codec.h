@@ -0,0 +1,424 @@
+#ifndef CBOR2_CODEC_H
+#define CBOR2_CODEC_H
+
+// Byte-level kernels shared by the encoder, decoder and scanner. Nothing in
+// here depends on Python.h so they can be benchmarked in isolation (see
+// benchmarks/kernels.c).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// The largest head: the lead byte plus an 8 byte argument
+#define CBOR_MAX_HEAD_SIZE 9
+
+
+// Number of bytes needed to encode a head with the given argument
+static inline size_t
+cbor_head_size(uint64_t value)
+{
+    if (value < 24)
+        return 1;
+    else if (value <= UINT8_MAX)
+        return 2;
+    else if (value <= UINT16_MAX)
+        return 3;
+    else if (value <= UINT32_MAX)
+        return 5;
+    else
+        return 9;
+}
+
+
+// Write the shortest head for major type major and argument value to out
+// (which must have room for CBOR_MAX_HEAD_SIZE bytes) and return its length
+static inline size_t
+cbor_encode_head(uint8_t *out, uint8_t major, uint64_t value)
+{
+    major <<= 5;
+    if (value < 24) {
+        out[0] = major | (uint8_t) value;
+        return 1;
+    } else if (value <= UINT8_MAX) {
+        out[0] = major | 24;
+        out[1] = (uint8_t) value;
+        return 2;
+    } else if (value <= UINT16_MAX) {
+        out[0] = major | 25;
+        out[1] = (uint8_t) (value >> 8);
+        out[2] = (uint8_t) value;
+        return 3;
+    } else if (value <= UINT32_MAX) {
+        out[0] = major | 26;
+        out[1] = (uint8_t) (value >> 24);
+        out[2] = (uint8_t) (value >> 16);
+        out[3] = (uint8_t) (value >> 8);
+        out[4] = (uint8_t) value;
+        return 5;
+    } else {
+        out[0] = major | 27;
+        out[1] = (uint8_t) (value >> 56);
+        out[2] = (uint8_t) (value >> 48);
+        out[3] = (uint8_t) (value >> 40);
+        out[4] = (uint8_t) (value >> 32);
+        out[5] = (uint8_t) (value >> 24);
+        out[6] = (uint8_t) (value >> 16);
+        out[7] = (uint8_t) (value >> 8);
+        out[8] = (uint8_t) value;
+        return 9;
+    }
+}
+
+
+// Number of argument bytes following a lead byte with the given additional
+// information (subtype), or -1 if it doesn't take a plain argument (28-31)
+static inline int
+cbor_argument_size(uint8_t subtype)
+{
+    if (subtype < 24)
+        return 0;
+    else if (subtype < 28)
+        return 1 << (subtype - 24);
+    else
+        return -1;
+}
+
+
+// Read a big-endian argument of size bytes (1, 2, 4 or 8)
+static inline uint64_t
+cbor_read_argument(const uint8_t *p, int size)
+{
+    switch (size) {
+        case 1:
+            return p[0];
+        case 2:
+            return (uint64_t) p[0] << 8 | p[1];
+        case 4:
+            return (uint64_t) p[0] << 24 | (uint64_t) p[1] << 16 |
+                   (uint64_t) p[2] << 8 | p[3];
+        default:
+            return (uint64_t) p[0] << 56 | (uint64_t) p[1] << 48 |
+                   (uint64_t) p[2] << 40 | (uint64_t) p[3] << 32 |
+                   (uint64_t) p[4] << 24 | (uint64_t) p[5] << 16 |
+                   (uint64_t) p[6] << 8 | p[7];
+    }
+}
+
+
+// Minimum length of a string which is added to a stringref namespace that
+// already holds index strings; shorter strings would take more space as a
+// reference than they do inline
+static inline uint64_t
+cbor_stringref_min_length(uint64_t index)
+{
+    if (index < 24)
+        return 3;
+    else if (index < 256)
+        return 4;
+    else if (index < 65536)
+        return 5;
+    else if (index < 4294967296ULL)
+        return 7;
+    else
+        return 11;
+}
+
+
+// Return true if the length bytes at p are well-formed UTF-8 (no overlong
+// forms, surrogates or code points above U+10FFFF)
+static inline bool
+cbor_utf8_valid(const uint8_t *p, size_t length)
+{
+    const uint8_t *end = p + length;
+    uint64_t word;
+    uint8_t c;
+
+    while (p < end) {
+        // skip runs of ASCII a word at a time
+        while (end - p >= 8) {
+            memcpy(&word, p, 8);
+            if (word & 0x8080808080808080ULL)
+                break;
+            p += 8;
+        }
+        if (p == end)
+            break;
+        c = *p;
+        if (c < 0x80) {
+            p++;
+        } else if (c >= 0xC2 && c <= 0xDF) {
+            if (end - p < 2 || (p[1] & 0xC0) != 0x80)
+                return false;
+            p += 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            if (end - p < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 ||
+                    (c == 0xE0 && p[1] < 0xA0) || (c == 0xED && p[1] > 0x9F))
+                return false;
+            p += 3;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            if (end - p < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 ||
+                    (p[3] & 0xC0) != 0x80 || (c == 0xF0 && p[1] < 0x90) ||
+                    (c == 0xF4 && p[1] > 0x8F))
+                return false;
+            p += 4;
+        } else
+            return false;
+    }
+    return true;
+}
+
+
+// The most UTF-8 bytes a single code unit of the given width (1, 2 or 4 bytes,
+// as in a PEP 393 string) can take
+#define CBOR_UTF8_MAX_UNIT(kind) ((kind) == 1 ? 2 : (kind) == 2 ? 3 : 4)
+
+
+// Return the UTF-8 length of count code points held kind (1, 2 or 4) bytes
+// apiece at data, or SIZE_MAX if they include a surrogate (which UTF-8 can't
+// represent). The loops are branch-free so the compiler can vectorize them
+static inline size_t
+cbor_utf8_length(int kind, const void *data, size_t count)
+{
+    size_t i, length = count;
+    uint64_t word, high;
+    uint32_t c, surrogates = 0;
+
+    if (kind == 1) {
+        const uint8_t *p = data;
+
+        // add the number of bytes >= 0x80 (each of which takes two), a word
+        // at a time
+        for (i = 0; count - i >= 8; i += 8) {
+            memcpy(&word, p + i, 8);
+            high = (word >> 7) & 0x0101010101010101ULL;
+            length += (high * 0x0101010101010101ULL) >> 56;
+        }
+        for (; i < count; ++i)
+            length += p[i] >> 7;
+        return length;
+    } else if (kind == 2) {
+        const uint16_t *p = data;
+
+        for (i = 0; i < count; ++i) {
+            c = p[i];
+            length += (c >= 0x80) + (c >= 0x800);
+            surrogates |= (c & 0xF800) == 0xD800;
+        }
+    } else {
+        const uint32_t *p = data;
+
+        for (i = 0; i < count; ++i) {
+            c = p[i];
+            length += (c >= 0x80) + (c >= 0x800) + (c >= 0x10000);
+            surrogates |= (c & 0xFFFFF800) == 0xD800;
+        }
+    }
+    return surrogates ? SIZE_MAX : length;
+}
+
+
+// Write the code point c (not a surrogate) to out as UTF-8, returning the
+// number of bytes written
+static inline size_t
+cbor_utf8_put(uint8_t *out, uint32_t c)
+{
+    if (c < 0x80) {
+        out[0] = (uint8_t) c;
+        return 1;
+    } else if (c < 0x800) {
+        out[0] = (uint8_t) (0xC0 | c >> 6);
+        out[1] = (uint8_t) (0x80 | (c & 0x3F));
+        return 2;
+    } else if (c < 0x10000) {
+        out[0] = (uint8_t) (0xE0 | c >> 12);
+        out[1] = (uint8_t) (0x80 | (c >> 6 & 0x3F));
+        out[2] = (uint8_t) (0x80 | (c & 0x3F));
+        return 3;
+    } else {
+        out[0] = (uint8_t) (0xF0 | c >> 18);
+        out[1] = (uint8_t) (0x80 | (c >> 12 & 0x3F));
+        out[2] = (uint8_t) (0x80 | (c >> 6 & 0x3F));
+        out[3] = (uint8_t) (0x80 | (c & 0x3F));
+        return 4;
+    }
+}
+
+
+#if defined(_WIN32) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CBOR_LITTLE_ENDIAN 1
+#else
+#define CBOR_LITTLE_ENDIAN 0
+#endif
+
+// Store the low size (4 or 8) bytes of w at out, lowest first
+static inline void
+cbor_store_le(uint8_t *out, uint64_t w, int size)
+{
+#if CBOR_LITTLE_ENDIAN
+    uint32_t half = (uint32_t) w;
+
+    if (size == 8)
+        memcpy(out, &w, 8);
+    else
+        memcpy(out, &half, 4);
+#else
+    int i;
+
+    for (i = 0; i < size; ++i)
+        out[i] = (uint8_t) (w >> (8 * i));
+#endif
+}
+
+
+// Repeat the 16 or 32 bit value x in each lane of a 64 bit word
+#define CBOR_LANES16(x) ((uint64_t) (x) * 0x0001000100010001ULL)
+#define CBOR_LANES32(x) ((uint64_t) (x) * 0x0000000100000001ULL)
+
+// True if every 16 bit lane of w has a bit set within mask
+static inline bool
+cbor_lanes16_any(uint64_t w, uint16_t mask, int shift)
+{
+    // move the masked bits to the bottom of each lane and add a value that
+    // carries into the bit above them unless they're all clear
+    uint64_t bits = w >> shift & CBOR_LANES16(mask >> shift);
+
+    return ((bits + CBOR_LANES16(mask >> shift)) & CBOR_LANES16((mask >> shift) + 1))
+        == CBOR_LANES16((mask >> shift) + 1);
+}
+
+
+// The transcoding loops behind cbor_utf8_encode, one per string kind so that
+// nothing but the code points themselves is tested in them. The wider kinds
+// work through blocks of code points held in a 64 bit word: blocks needing
+// the same number of UTF-8 bytes for each (all ASCII, all two byte, ...) are
+// transcoded in all lanes of the word at once and stored a word at a time,
+// and only mixed blocks are written a code point at a time. Text in any one
+// script mostly comes in such blocks
+
+static inline size_t
+cbor_utf8_encode_ucs1(uint8_t *out, const uint8_t *p, size_t count)
+{
+    uint8_t *start = out;
+    uint64_t word;
+    size_t i = 0, end;
+    uint8_t c;
+
+    // at least one more code point follows each block, so writing both
+    // bytes of a sequence before knowing whether it needs them is safe
+    while (count - i > 8) {
+        memcpy(&word, p + i, 8);
+        if (!(word & 0x8080808080808080ULL)) {
+            memcpy(out, &word, 8);
+            out += 8;
+            i += 8;
+            continue;
+        }
+        for (end = i + 8; i < end; ++i) {
+            c = p[i];
+            out[0] = c < 0x80 ? c : (uint8_t) (0xC0 | c >> 6);
+            out[1] = (uint8_t) (0x80 | (c & 0x3F));
+            out += 1 + (c >> 7);
+        }
+    }
+    for (; i < count; ++i)
+        out += cbor_utf8_put(out, p[i]);
+    return out - start;
+}
+
+
+static inline size_t
+cbor_utf8_encode_ucs2(uint8_t *out, const uint16_t *p, size_t count)
+{
+    uint8_t *start = out;
+    uint64_t w, lead, mid, last;
+    size_t i, blocks = count & ~(size_t) 3;
+
+    for (i = 0; i < blocks; i += 4) {
+        w = (uint64_t) p[i] | (uint64_t) p[i + 1] << 16 |
+            (uint64_t) p[i + 2] << 32 | (uint64_t) p[i + 3] << 48;
+        last = (w & CBOR_LANES16(0x3F)) | CBOR_LANES16(0x80);
+        if (!(w & CBOR_LANES16(0xFF80))) {
+            // all ASCII: gather the low byte of each lane
+            w |= w >> 8;
+            w = (w & 0xFFFF) | (w >> 16 & 0xFFFF0000);
+            cbor_store_le(out, w, 4);
+            out += 4;
+        } else if (cbor_lanes16_any(w, 0xF800, 11)) {
+            // all three byte sequences (surrogates aren't expected here)
+            lead = (w >> 12 & CBOR_LANES16(0x0F)) | CBOR_LANES16(0xE0);
+            mid = (w >> 6 & CBOR_LANES16(0x3F)) | CBOR_LANES16(0x80);
+            lead |= mid << 8;
+            cbor_store_le(out,
+                (lead & 0xFFFF) | (last & 0xFF) << 16 |
+                (lead >> 16 & 0xFFFF) << 24 | (last >> 16 & 0xFF) << 40 |
+                (lead >> 32) << 48, 8);
+            cbor_store_le(out + 8,
+                (last >> 32 & 0xFF) | (lead >> 48) << 8 | (last >> 48) << 24, 4);
+            out += 12;
+        } else if (!(w & CBOR_LANES16(0xF800)) &&
+                   cbor_lanes16_any(w, 0x0780, 7)) {
+            // all two byte sequences: each fills its lane
+            lead = (w >> 6 & CBOR_LANES16(0x1F)) | CBOR_LANES16(0xC0);
+            cbor_store_le(out, lead | last << 8, 8);
+            out += 8;
+        } else {
+            out += cbor_utf8_put(out, p[i]);
+            out += cbor_utf8_put(out, p[i + 1]);
+            out += cbor_utf8_put(out, p[i + 2]);
+            out += cbor_utf8_put(out, p[i + 3]);
+        }
+    }
+    for (; i < count; ++i)
+        out += cbor_utf8_put(out, p[i]);
+    return out - start;
+}
+
+
+static inline size_t
+cbor_utf8_encode_ucs4(uint8_t *out, const uint32_t *p, size_t count)
+{
+    uint8_t *start = out;
+    uint64_t w;
+    size_t i, blocks = count & ~(size_t) 1;
+
+    for (i = 0; i < blocks; i += 2) {
+        w = (uint64_t) p[i] | (uint64_t) p[i + 1] << 32;
+        if (!(w & CBOR_LANES32(0xFFFFFF80))) {
+            out[0] = (uint8_t) w;
+            out[1] = (uint8_t) (w >> 32);
+            out += 2;
+        } else if ((w & 0x1F0000) && (w & 0x1F000000000000ULL)) {
+            // both four byte sequences, each filling its lane
+            w = ((w >> 18 & CBOR_LANES32(0x07)) | CBOR_LANES32(0xF0)) |
+                ((w >> 12 & CBOR_LANES32(0x3F)) | CBOR_LANES32(0x80)) << 8 |
+                ((w >> 6 & CBOR_LANES32(0x3F)) | CBOR_LANES32(0x80)) << 16 |
+                ((w & CBOR_LANES32(0x3F)) | CBOR_LANES32(0x80)) << 24;
+            cbor_store_le(out, w, 8);
+            out += 8;
+        } else {
+            out += cbor_utf8_put(out, p[i]);
+            out += cbor_utf8_put(out, p[i + 1]);
+        }
+    }
+    if (i < count)
+        out += cbor_utf8_put(out, p[i]);
+    return out - start;
+}
+
+
+// Write count code points held kind (1, 2 or 4) bytes apiece at data to out
+// as UTF-8, returning the number of bytes written. out must have room for
+// them (see cbor_utf8_length); surrogates are not checked for
+static inline size_t
+cbor_utf8_encode(uint8_t *out, int kind, const void *data, size_t count)
+{
+    switch (kind) {
+        case 1:  return cbor_utf8_encode_ucs1(out, data, count);
+        case 2:  return cbor_utf8_encode_ucs2(out, data, count);
+        default: return cbor_utf8_encode_ucs4(out, data, count);
+    }
+}
+
+#endif
@@ -11,11 +11,13 @@
 #include <endian.h>
 #endif
 #include <stdint.h>
+#include <inttypes.h>
 #include <math.h>
 #include <structmember.h>
 #include <datetime.h>
 #include "module.h"
 #include "halffloat.h"
+#include "codec.h"
 #include "tags.h"
 #include "decoder.h"
 
@@ -33,6 +35,16 @@
 // copied from cpython/Objects/bytesobject.c for bounds checks
 #define PyBytesObject_SIZE (offsetof(PyBytesObject, ob_sval) + 1)
 
+// Lengths claimed by the input are only trusted up to these sizes; beyond
+// them strings are read in growing chunks and arrays grow as their items
+// arrive, so a few bytes of input can't make the decoder allocate gigabytes
+#define READ_CHUNK_SIZE (1 << 20)
+#define PREALLOC_LIMIT 256
+
+// Chunks of indefinite length strings are joined in batches of this many so
+// that lots of tiny chunks don't cost much more memory than the result
+#define JOIN_BATCH_SIZE 1024
+
 enum DecodeOption {
     DECODE_NORMAL = 0,
     DECODE_IMMUTABLE = 1,
@@ -44,10 +56,13 @@ static int _CBORDecoder_set_fp(CBORDecoderObject *, PyObject *, void *);
 static int _CBORDecoder_set_tag_hook(CBORDecoderObject *, PyObject *, void *);
 static int _CBORDecoder_set_object_hook(CBORDecoderObject *, PyObject *, void *);
 static int _CBORDecoder_set_str_errors(CBORDecoderObject *, PyObject *, void *);
+static int _CBORDecoder_set_map_type(CBORDecoderObject *, PyObject *, void *);
 
 static PyObject * decode(CBORDecoderObject *, DecodeOptions);
 static PyObject * decode_bytestring(CBORDecoderObject *, uint8_t);
 static PyObject * decode_string(CBORDecoderObject *, uint8_t);
+static PyObject * decode_semantic(CBORDecoderObject *, uint8_t);
+static PyObject * decode_special(CBORDecoderObject *, uint8_t);
 static PyObject * CBORDecoder_decode_datetime_string(CBORDecoderObject *);
 static PyObject * CBORDecoder_decode_epoch_datetime(CBORDecoderObject *);
 static PyObject * CBORDecoder_decode_fraction(CBORDecoderObject *);
@@ -64,6 +79,7 @@ static PyObject * CBORDecoder_decode_float32(CBORDecoderObject *);
 static PyObject * CBORDecoder_decode_float64(CBORDecoderObject *);
 static PyObject * CBORDecoder_decode_ipaddress(CBORDecoderObject *);
 static PyObject * CBORDecoder_decode_ipnetwork(CBORDecoderObject *);
+static PyObject * CBORDecoder_decode_extended_time(CBORDecoderObject *);
 static PyObject * CBORDecoder_decode_self_describe_cbor(CBORDecoderObject *);
 
 static PyObject * CBORDecoder_decode_shareable(CBORDecoderObject *);
@@ -138,7 +154,11 @@ CBORDecoder_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
         self->object_hook = Py_None;
         self->str_errors = PyBytes_FromString("strict");
         self->immutable = false;
+        self->map_pairs = false;
         self->shared_index = -1;
+        self->buf = NULL;
+        self->buf_length = 0;
+        self->buf_pos = 0;
     }
     return (PyObject *) self;
 error:
@@ -147,22 +167,24 @@ error:
 }
 
 
-// CBORDecoder.__init__(self, fp=None, tag_hook=None, object_hook=None,
-//                      str_errors='strict')
-int
-CBORDecoder_init(CBORDecoderObject *self, PyObject *args, PyObject *kwargs)
+static int
+decoder_init(CBORDecoderObject *self, PyObject *args, PyObject *kwargs,
+             const char *format)
 {
     static char *keywords[] = {
-        "fp", "tag_hook", "object_hook", "str_errors", NULL
+        "fp", "tag_hook", "object_hook", "str_errors", "map_type",
+        "immutable", NULL
     };
     PyObject *fp = NULL, *tag_hook = NULL, *object_hook = NULL,
-             *str_errors = NULL;
+             *str_errors = NULL, *map_type = NULL;
+    int immutable = 0;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOO", keywords,
-                &fp, &tag_hook, &object_hook, &str_errors))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords,
+                &fp, &tag_hook, &object_hook, &str_errors, &map_type,
+                &immutable))
         return -1;
 
-    if (_CBORDecoder_set_fp(self, fp, NULL) == -1)
+    if (fp && _CBORDecoder_set_fp(self, fp, NULL) == -1)
         return -1;
     if (tag_hook && _CBORDecoder_set_tag_hook(self, tag_hook, NULL) == -1)
         return -1;
@@ -170,6 +192,9 @@ CBORDecoder_init(CBORDecoderObject *self, PyObject *args, PyObject *kwargs)
         return -1;
     if (str_errors && _CBORDecoder_set_str_errors(self, str_errors, NULL) == -1)
         return -1;
+    if (map_type && _CBORDecoder_set_map_type(self, map_type, NULL) == -1)
+        return -1;
+    self->immutable = immutable;
 
     if (!_CBOR2_FrozenDict && _CBOR2_init_FrozenDict() == -1)
         return -1;
@@ -178,13 +203,43 @@ CBORDecoder_init(CBORDecoderObject *self, PyObject *args, PyObject *kwargs)
 }
 
 
+// CBORDecoder.__init__(self, fp=None, tag_hook=None, object_hook=None,
+//                      str_errors='strict', map_type='dict', immutable=False)
+int
+CBORDecoder_init(CBORDecoderObject *self, PyObject *args, PyObject *kwargs)
+{
+    return decoder_init(self, args, kwargs, "O|OOOOp");
+}
+
+
+// Initialize a decoder reading from the length bytes at buf rather than from
+// a file object (for the C API); kwargs holds the other __init__ arguments.
+// The buffer must outlive the decoder, or be detached with
+// CBORDecoder_init_buffer(self, NULL, 0, NULL) once decoding is done
+int
+CBORDecoder_init_buffer(CBORDecoderObject *self, const char *buf,
+                        Py_ssize_t length, PyObject *kwargs)
+{
+    self->buf = buf;
+    self->buf_length = length;
+    self->buf_pos = 0;
+    if (!buf)
+        return 0;
+    return decoder_init(self, _CBOR2_empty_tuple, kwargs, "|OOOOOp");
+}
+
+
 // Property accessors ////////////////////////////////////////////////////////
 
 // CBORDecoder._get_fp(self)
 static PyObject *
 _CBORDecoder_get_fp(CBORDecoderObject *self, void *closure)
 {
-    PyObject *ret = PyMethod_GET_SELF(self->read);
+    PyObject *ret;
+
+    if (self->buf)
+        Py_RETURN_NONE;
+    ret = PyMethod_GET_SELF(self->read);
     Py_INCREF(ret);
     return ret;
 }
@@ -211,6 +266,7 @@ _CBORDecoder_set_fp(CBORDecoderObject *self, PyObject *value, void *closure)
     tmp = self->read;
     self->read = read;
     Py_DECREF(tmp);
+    self->buf = NULL;
     return 0;
 }
 
@@ -330,6 +386,39 @@ _CBORDecoder_set_str_errors(CBORDecoderObject *self, PyObject *value,
 }
 
 
+// CBORDecoder._get_map_type(self)
+static PyObject *
+_CBORDecoder_get_map_type(CBORDecoderObject *self, void *closure)
+{
+    return PyUnicode_FromString(self->map_pairs ? "pairs" : "dict");
+}
+
+
+// CBORDecoder._set_map_type(self, value)
+static int
+_CBORDecoder_set_map_type(CBORDecoderObject *self, PyObject *value,
+                          void *closure)
+{
+    if (!value) {
+        PyErr_SetString(PyExc_AttributeError,
+                        "cannot delete map_type attribute");
+        return -1;
+    }
+    if (PyUnicode_Check(value)) {
+        if (!PyUnicode_CompareWithASCIIString(value, "dict")) {
+            self->map_pairs = false;
+            return 0;
+        } else if (!PyUnicode_CompareWithASCIIString(value, "pairs")) {
+            self->map_pairs = true;
+            return 0;
+        }
+    }
+    PyErr_Format(PyExc_ValueError,
+            "invalid map_type value %R (must be 'dict' or 'pairs')", value);
+    return -1;
+}
+
+
 // CBORDecoder._get_immutable(self, value)
 static PyObject *
 _CBORDecoder_get_immutable(CBORDecoderObject *self, void *closure)
@@ -343,6 +432,23 @@ _CBORDecoder_get_immutable(CBORDecoderObject *self, void *closure)
 
 // Utility functions /////////////////////////////////////////////////////////
 
+static int
+buf_check(CBORDecoderObject *self, const Py_ssize_t size)
+{
+    Py_ssize_t remaining = self->buf_length - self->buf_pos;
+
+    if (size > remaining) {
+        self->buf_pos = self->buf_length;
+        PyErr_Format(
+            _CBOR2_CBORDecodeEOF,
+            "premature end of stream (expected to read %zd bytes, "
+            "got %zd instead)", size, remaining);
+        return -1;
+    }
+    return 0;
+}
+
+
 static int
 fp_read(CBORDecoderObject *self, char *buf, const Py_ssize_t size)
 {
@@ -350,6 +456,13 @@ fp_read(CBORDecoderObject *self, char *buf, const Py_ssize_t size)
     char *data;
     int ret = -1;
 
+    if (self->buf) {
+        if (buf_check(self, size) == -1)
+            return -1;
+        memcpy(buf, self->buf + self->buf_pos, size);
+        self->buf_pos += size;
+        return 0;
+    }
     size_obj = PyLong_FromSsize_t(size);
     if (size_obj) {
         obj = PyObject_CallFunctionObjArgs(self->read, size_obj, NULL);
@@ -373,24 +486,77 @@ fp_read(CBORDecoderObject *self, char *buf, const Py_ssize_t size)
 }
 
 
+static PyObject *
+fp_read_object(CBORDecoderObject *self, const Py_ssize_t size)
+{
+    PyObject *chunks = NULL, *obj, *size_obj, *ret = NULL;
+    Py_ssize_t pos = 0, chunk = size;
+
+    if (self->buf) {
+        if (buf_check(self, size) == -1)
+            return NULL;
+        ret = PyBytes_FromStringAndSize(self->buf + self->buf_pos, size);
+        if (ret)
+            self->buf_pos += size;
+        return ret;
+    }
+    // Large reads are made in chunks (each as large as everything read so
+    // far) as file objects allocate the full amount requested up front
+    if (size > READ_CHUNK_SIZE) {
+        chunks = PyList_New(0);
+        if (!chunks)
+            return NULL;
+        chunk = READ_CHUNK_SIZE;
+    }
+    while (1) {
+        size_obj = PyLong_FromSsize_t(chunk);
+        if (!size_obj)
+            break;
+        obj = PyObject_CallFunctionObjArgs(self->read, size_obj, NULL);
+        Py_DECREF(size_obj);
+        if (!obj)
+            break;
+        assert(PyBytes_CheckExact(obj));
+        if (PyBytes_GET_SIZE(obj) != chunk) {
+            PyErr_Format(
+                _CBOR2_CBORDecodeEOF,
+                "premature end of stream (expected to read %zd bytes, "
+                "got %zd instead)", size, pos + PyBytes_GET_SIZE(obj));
+            Py_DECREF(obj);
+            break;
+        }
+        if (!chunks) {
+            ret = obj;
+            break;
+        }
+        if (PyList_Append(chunks, obj) == -1) {
+            Py_DECREF(obj);
+            break;
+        }
+        Py_DECREF(obj);
+        pos += chunk;
+        if (pos == size) {
+            ret = PyObject_CallMethodObjArgs(
+                    _CBOR2_empty_bytes, _CBOR2_str_join, chunks, NULL);
+            break;
+        }
+        chunk = pos < size - pos ? pos : size - pos;
+    }
+    Py_XDECREF(chunks);
+    return ret;
+}
+
+
 // CBORDecoder.read(self, length) -> bytes
 static PyObject *
 CBORDecoder_read(CBORDecoderObject *self, PyObject *length)
 {
-    PyObject *ret = NULL;
     Py_ssize_t len;
 
     len = PyLong_AsSsize_t(length);
     if (PyErr_Occurred())
         return NULL;
-    ret = PyBytes_FromStringAndSize(NULL, len);
-    if (ret) {
-        if (fp_read(self, PyBytes_AS_STRING(ret), len) == -1) {
-            Py_DECREF(ret);
-            ret = NULL;
-        }
-    }
-    return ret;
+    return fp_read_object(self, len);
 }
 
 
@@ -422,33 +588,19 @@ static int
 decode_length(CBORDecoderObject *self, uint8_t subtype,
         uint64_t *length, bool *indefinite)
 {
-    union {
-        union { uint64_t value; char buf[sizeof(uint64_t)]; } u64;
-        union { uint32_t value; char buf[sizeof(uint32_t)]; } u32;
-        union { uint16_t value; char buf[sizeof(uint16_t)]; } u16;
-        union { uint8_t value;  char buf[sizeof(uint8_t)];  } u8;
-    } value;
-
-    if (subtype < 28) {
-        if (subtype < 24) {
-            *length = subtype;
-        } else if (subtype == 24) {
-            if (fp_read(self, value.u8.buf, sizeof(uint8_t)) == -1)
-                return -1;
-            *length = value.u8.value;
-        } else if (subtype == 25) {
-            if (fp_read(self, value.u16.buf, sizeof(uint16_t)) == -1)
-                return -1;
-            *length = be16toh(value.u16.value);
-        } else if (subtype == 26) {
-            if (fp_read(self, value.u32.buf, sizeof(uint32_t)) == -1)
-                return -1;
-            *length = be32toh(value.u32.value);
-        } else {
-            if (fp_read(self, value.u64.buf, sizeof(uint64_t)) == -1)
-                return -1;
-            *length = be64toh(value.u64.value);
-        }
+    uint8_t buf[sizeof(uint64_t)];
+    int size;
+
+    size = cbor_argument_size(subtype);
+    if (size == 0) {
+        *length = subtype;
+        if (indefinite)
+            *indefinite = false;
+        return 0;
+    } else if (size > 0) {
+        if (fp_read(self, (char *) buf, size) == -1)
+            return -1;
+        *length = cbor_read_argument(buf, size);
         if (indefinite)
             *indefinite = false;
         return 0;
@@ -468,20 +620,8 @@ string_namespace_add(CBORDecoderObject *self, PyObject *string, uint64_t length)
 {
     if (self->stringref_namespace != Py_None) {
         uint64_t next_index = PyList_GET_SIZE(self->stringref_namespace);
-        bool is_referenced = true;
-        if (next_index < 24) {
-            is_referenced = length >= 3;
-        } else if (next_index < 256) {
-            is_referenced = length >= 4;
-        } else if (next_index < 65536) {
-            is_referenced = length >= 5;
-        } else if (next_index < 4294967296ull) {
-            is_referenced = length >= 7;
-        } else {
-            is_referenced = length >= 11;
-        }
 
-        if (is_referenced) {
+        if (length >= cbor_stringref_min_length(next_index)) {
             return PyList_Append(self->stringref_namespace, string);
         }
     }
@@ -492,89 +632,34 @@ string_namespace_add(CBORDecoderObject *self, PyObject *string, uint64_t length)
 
 // Major decoders ////////////////////////////////////////////////////////////
 
-static PyObject *
-decode_uint(CBORDecoderObject *self, uint8_t subtype)
-{
-    // major type 0
-    uint64_t length;
-    PyObject *ret;
-
-    if (decode_length(self, subtype, &length, NULL) == -1)
-        return NULL;
-    ret = PyLong_FromUnsignedLongLong(length);
-    set_shareable(self, ret);
-    return ret;
-}
-
-
-static PyObject *
-decode_negint(CBORDecoderObject *self, uint8_t subtype)
-{
-    // major type 1
-    PyObject *value, *one, *ret = NULL;
-
-    value = decode_uint(self, subtype);
-    if (value) {
-        one = PyLong_FromLong(1);
-        if (one) {
-            ret = PyNumber_Negative(value);
-            if (ret) {
-                Py_DECREF(value);
-                value = ret;
-                ret = PyNumber_Subtract(value, one);
-                set_shareable(self, ret);
-            }
-            Py_DECREF(one);
-        }
-        Py_DECREF(value);
-    }
-    return ret;
-}
-
-
-static PyObject *
-decode_definite_bytestring(CBORDecoderObject *self, Py_ssize_t length)
-{
-    PyObject *ret = NULL;
-
-    ret = PyBytes_FromStringAndSize(NULL, length);
-    if (!ret)
-        return NULL;
-    if (fp_read(self, PyBytes_AS_STRING(ret), length) == -1) {
-        Py_DECREF(ret);
-        return NULL;
-    }
-    if (string_namespace_add(self, ret, length) == -1) {
-        Py_DECREF(ret);
-        return NULL;
-    }
-    return ret;
-}
-
-
 static PyObject *
 decode_indefinite_bytestrings(CBORDecoderObject *self)
 {
-    PyObject *list, *ret = NULL;
+    PyObject *buf, *chunk, *ret = NULL;
     LeadByte lead;
 
-    list = PyList_New(0);
-    if (list) {
+    // The chunks are accumulated in a bytearray rather than a list as the
+    // latter costs a pointer (and usually an object) per chunk
+    buf = PyByteArray_FromStringAndSize(NULL, 0);
+    if (buf) {
         while (1) {
             if (fp_read(self, &lead.byte, 1) == -1)
                 break;
             if (lead.major == 2 && lead.subtype != 31) {
-                ret = decode_bytestring(self, lead.subtype);
-                if (ret) {
-                    PyList_Append(list, ret);
+                chunk = decode_bytestring(self, lead.subtype);
+                if (chunk) {
+                    ret = PySequence_InPlaceConcat(buf, chunk);
+                    Py_DECREF(chunk);
+                    if (!ret)
+                        break;
                     Py_DECREF(ret);
                     ret = NULL;
                 } else {
                     break;
                 }
             } else if (lead.major == 7 && lead.subtype == 31) { // break-code
-                ret = PyObject_CallMethodObjArgs(
-                        _CBOR2_empty_bytes, _CBOR2_str_join, list, NULL);
+                ret = PyBytes_FromStringAndSize(
+                        PyByteArray_AS_STRING(buf), PyByteArray_GET_SIZE(buf));
                 break;
             } else {
                 PyErr_SetString(
@@ -583,36 +668,8 @@ decode_indefinite_bytestrings(CBORDecoderObject *self)
                 break;
             }
         }
-        Py_DECREF(list);
-    }
-    return ret;
-}
-
-
-static PyObject *
-decode_bytestring(CBORDecoderObject *self, uint8_t subtype)
-{
-    // major type 2
-    uint64_t length = 0;
-    bool indefinite = true;
-    PyObject *ret;
-    char length_hex[17];
-
-    if (decode_length(self, subtype, &length, &indefinite) == -1)
-        return NULL;
-
-    if (length > (uint64_t)PY_SSIZE_T_MAX - (uint64_t)PyBytesObject_SIZE) {
-        sprintf(length_hex, "%llX", length);
-        PyErr_Format(
-                _CBOR2_CBORDecodeValueError,
-                "excessive bytestring size 0x%s", length_hex);
-        return NULL;
+        Py_DECREF(buf);
     }
-    if (indefinite)
-        ret = decode_indefinite_bytestrings(self);
-    else
-        ret = decode_definite_bytestring(self, (Py_ssize_t)length);
-    set_shareable(self, ret);
     return ret;
 }
 
@@ -631,25 +688,20 @@ decode_bytestring(CBORDecoderObject *self, uint8_t subtype)
 // happily ignore UTF-8 characters split across chunks.
 
 
-static PyObject *
-decode_definite_string(CBORDecoderObject *self, Py_ssize_t length)
+static int
+join_strings(PyObject *batch, PyObject *joined)
 {
-    PyObject *ret = NULL;
-    char *buf;
-
-    buf = PyMem_Malloc(length);
-    if (!buf)
-        return PyErr_NoMemory();
+    PyObject *str;
+    int ret;
 
-    if (fp_read(self, buf, length) == 0)
-        ret = PyUnicode_DecodeUTF8(
-                buf, length, PyBytes_AS_STRING(self->str_errors));
-    PyMem_Free(buf);
-
-    if (string_namespace_add(self, ret, length) == -1) {
-        Py_DECREF(ret);
-        return NULL;
-    }
+    str = PyObject_CallMethodObjArgs(
+            _CBOR2_empty_str, _CBOR2_str_join, batch, NULL);
+    if (!str)
+        return -1;
+    ret = PyList_Append(joined, str);
+    Py_DECREF(str);
+    if (ret == 0)
+        ret = PyList_SetSlice(batch, 0, PY_SSIZE_T_MAX, NULL);
     return ret;
 }
 
@@ -657,26 +709,37 @@ decode_definite_string(CBORDecoderObject *self, Py_ssize_t length)
 static PyObject *
 decode_indefinite_strings(CBORDecoderObject *self)
 {
-    PyObject *list, *ret = NULL;
+    PyObject *batch, *joined, *ret = NULL;
     LeadByte lead;
 
-    list = PyList_New(0);
-    if (list) {
+    batch = PyList_New(0);
+    if (!batch)
+        return NULL;
+    joined = PyList_New(0);
+    if (joined) {
         while (1) {
             if (fp_read(self, &lead.byte, 1) == -1)
                 break;
             if (lead.major == 3 && lead.subtype != 31) {
                 ret = decode_string(self, lead.subtype);
                 if (ret) {
-                    PyList_Append(list, ret);
+                    if (PyList_Append(batch, ret) == -1) {
+                        Py_DECREF(ret);
+                        ret = NULL;
+                        break;
+                    }
                     Py_DECREF(ret);
                     ret = NULL;
+                    if (PyList_GET_SIZE(batch) == JOIN_BATCH_SIZE &&
+                            join_strings(batch, joined) == -1)
+                        break;
                 } else {
                     break;
                 }
             } else if (lead.major == 7 && lead.subtype == 31) { // break-code
-                ret = PyObject_CallMethodObjArgs(
-                        _CBOR2_empty_str, _CBOR2_str_join, list, NULL);
+                if (join_strings(batch, joined) == 0)
+                    ret = PyObject_CallMethodObjArgs(
+                            _CBOR2_empty_str, _CBOR2_str_join, joined, NULL);
                 break;
             } else {
                 PyErr_SetString(
@@ -685,262 +748,29 @@ decode_indefinite_strings(CBORDecoderObject *self)
                 break;
             }
         }
-        Py_DECREF(list);
-    }
-    return ret;
-}
-
-
-static PyObject *
-decode_string(CBORDecoderObject *self, uint8_t subtype)
-{
-    // major type 3
-    uint64_t length = 0;
-    bool indefinite = true;
-    PyObject *ret;
-    char length_hex[17];
-
-    if (decode_length(self, subtype, &length, &indefinite) == -1)
-        return NULL;
-    if (length > (uint64_t)PY_SSIZE_T_MAX - (uint64_t)PyBytesObject_SIZE) {
-        sprintf(length_hex, "%llX", length);
-        PyErr_Format(
-                _CBOR2_CBORDecodeValueError,
-                "excessive string size 0x%s", length_hex);
-        return NULL;
-    }
-    if (indefinite)
-        ret = decode_indefinite_strings(self);
-    else
-        ret = decode_definite_string(self, (Py_ssize_t)length);
-    set_shareable(self, ret);
-    return ret;
-}
-
-
-static PyObject *
-decode_indefinite_array(CBORDecoderObject *self)
-{
-    PyObject *array, *item, *ret = NULL;
-
-    array = PyList_New(0);
-    if (array) {
-        ret = array;
-        set_shareable(self, array);
-        while (ret) {
-            item = decode(self, DECODE_UNSHARED);
-            if (item == break_marker) {
-                Py_DECREF(item);
-                break;
-            } else if (item) {
-                if (PyList_Append(array, item) == -1)
-                    ret = NULL;
-                Py_DECREF(item);
-            } else
-                ret = NULL;
-        }
-        if (ret && self->immutable) {
-            ret = PyList_AsTuple(array);
-            if (ret) {
-                Py_DECREF(array);
-                // There's a potential here for an indefinite length recursive
-                // array to wind up with a strange representation (the outer
-                // being a tuple, the inners all being a list). However, a
-                // recursive tuple isn't valid in the first place so it's a bit
-                // of a waste of time searching for recursive references just
-                // to throw an error
-                set_shareable(self, ret);
-            } else
-                ret = NULL;
-        }
-        if (!ret)
-            Py_DECREF(array);
-    }
-    return ret;
-}
-
-
-static PyObject *
-decode_definite_array(CBORDecoderObject *self, Py_ssize_t length)
-{
-    Py_ssize_t i;
-    PyObject *array, *item, *ret = NULL;
-    if (length > 65536) {
-        // Let cPython manage allocation of huge lists by appending
-        // items one-by-one
-        array = PyList_New(0);
-        if (array) {
-            ret = array;
-            set_shareable(self, array);
-            for (i = 0; i < length; ++i) {
-                item = decode(self, DECODE_UNSHARED);
-                if (item) {
-                    if (PyList_Append(array, item) == -1) {
-                        ret = NULL;
-                        Py_DECREF(item);
-                        break;
-                    }
-                    Py_DECREF(item);
-                } else {
-                    ret = NULL;
-                    break;
-                }
-            }
-            if (ret && self->immutable) {
-                ret = PyList_AsTuple(array);
-                if (ret) {
-                    Py_DECREF(array);
-                    // There's a potential here for an indefinite length recursive
-                    // array to wind up with a strange representation (the outer
-                    // being a tuple, the inners all being a list). However, a
-                    // recursive tuple isn't valid in the first place so it's a bit
-                    // of a waste of time searching for recursive references just
-                    // to throw an error
-                    set_shareable(self, ret);
-                } else
-                    ret = NULL;
-            }
-            if (!ret)
-                Py_DECREF(array);
-        }
-    } else {
-        if (self->immutable) {
-            array = PyTuple_New(length);
-            if (array) {
-                ret = array;
-                for (i = 0; i < length; ++i) {
-                    item = decode(self, DECODE_UNSHARED);
-                    if (item)
-                        PyTuple_SET_ITEM(array, i, item);
-                    else {
-                        ret = NULL;
-                        break;
-                    }
-                }
-            }
-            // This is done *after* the construction of the tuple because while
-            // it's valid for a tuple object to be shared, it's not valid for it to
-            // contain a reference to itself (because a reference to it can't exist
-            // during its own construction ... in Python at least; as can be seen
-            // above this *is* theoretically possible at the C level).
-            set_shareable(self, ret);
-        } else {
-            array = PyList_New(length);
-            if (array) {
-                ret = array;
-                set_shareable(self, array);
-                for (i = 0; i < length; ++i) {
-                    item = decode(self, DECODE_UNSHARED);
-                    if (item)
-                        PyList_SET_ITEM(array, i, item);
-                    else {
-                        ret = NULL;
-                        break;
-                    }
-                }
-            }
-        }
-        if (!ret)
-            Py_DECREF(array);
+        Py_DECREF(joined);
     }
+    Py_DECREF(batch);
     return ret;
 }
 
 
-static PyObject *
-decode_array(CBORDecoderObject *self, uint8_t subtype)
-{
-    // major type 4
-    uint64_t length;
-    bool indefinite = true;
-    char length_hex[17];
+// The full variant keeps the plain names, used by the semantic decoders and
+// the public methods; the others are only entered from decode_top()
+#define VARIANT(name) name
+#define WITH_HOOKS 1
+#define WITH_SHARING 1
+#include "decoder_variant.h"
 
-    if (decode_length(self, subtype, &length, &indefinite) == -1)
-        return NULL;
-    if (indefinite)
-        return decode_indefinite_array(self);
-    if (length > (uint64_t)PY_SSIZE_T_MAX) {
-        sprintf(length_hex, "%llX", length);
-        PyErr_Format(
-                _CBOR2_CBORDecodeValueError,
-                "excessive array size 0x%s", length_hex);
-        return NULL;
-    } else
-        return decode_definite_array(self, (Py_ssize_t) length);
-}
-
-
-static PyObject *
-decode_map(CBORDecoderObject *self, uint8_t subtype)
-{
-    // major type 5
-    uint64_t length;
-    bool indefinite = true;
-    PyObject *map, *key, *value, *ret = NULL;
+#define VARIANT(name) name##_plain
+#define WITH_HOOKS 0
+#define WITH_SHARING 0
+#include "decoder_variant.h"
 
-    map = PyDict_New();
-    if (map) {
-        ret = map;
-        set_shareable(self, map);
-        if (decode_length(self, subtype, &length, &indefinite) == 0) {
-            if (indefinite) {
-                while (ret) {
-                    key = decode(self, DECODE_IMMUTABLE | DECODE_UNSHARED);
-                    if (key == break_marker) {
-                        Py_DECREF(key);
-                        break;
-                    } else if (key) {
-                        value = decode(self, DECODE_UNSHARED);
-                        if (value) {
-                            if (PyDict_SetItem(map, key, value) == -1)
-                                ret = NULL;
-                            Py_DECREF(value);
-                        } else
-                            ret = NULL;
-                        Py_DECREF(key);
-                    } else
-                        ret = NULL;
-                }
-            } else {
-                while (ret && length--) {
-                    key = decode(self, DECODE_IMMUTABLE | DECODE_UNSHARED);
-                    if (key) {
-                        value = decode(self, DECODE_UNSHARED);
-                        if (value) {
-                            if (PyDict_SetItem(map, key, value) == -1)
-                                ret = NULL;
-                            Py_DECREF(value);
-                        } else
-                            ret = NULL;
-                        Py_DECREF(key);
-                    } else
-                        ret = NULL;
-                }
-            }
-        } else
-            ret = NULL;
-        if (!ret)
-            Py_DECREF(map);
-    }
-    if (ret && self->immutable) {
-        // _CBOR2_FrozenDict is initialized in CBORDecoder_init
-        map = PyObject_CallFunctionObjArgs(_CBOR2_FrozenDict, ret, NULL);
-        if (map) {
-            set_shareable(self, map);
-            Py_DECREF(ret);
-            ret = map;
-        }
-    }
-    if (ret && self->object_hook != Py_None) {
-        map = PyObject_CallFunctionObjArgs(self->object_hook, self, ret, NULL);
-        if (map) {
-            set_shareable(self, map);
-            Py_DECREF(ret);
-            ret = map;
-        }
-    }
-    return ret;
-}
+#define VARIANT(name) name##_hooks
+#define WITH_HOOKS 1
+#define WITH_SHARING 0
+#include "decoder_variant.h"
 
 
 // Semantic decoders /////////////////////////////////////////////////////////
@@ -971,6 +801,7 @@ decode_semantic(CBORDecoderObject *self, uint8_t subtype)
             case 258:   ret = CBORDecoder_decode_set(self);             break;
             case 260:   ret = CBORDecoder_decode_ipaddress(self);       break;
             case 261:   ret = CBORDecoder_decode_ipnetwork(self);       break;
+            case 1001:  ret = CBORDecoder_decode_extended_time(self);   break;
             case 55799: ret = CBORDecoder_decode_self_describe_cbor(self);
                 break;
 
@@ -1184,6 +1015,51 @@ CBORDecoder_decode_negative_bignum(CBORDecoderObject *self)
 }
 
 
+static int
+check_decimal_digits(PyObject *payload)
+{
+    // Converting an int to a Decimal takes time quadratic in its size so,
+    // like int to str conversions, only ints of up to
+    // sys.get_int_max_str_digits() digits (4300 by default) are accepted
+    PyObject *value, *func, *obj;
+    Py_ssize_t i, limit = 4300, bits;
+    int overflow;
+
+    for (i = 0; i < PyTuple_GET_SIZE(payload); ++i) {
+        value = PyTuple_GET_ITEM(payload, i);
+        if (!PyLong_Check(value))
+            continue;
+        PyLong_AsLongLongAndOverflow(value, &overflow);
+        if (!overflow)
+            continue;
+        func = PySys_GetObject("get_int_max_str_digits");
+        if (func) {
+            obj = PyObject_CallFunctionObjArgs(func, NULL);
+            if (!obj)
+                return -1;
+            limit = PyLong_AsSsize_t(obj);
+            Py_DECREF(obj);
+            if (limit == -1 && PyErr_Occurred())
+                return -1;
+        }
+        obj = PyObject_CallMethod(value, "bit_length", NULL);
+        if (!obj)
+            return -1;
+        bits = PyLong_AsSsize_t(obj);
+        Py_DECREF(obj);
+        if (bits == -1 && PyErr_Occurred())
+            return -1;
+        if (limit && bits / 10 * 3 > limit) {
+            PyErr_Format(
+                _CBOR2_CBORDecodeValueError,
+                "%zd bit integer is too large to convert to a Decimal", bits);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
 // CBORDecoder.decode_fraction(self)
 static PyObject *
 CBORDecoder_decode_fraction(CBORDecoderObject *self)
@@ -1199,6 +1075,10 @@ CBORDecoder_decode_fraction(CBORDecoderObject *self)
     payload_t = decode(self, DECODE_IMMUTABLE | DECODE_UNSHARED);
     if (payload_t) {
         if (PyTuple_CheckExact(payload_t) && PyTuple_GET_SIZE(payload_t) == 2) {
+            if (check_decimal_digits(payload_t) == -1) {
+                Py_DECREF(payload_t);
+                return NULL;
+            }
             exp = PyTuple_GET_ITEM(payload_t, 0);
             sig = PyTuple_GET_ITEM(payload_t, 1);
             tmp = PyObject_CallFunction(_CBOR2_Decimal, "O", sig);
@@ -1239,6 +1119,10 @@ CBORDecoder_decode_bigfloat(CBORDecoderObject *self)
     tuple = decode(self, DECODE_IMMUTABLE | DECODE_UNSHARED);
     if (tuple) {
         if (PyTuple_CheckExact(tuple) && PyTuple_GET_SIZE(tuple) == 2) {
+            if (check_decimal_digits(tuple) == -1) {
+                Py_DECREF(tuple);
+                return NULL;
+            }
             exp = PyTuple_GET_ITEM(tuple, 0);
             sig = PyTuple_GET_ITEM(tuple, 1);
             two = PyObject_CallFunction(_CBOR2_Decimal, "i", 2);
@@ -1537,10 +1421,18 @@ CBORDecoder_decode_ipnetwork(CBORDecoderObject *self)
     // semantic type 261
     PyObject *map, *tuple, *bytes, *prefixlen, *ret = NULL;
     Py_ssize_t pos = 0;
+    bool map_pairs, immutable;
 
     if (!_CBOR2_ip_network && _CBOR2_init_ip_address() == -1)
         return NULL;
+    // the prefix is given as a dict, whatever map_type and immutable are
+    map_pairs = self->map_pairs;
+    immutable = self->immutable;
+    self->map_pairs = false;
+    self->immutable = false;
     map = decode(self, DECODE_UNSHARED);
+    self->map_pairs = map_pairs;
+    self->immutable = immutable;
     if (map) {
         if (PyDict_CheckExact(map) && PyDict_Size(map) == 1) {
             if (PyDict_Next(map, &pos, &bytes, &prefixlen)) {
@@ -1574,6 +1466,141 @@ CBORDecoder_decode_ipnetwork(CBORDecoderObject *self)
 }
 
 
+// The date the given number of days after 1970-01-01 (of the proleptic
+// Gregorian calendar), from http://howardhinnant.github.io/date_algorithms.html
+static void
+civil_from_days(int64_t z, int *y, int *m, int *d)
+{
+    int64_t era;
+    unsigned doe, yoe, doy, mp;
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = (unsigned) (z - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int) (yoe + era * 400 + (*m <= 2));
+}
+
+// The seconds since the epoch of 0001-01-01T00:00:00Z and
+// 9999-12-31T23:59:59Z, the range of datetime
+#define MIN_EPOCH_SECONDS (-62135596800LL)
+#define MAX_EPOCH_SECONDS 253402300799LL
+
+// CBORDecoder.decode_extended_time(self)
+static PyObject *
+CBORDecoder_decode_extended_time(CBORDecoderObject *self)
+{
+    // semantic type 1001; the base time (key 1) is a number of seconds since
+    // the epoch, to which an integer fraction of a second (in units of
+    // 10**key for a key from -3 to -18) may be added when it's an integer.
+    // Other negative keys are critical (they change the meaning of the
+    // value) so can't be ignored; positive ones are elective, so they are.
+    // Digits beyond microseconds are dropped.
+    PyObject *map, *key, *value, *seconds = NULL, *fraction = NULL, *tuple,
+             *ret = NULL;
+    Py_ssize_t pos = 0;
+    long k, fraction_key = 0;
+    long long secs, frac, divisor = 1;
+    int64_t days, sod, micros = 0;
+    int overflow, y, m, d;
+    bool map_pairs, immutable, valid = true;
+
+    if (!_CBOR2_timezone_utc && _CBOR2_init_timezone_utc() == -1)
+        return NULL;
+    // the fields are given as a plain map, whatever the context
+    map_pairs = self->map_pairs;
+    immutable = self->immutable;
+    self->map_pairs = false;
+    self->immutable = false;
+    map = decode(self, DECODE_UNSHARED);
+    self->map_pairs = map_pairs;
+    self->immutable = immutable;
+    if (!map)
+        return NULL;
+
+    if (!PyDict_Check(map))
+        valid = false;
+    while (valid && PyDict_Next(map, &pos, &key, &value)) {
+        if (!PyLong_CheckExact(key))
+            continue;
+        k = PyLong_AsLongAndOverflow(key, &overflow);
+        if (overflow > 0)
+            continue;
+        if (overflow < 0 || (k < 0 && fraction))
+            valid = false;
+        else if (k == 1)
+            seconds = value;
+        else if (k < 0) {
+            fraction_key = k;
+            fraction = value;
+        }
+    }
+
+    if (!valid || !seconds) {
+        valid = false;
+    } else if (PyFloat_CheckExact(seconds) && !fraction) {
+        tuple = PyTuple_Pack(2, seconds, _CBOR2_timezone_utc);
+        if (tuple) {
+            ret = PyDateTime_FromTimestamp(tuple);
+            Py_DECREF(tuple);
+        }
+        if (!ret && (
+                PyErr_ExceptionMatches(PyExc_OverflowError) ||
+                PyErr_ExceptionMatches(PyExc_ValueError) ||
+                PyErr_ExceptionMatches(PyExc_OSError))) {
+            PyErr_Clear();
+            valid = false;
+        }
+    } else if (PyLong_CheckExact(seconds)) {
+        secs = PyLong_AsLongLongAndOverflow(seconds, &overflow);
+        if (overflow || secs < MIN_EPOCH_SECONDS || secs > MAX_EPOCH_SECONDS)
+            valid = false;
+        if (valid && fraction) {
+            if (fraction_key >= -18 && fraction_key <= -3 && fraction_key % 3 == 0) {
+                for (k = fraction_key; k < 0; k++)
+                    divisor *= 10;
+            } else
+                valid = false;
+            if (valid && PyLong_CheckExact(fraction)) {
+                frac = PyLong_AsLongLongAndOverflow(fraction, &overflow);
+                if (overflow || frac < 0 || frac >= divisor)
+                    valid = false;
+                else if (divisor < 1000000)
+                    micros = frac * (1000000 / divisor);
+                else
+                    micros = frac / (divisor / 1000000);
+            } else
+                valid = false;
+        }
+        if (valid) {
+            days = secs / 86400;
+            sod = secs % 86400;
+            if (sod < 0) {
+                sod += 86400;
+                days--;
+            }
+            civil_from_days(days, &y, &m, &d);
+            ret = PyDateTimeAPI->DateTime_FromDateAndTime(
+                    y, m, d, sod / 3600, sod / 60 % 60, sod % 60, micros,
+                    _CBOR2_timezone_utc, PyDateTimeAPI->DateTimeType);
+        }
+    } else
+        valid = false;
+
+    if (!valid)
+        PyErr_Format(
+            _CBOR2_CBORDecodeValueError,
+            "invalid extended time value %R", map);
+    Py_DECREF(map);
+    set_shareable(self, ret);
+    return ret;
+}
+
+
 // CBORDecoder.decode_self_describe_cbor(self)
 static PyObject *
 CBORDecoder_decode_self_describe_cbor(CBORDecoderObject *self)
@@ -1589,19 +1616,11 @@ static PyObject *
 decode_special(CBORDecoderObject *self, uint8_t subtype)
 {
     // major type 7
-    PyObject *tag, *ret = NULL;
+    PyObject *ret = NULL;
 
     if ((subtype) < 20) {
-        tag = PyStructSequence_New(&CBORSimpleValueType);
-        if (tag) {
-            PyStructSequence_SET_ITEM(tag, 0, PyLong_FromLong(subtype));
-            if (PyStructSequence_GET_ITEM(tag, 0)) {
-                Py_INCREF(tag);
-                ret = tag;
-            }
-            Py_DECREF(tag);
-            // XXX Set shareable?
-        }
+        // XXX Set shareable?
+        ret = CBORSimpleValue_FromByte(subtype);
     } else {
         switch (subtype) {
             case 20: Py_RETURN_FALSE;
@@ -1628,21 +1647,12 @@ decode_special(CBORDecoderObject *self, uint8_t subtype)
 static PyObject *
 CBORDecoder_decode_simple_value(CBORDecoderObject *self)
 {
-    PyObject *tag, *ret = NULL;
+    PyObject *ret = NULL;
     uint8_t buf;
 
-    if (fp_read(self, (char*)&buf, sizeof(uint8_t)) == 0) {
-        tag = PyStructSequence_New(&CBORSimpleValueType);
-        if (tag) {
-            PyStructSequence_SET_ITEM(tag, 0, PyLong_FromLong(buf));
-            if (PyStructSequence_GET_ITEM(tag, 0)) {
-                Py_INCREF(tag);
-                ret = tag;
-            }
-            Py_DECREF(tag);
-        }
-    }
     // XXX Set shareable?
+    if (fp_read(self, (char*)&buf, sizeof(uint8_t)) == 0)
+        ret = CBORSimpleValue_FromByte(buf);
     return ret;
 }
 
@@ -1704,46 +1714,18 @@ CBORDecoder_decode_float64(CBORDecoderObject *self)
 }
 
 
-PyObject *
-decode(CBORDecoderObject *self, DecodeOptions options)
+// Picks the cheapest variant of the decode loop for the decoder's current
+// options; the full one is only needed while a shareable or string namespace
+// is open (i.e. when a tag hook or decoder subclass decodes from within one)
+static PyObject *
+decode_top(CBORDecoderObject *self)
 {
-    bool old_immutable;
-    Py_ssize_t old_index;
-    PyObject *ret = NULL;
-    LeadByte lead;
-
-    if (options & DECODE_IMMUTABLE) {
-        old_immutable = self->immutable;
-        self->immutable = true;
-    }
-    if (options & DECODE_UNSHARED) {
-        old_index = self->shared_index;
-        self->shared_index = -1;
-    }
-
-    if (Py_EnterRecursiveCall(" in CBORDecoder.decode"))
-        return NULL;
-
-    if (fp_read(self, &lead.byte, 1) == 0) {
-        switch (lead.major) {
-            case 0: ret = decode_uint(self, lead.subtype);       break;
-            case 1: ret = decode_negint(self, lead.subtype);     break;
-            case 2: ret = decode_bytestring(self, lead.subtype); break;
-            case 3: ret = decode_string(self, lead.subtype);     break;
-            case 4: ret = decode_array(self, lead.subtype);      break;
-            case 5: ret = decode_map(self, lead.subtype);        break;
-            case 6: ret = decode_semantic(self, lead.subtype);   break;
-            case 7: ret = decode_special(self, lead.subtype);    break;
-            default: assert(0);
-        }
-    }
-
-    Py_LeaveRecursiveCall();
-    if (options & DECODE_IMMUTABLE)
-        self->immutable = old_immutable;
-    if (options & DECODE_UNSHARED)
-        self->shared_index = old_index;
-    return ret;
+    if (self->shared_index != -1 || self->stringref_namespace != Py_None)
+        return decode(self, DECODE_NORMAL);
+    else if (self->object_hook == Py_None)
+        return decode_plain(self, DECODE_NORMAL);
+    else
+        return decode_hooks(self, DECODE_NORMAL);
 }
 
 
@@ -1751,7 +1733,7 @@ decode(CBORDecoderObject *self, DecodeOptions options)
 PyObject *
 CBORDecoder_decode(CBORDecoderObject *self)
 {
-    return decode(self, DECODE_NORMAL);
+    return decode_top(self);
 }
 
 
@@ -1760,6 +1742,7 @@ static PyObject *
 CBORDecoder_decode_from_bytes(CBORDecoderObject *self, PyObject *data)
 {
     PyObject *save_read, *buf, *ret = NULL;
+    const char *save_buf = self->buf;
 
     if (!_CBOR2_BytesIO && _CBOR2_init_BytesIO() == -1)
         return NULL;
@@ -1769,7 +1752,9 @@ CBORDecoder_decode_from_bytes(CBORDecoderObject *self, PyObject *data)
     if (buf) {
         self->read = PyObject_GetAttr(buf, _CBOR2_str_read);
         if (self->read) {
-            ret = decode(self, DECODE_NORMAL);
+            self->buf = NULL;
+            ret = decode_top(self);
+            self->buf = save_buf;
             Py_DECREF(self->read);
         }
         Py_DECREF(buf);
@@ -1812,6 +1797,10 @@ static PyGetSetDef CBORDecoder_getsetters[] = {
     {"str_errors",
         (getter) _CBORDecoder_get_str_errors, (setter) _CBORDecoder_set_str_errors,
         "the error mode to use when decoding UTF-8 encoded strings"},
+    {"map_type",
+        (getter) _CBORDecoder_get_map_type, (setter) _CBORDecoder_set_map_type,
+        "'dict' to decode maps as dicts, or 'pairs' to decode them as lists "
+        "of (key, value) tuples"},
     {"immutable",
         (getter) _CBORDecoder_get_immutable, NULL,
         "when True, the next item decoded should be made immutable (a "
@@ -1883,6 +1872,8 @@ static PyMethodDef CBORDecoder_methods[] = {
         "decode an IPv4Address or IPv6Address from the input"},
     {"decode_ipnetwork", (PyCFunction) CBORDecoder_decode_ipnetwork, METH_NOARGS,
         "decode an IPv4Network or IPv6Network from the input"},
+    {"decode_extended_time", (PyCFunction) CBORDecoder_decode_extended_time, METH_NOARGS,
+        "decode a datetime from an extended time map"},
     {"decode_self_describe_cbor", (PyCFunction) CBORDecoder_decode_self_describe_cbor, METH_NOARGS,
         "decode a data item after a self-describe CBOR tag"},
     {"decode_simple_value",
@@ -1919,7 +1910,8 @@ PyDoc_STRVAR(CBORDecoder__doc__,
 "    callable that takes 2 arguments: the decoder instance, and a\n"
 "    dictionary. This callback is invoked for each deserialized\n"
 "    :class:`dict` object. The return value is substituted for the dict\n"
-"    in the deserialized output.\n"
+"    in the deserialized output. The hook gets a plain dict even where the\n"
+"    result has to be immutable (see :attr:`immutable`).\n"
 "\n"
 ".. _CBOR: https://cbor.io/\n"
 );
@@ -12,11 +12,17 @@ typedef struct {
     PyObject *stringref_namespace;
     PyObject *str_errors;
     bool immutable;
+    bool map_pairs;    // decode maps as lists of (key, value) tuples
     Py_ssize_t shared_index;
+    const char *buf;   // when set, input is read from here instead of fp
+    Py_ssize_t buf_length;
+    Py_ssize_t buf_pos;
 } CBORDecoderObject;
 
 extern PyTypeObject CBORDecoderType;
 
 PyObject * CBORDecoder_new(PyTypeObject *, PyObject *, PyObject *);
 int CBORDecoder_init(CBORDecoderObject *, PyObject *, PyObject *);
+int CBORDecoder_init_buffer(CBORDecoderObject *, const char *, Py_ssize_t,
+                            PyObject *);
 PyObject * CBORDecoder_decode(CBORDecoderObject *);
@@ -0,0 +1,523 @@
+// The major type decoders and the decode() loop that dispatches to them.
+// decoder.c includes this file once per variant of the loop, defining:
+//
+//   VARIANT(name)  the name given to each function in this variant
+//   WITH_HOOKS     1 to call object_hook for every decoded map
+//   WITH_SHARING   1 to maintain shared_index and the stringref namespace
+//
+// Each variant calls only its own functions, so a decode that starts in a
+// variant without sharing stays there; the tags that introduce shareables
+// and string namespaces (28 and 256) go through the semantic decoders, which
+// call the full variant for their contents. There's deliberately no include
+// guard.
+
+#if WITH_SHARING
+#define SET_SHAREABLE(self, value) set_shareable(self, value)
+#define NAMESPACE_ADD(self, string, length) \
+    string_namespace_add(self, string, length)
+#else
+#define SET_SHAREABLE(self, value) ((void) 0)
+#define NAMESPACE_ADD(self, string, length) 0
+#endif
+
+static PyObject * VARIANT(decode)(CBORDecoderObject *, DecodeOptions);
+
+
+static PyObject *
+VARIANT(decode_uint)(CBORDecoderObject *self, uint8_t subtype)
+{
+    // major type 0
+    uint64_t length;
+    PyObject *ret;
+
+    if (decode_length(self, subtype, &length, NULL) == -1)
+        return NULL;
+    ret = PyLong_FromUnsignedLongLong(length);
+    SET_SHAREABLE(self, ret);
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_negint)(CBORDecoderObject *self, uint8_t subtype)
+{
+    // major type 1
+    PyObject *value, *one, *ret = NULL;
+
+    value = VARIANT(decode_uint)(self, subtype);
+    if (value) {
+        one = PyLong_FromLong(1);
+        if (one) {
+            ret = PyNumber_Negative(value);
+            if (ret) {
+                Py_DECREF(value);
+                value = ret;
+                ret = PyNumber_Subtract(value, one);
+                SET_SHAREABLE(self, ret);
+            }
+            Py_DECREF(one);
+        }
+        Py_DECREF(value);
+    }
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_definite_bytestring)(CBORDecoderObject *self, Py_ssize_t length)
+{
+    PyObject *ret = NULL;
+
+    ret = fp_read_object(self, length);
+    if (!ret)
+        return NULL;
+    if (NAMESPACE_ADD(self, ret, length) == -1) {
+        Py_DECREF(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_bytestring)(CBORDecoderObject *self, uint8_t subtype)
+{
+    // major type 2
+    uint64_t length = 0;
+    bool indefinite = true;
+    PyObject *ret;
+    char length_hex[17];
+
+    if (decode_length(self, subtype, &length, &indefinite) == -1)
+        return NULL;
+
+    if (length > (uint64_t)PY_SSIZE_T_MAX - (uint64_t)PyBytesObject_SIZE) {
+        sprintf(length_hex, "%" PRIX64, length);
+        PyErr_Format(
+                _CBOR2_CBORDecodeValueError,
+                "excessive bytestring size 0x%s", length_hex);
+        return NULL;
+    }
+    if (indefinite)
+        ret = decode_indefinite_bytestrings(self);
+    else
+        ret = VARIANT(decode_definite_bytestring)(self, (Py_ssize_t)length);
+    SET_SHAREABLE(self, ret);
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_definite_string)(CBORDecoderObject *self, Py_ssize_t length)
+{
+    PyObject *bytes, *ret = NULL;
+
+    bytes = fp_read_object(self, length);
+    if (!bytes)
+        return NULL;
+    ret = PyUnicode_DecodeUTF8(
+            PyBytes_AS_STRING(bytes), length, PyBytes_AS_STRING(self->str_errors));
+    Py_DECREF(bytes);
+    if (!ret)
+        return NULL;
+
+    if (NAMESPACE_ADD(self, ret, length) == -1) {
+        Py_DECREF(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_string)(CBORDecoderObject *self, uint8_t subtype)
+{
+    // major type 3
+    uint64_t length = 0;
+    bool indefinite = true;
+    PyObject *ret;
+    char length_hex[17];
+
+    if (decode_length(self, subtype, &length, &indefinite) == -1)
+        return NULL;
+    if (length > (uint64_t)PY_SSIZE_T_MAX - (uint64_t)PyBytesObject_SIZE) {
+        sprintf(length_hex, "%" PRIX64, length);
+        PyErr_Format(
+                _CBOR2_CBORDecodeValueError,
+                "excessive string size 0x%s", length_hex);
+        return NULL;
+    }
+    if (indefinite)
+        ret = decode_indefinite_strings(self);
+    else
+        ret = VARIANT(decode_definite_string)(self, (Py_ssize_t)length);
+    SET_SHAREABLE(self, ret);
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_indefinite_array)(CBORDecoderObject *self)
+{
+    PyObject *array, *item, *ret = NULL;
+
+    array = PyList_New(0);
+    if (array) {
+        ret = array;
+        SET_SHAREABLE(self, array);
+        while (ret) {
+            item = VARIANT(decode)(self, DECODE_UNSHARED);
+            if (item == break_marker) {
+                Py_DECREF(item);
+                break;
+            } else if (item) {
+                if (PyList_Append(array, item) == -1)
+                    ret = NULL;
+                Py_DECREF(item);
+            } else
+                ret = NULL;
+        }
+        if (ret && self->immutable) {
+            ret = PyList_AsTuple(array);
+            if (ret) {
+                Py_DECREF(array);
+                // There's a potential here for an indefinite length recursive
+                // array to wind up with a strange representation (the outer
+                // being a tuple, the inners all being a list). However, a
+                // recursive tuple isn't valid in the first place so it's a bit
+                // of a waste of time searching for recursive references just
+                // to throw an error
+                SET_SHAREABLE(self, ret);
+            } else
+                ret = NULL;
+        }
+        if (!ret)
+            Py_DECREF(array);
+    }
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_definite_array)(CBORDecoderObject *self, Py_ssize_t length)
+{
+    Py_ssize_t i;
+    PyObject *array, *item, *ret = NULL;
+    if (length > PREALLOC_LIMIT) {
+        // Don't trust large lengths enough to allocate for them up front;
+        // let the list grow as the items actually arrive
+        array = PyList_New(0);
+        if (array) {
+            ret = array;
+            SET_SHAREABLE(self, array);
+            for (i = 0; i < length; ++i) {
+                item = VARIANT(decode)(self, DECODE_UNSHARED);
+                if (item) {
+                    if (PyList_Append(array, item) == -1) {
+                        ret = NULL;
+                        Py_DECREF(item);
+                        break;
+                    }
+                    Py_DECREF(item);
+                } else {
+                    ret = NULL;
+                    break;
+                }
+            }
+            if (ret && self->immutable) {
+                ret = PyList_AsTuple(array);
+                if (ret) {
+                    Py_DECREF(array);
+                    // There's a potential here for an indefinite length recursive
+                    // array to wind up with a strange representation (the outer
+                    // being a tuple, the inners all being a list). However, a
+                    // recursive tuple isn't valid in the first place so it's a bit
+                    // of a waste of time searching for recursive references just
+                    // to throw an error
+                    SET_SHAREABLE(self, ret);
+                } else
+                    ret = NULL;
+            }
+            if (!ret)
+                Py_DECREF(array);
+        }
+    } else {
+        if (self->immutable) {
+            array = PyTuple_New(length);
+            if (array) {
+                ret = array;
+                for (i = 0; i < length; ++i) {
+                    item = VARIANT(decode)(self, DECODE_UNSHARED);
+                    if (item)
+                        PyTuple_SET_ITEM(array, i, item);
+                    else {
+                        ret = NULL;
+                        break;
+                    }
+                }
+            }
+            // This is done *after* the construction of the tuple because while
+            // it's valid for a tuple object to be shared, it's not valid for it to
+            // contain a reference to itself (because a reference to it can't exist
+            // during its own construction ... in Python at least; as can be seen
+            // above this *is* theoretically possible at the C level).
+            SET_SHAREABLE(self, ret);
+        } else {
+            array = PyList_New(length);
+            if (array) {
+                ret = array;
+                SET_SHAREABLE(self, array);
+                for (i = 0; i < length; ++i) {
+                    item = VARIANT(decode)(self, DECODE_UNSHARED);
+                    if (item)
+                        PyList_SET_ITEM(array, i, item);
+                    else {
+                        ret = NULL;
+                        break;
+                    }
+                }
+            }
+        }
+        if (!ret)
+            Py_DECREF(array);
+    }
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_array)(CBORDecoderObject *self, uint8_t subtype)
+{
+    // major type 4
+    uint64_t length;
+    bool indefinite = true;
+    char length_hex[17];
+
+    if (decode_length(self, subtype, &length, &indefinite) == -1)
+        return NULL;
+    if (indefinite)
+        return VARIANT(decode_indefinite_array)(self);
+    if (length > (uint64_t)PY_SSIZE_T_MAX) {
+        sprintf(length_hex, "%" PRIX64, length);
+        PyErr_Format(
+                _CBOR2_CBORDecodeValueError,
+                "excessive array size 0x%s", length_hex);
+        return NULL;
+    } else
+        return VARIANT(decode_definite_array)(self, (Py_ssize_t) length);
+}
+
+
+// Decode a map as a list of (key, value) tuples for map_type="pairs". As the
+// keys aren't hashed they're decoded as they are, not made immutable
+static PyObject *
+VARIANT(decode_pairs)(CBORDecoderObject *self, uint64_t length,
+                      bool indefinite)
+{
+    Py_ssize_t i;
+    PyObject *pairs, *pair, *key, *value, *ret;
+
+    // as with arrays, only small lengths are trusted enough to allocate for
+    pairs = PyList_New(!indefinite && length <= PREALLOC_LIMIT ? length : 0);
+    if (!pairs)
+        return NULL;
+    ret = pairs;
+    SET_SHAREABLE(self, pairs);
+    for (i = 0; indefinite || (uint64_t) i < length; ++i) {
+        key = VARIANT(decode)(self, DECODE_UNSHARED);
+        if (!key) {
+            ret = NULL;
+            break;
+        } else if (indefinite && key == break_marker) {
+            Py_DECREF(key);
+            break;
+        }
+        value = VARIANT(decode)(self, DECODE_UNSHARED);
+        if (!value) {
+            Py_DECREF(key);
+            ret = NULL;
+            break;
+        }
+        pair = PyTuple_New(2);
+        if (!pair) {
+            Py_DECREF(key);
+            Py_DECREF(value);
+            ret = NULL;
+            break;
+        }
+        PyTuple_SET_ITEM(pair, 0, key);
+        PyTuple_SET_ITEM(pair, 1, value);
+        if (i < PyList_GET_SIZE(pairs))
+            PyList_SET_ITEM(pairs, i, pair);
+        else {
+            if (PyList_Append(pairs, pair) == -1)
+                ret = NULL;
+            Py_DECREF(pair);
+            if (!ret)
+                break;
+        }
+    }
+    if (!ret) {
+        Py_DECREF(pairs);
+        return NULL;
+    }
+    // like the Python decoder, object_hook gets the list itself and deals
+    // with self->immutable (if it cares); only without one is it frozen here
+#if WITH_HOOKS
+    if (self->object_hook != Py_None) {
+        ret = PyObject_CallFunctionObjArgs(self->object_hook, self, pairs, NULL);
+        Py_DECREF(pairs);
+        if (!ret)
+            return NULL;
+        SET_SHAREABLE(self, ret);
+        return ret;
+    }
+#endif
+    if (self->immutable) {
+        ret = PyList_AsTuple(pairs);
+        Py_DECREF(pairs);
+        if (!ret)
+            return NULL;
+        SET_SHAREABLE(self, ret);
+    }
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode_map)(CBORDecoderObject *self, uint8_t subtype)
+{
+    // major type 5
+    uint64_t length;
+    bool indefinite = true;
+    PyObject *map, *key, *value, *ret = NULL;
+
+    if (self->map_pairs) {
+        if (decode_length(self, subtype, &length, &indefinite) == -1)
+            return NULL;
+        return VARIANT(decode_pairs)(self, length, indefinite);
+    }
+    map = PyDict_New();
+    if (map) {
+        ret = map;
+        SET_SHAREABLE(self, map);
+        if (decode_length(self, subtype, &length, &indefinite) == 0) {
+            if (indefinite) {
+                while (ret) {
+                    key = VARIANT(decode)(
+                            self, DECODE_IMMUTABLE | DECODE_UNSHARED);
+                    if (key == break_marker) {
+                        Py_DECREF(key);
+                        break;
+                    } else if (key) {
+                        value = VARIANT(decode)(self, DECODE_UNSHARED);
+                        if (value) {
+                            if (PyDict_SetItem(map, key, value) == -1)
+                                ret = NULL;
+                            Py_DECREF(value);
+                        } else
+                            ret = NULL;
+                        Py_DECREF(key);
+                    } else
+                        ret = NULL;
+                }
+            } else {
+                while (ret && length--) {
+                    key = VARIANT(decode)(
+                            self, DECODE_IMMUTABLE | DECODE_UNSHARED);
+                    if (key) {
+                        value = VARIANT(decode)(self, DECODE_UNSHARED);
+                        if (value) {
+                            if (PyDict_SetItem(map, key, value) == -1)
+                                ret = NULL;
+                            Py_DECREF(value);
+                        } else
+                            ret = NULL;
+                        Py_DECREF(key);
+                    } else
+                        ret = NULL;
+                }
+            }
+        } else
+            ret = NULL;
+        if (!ret)
+            Py_DECREF(map);
+    }
+#if WITH_HOOKS
+    // as for pairs, object_hook gets the dict rather than a FrozenDict
+    if (ret && self->object_hook != Py_None) {
+        map = PyObject_CallFunctionObjArgs(self->object_hook, self, ret, NULL);
+        if (map)
+            SET_SHAREABLE(self, map);
+        Py_DECREF(ret);
+        return map;
+    }
+#endif
+    if (ret && self->immutable) {
+        // _CBOR2_FrozenDict is initialized in CBORDecoder_init
+        map = PyObject_CallFunctionObjArgs(_CBOR2_FrozenDict, ret, NULL);
+        if (map)
+            SET_SHAREABLE(self, map);
+        Py_DECREF(ret);
+        ret = map;
+    }
+    return ret;
+}
+
+
+static PyObject *
+VARIANT(decode)(CBORDecoderObject *self, DecodeOptions options)
+{
+    bool old_immutable = false;
+#if WITH_SHARING
+    Py_ssize_t old_index = -1;
+#endif
+    PyObject *ret = NULL;
+    LeadByte lead;
+
+    if (Py_EnterRecursiveCall(" in CBORDecoder.decode"))
+        return NULL;
+
+    if (options & DECODE_IMMUTABLE) {
+        old_immutable = self->immutable;
+        self->immutable = true;
+    }
+#if WITH_SHARING
+    if (options & DECODE_UNSHARED) {
+        old_index = self->shared_index;
+        self->shared_index = -1;
+    }
+#endif
+
+    if (fp_read(self, &lead.byte, 1) == 0) {
+        switch (lead.major) {
+            case 0: ret = VARIANT(decode_uint)(self, lead.subtype);   break;
+            case 1: ret = VARIANT(decode_negint)(self, lead.subtype); break;
+            case 2:
+                ret = VARIANT(decode_bytestring)(self, lead.subtype);
+                break;
+            case 3: ret = VARIANT(decode_string)(self, lead.subtype); break;
+            case 4: ret = VARIANT(decode_array)(self, lead.subtype);  break;
+            case 5: ret = VARIANT(decode_map)(self, lead.subtype);    break;
+            case 6: ret = decode_semantic(self, lead.subtype);        break;
+            case 7: ret = decode_special(self, lead.subtype);         break;
+            default: assert(0);
+        }
+    }
+
+    Py_LeaveRecursiveCall();
+    if (options & DECODE_IMMUTABLE)
+        self->immutable = old_immutable;
+#if WITH_SHARING
+    if (options & DECODE_UNSHARED)
+        self->shared_index = old_index;
+#endif
+    return ret;
+}
+
+
+#undef NAMESPACE_ADD
+#undef SET_SHAREABLE
+#undef WITH_SHARING
+#undef WITH_HOOKS
+#undef VARIANT
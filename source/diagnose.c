@@ -0,0 +1,438 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include "module.h"
+#include "scanner.h"
+#include "diagnose.h"
+
+// Output is flushed to fp.write() (if given) whenever the buffer grows past
+// this size; flushes only happen between tokens so a UTF-8 sequence is never
+// split across two writes
+#define DIAG_FLUSH_SIZE 65536
+
+typedef struct {
+    char *buf;
+    Py_ssize_t length;
+    Py_ssize_t size;
+    PyObject *write;    // bound write() method of fp, or NULL
+} DiagOutput;
+
+
+// Output buffer /////////////////////////////////////////////////////////////
+
+static int
+out_reserve(DiagOutput *out, Py_ssize_t extra)
+{
+    Py_ssize_t size;
+    char *buf;
+
+    if (out->length + extra <= out->size)
+        return 0;
+    size = out->size ? out->size : 256;
+    while (size < out->length + extra) {
+        if (size > PY_SSIZE_T_MAX / 2) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        size *= 2;
+    }
+    buf = PyMem_Realloc(out->buf, size);
+    if (!buf) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    out->buf = buf;
+    out->size = size;
+    return 0;
+}
+
+
+static int
+out_write(DiagOutput *out, const char *data, Py_ssize_t length)
+{
+    if (out_reserve(out, length) == -1)
+        return -1;
+    memcpy(out->buf + out->length, data, length);
+    out->length += length;
+    return 0;
+}
+
+
+#define OUT_LITERAL(out, s) out_write((out), (s), sizeof(s) - 1)
+
+
+static int
+out_printf_u64(DiagOutput *out, const char *fmt, uint64_t value)
+{
+    char buf[32];
+    int length;
+
+    length = snprintf(buf, sizeof(buf), fmt, (unsigned long long) value);
+    return out_write(out, buf, length);
+}
+
+
+static PyObject *
+out_as_str(DiagOutput *out)
+{
+    // Text strings are copied through verbatim so the output may contain
+    // invalid UTF-8; it's better to show that than to fail
+    return PyUnicode_DecodeUTF8(out->buf, out->length, "backslashreplace");
+}
+
+
+static int
+out_flush(DiagOutput *out)
+{
+    PyObject *str, *ret;
+
+    if (!out->write || !out->length)
+        return 0;
+    str = out_as_str(out);
+    if (!str)
+        return -1;
+    ret = PyObject_CallFunctionObjArgs(out->write, str, NULL);
+    Py_DECREF(str);
+    if (!ret)
+        return -1;
+    Py_DECREF(ret);
+    out->length = 0;
+    return 0;
+}
+
+
+// Formatting ////////////////////////////////////////////////////////////////
+
+// Write the encoding indicator (RFC 8610, appendix G.2) for heads that don't
+// use the preferred (shortest) serialization of their argument
+static int
+write_indicator(DiagOutput *out, const CBORToken *tok)
+{
+    uint8_t preferred;
+    char buf[2] = {'_', '0'};
+
+    if (tok->ai < 24 || tok->ai > 27)
+        return 0;
+    if (tok->value < 24)
+        preferred = (uint8_t) tok->value;
+    else if (tok->value <= UINT8_MAX)
+        preferred = 24;
+    else if (tok->value <= UINT16_MAX)
+        preferred = 25;
+    else if (tok->value <= UINT32_MAX)
+        preferred = 26;
+    else
+        preferred = 27;
+    if (tok->ai == preferred)
+        return 0;
+    buf[1] += tok->ai - 24;
+    return out_write(out, buf, 2);
+}
+
+
+static int
+write_float(DiagOutput *out, const CBORToken *tok)
+{
+    char *repr;
+    char suffix[2] = {'_', '0'};
+    int ret;
+
+    if (isnan(tok->fvalue))
+        ret = OUT_LITERAL(out, "NaN");
+    else if (isinf(tok->fvalue)) {
+        if (tok->fvalue > 0)
+            ret = OUT_LITERAL(out, "Infinity");
+        else
+            ret = OUT_LITERAL(out, "-Infinity");
+    } else {
+        repr = PyOS_double_to_string(
+                tok->fvalue, 'r', 0, Py_DTSF_ADD_DOT_0, NULL);
+        if (!repr)
+            return -1;
+        ret = out_write(out, repr, strlen(repr));
+        PyMem_Free(repr);
+    }
+    if (ret == 0) {
+        suffix[1] += tok->ai - 24;
+        ret = out_write(out, suffix, 2);
+    }
+    return ret;
+}
+
+
+static int
+write_bytes(DiagOutput *out, const CBORToken *tok)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    const uint8_t *p;
+    char *q;
+
+    if (tok->value > (uint64_t) (PY_SSIZE_T_MAX - 3) / 2) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (out_reserve(out, (Py_ssize_t) tok->value * 2 + 3) == -1)
+        return -1;
+    q = out->buf + out->length;
+    *q++ = 'h';
+    *q++ = '\'';
+    for (p = tok->data; p < tok->data + tok->value; ++p) {
+        *q++ = hexdigits[*p >> 4];
+        *q++ = hexdigits[*p & 0x0f];
+    }
+    *q++ = '\'';
+    out->length = q - out->buf;
+    return write_indicator(out, tok);
+}
+
+
+static int
+write_text(DiagOutput *out, const CBORToken *tok)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    const uint8_t *p;
+    char *q;
+
+    // Worst case every byte is a control character written as \u00XX
+    if (tok->value > (uint64_t) (PY_SSIZE_T_MAX - 2) / 6) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (out_reserve(out, (Py_ssize_t) tok->value * 6 + 2) == -1)
+        return -1;
+    q = out->buf + out->length;
+    *q++ = '"';
+    for (p = tok->data; p < tok->data + tok->value; ++p) {
+        switch (*p) {
+            case '"':  *q++ = '\\'; *q++ = '"';  break;
+            case '\\': *q++ = '\\'; *q++ = '\\'; break;
+            case '\b': *q++ = '\\'; *q++ = 'b';  break;
+            case '\f': *q++ = '\\'; *q++ = 'f';  break;
+            case '\n': *q++ = '\\'; *q++ = 'n';  break;
+            case '\r': *q++ = '\\'; *q++ = 'r';  break;
+            case '\t': *q++ = '\\'; *q++ = 't';  break;
+            default:
+                if (*p < 0x20) {
+                    *q++ = '\\'; *q++ = 'u'; *q++ = '0'; *q++ = '0';
+                    *q++ = hexdigits[*p >> 4];
+                    *q++ = hexdigits[*p & 0x0f];
+                } else
+                    *q++ = *p;
+        }
+    }
+    *q++ = '"';
+    out->length = q - out->buf;
+    return write_indicator(out, tok);
+}
+
+
+static int
+write_simple(DiagOutput *out, const CBORToken *tok)
+{
+    switch (tok->value) {
+        case 20: return OUT_LITERAL(out, "false");
+        case 21: return OUT_LITERAL(out, "true");
+        case 22: return OUT_LITERAL(out, "null");
+        case 23: return OUT_LITERAL(out, "undefined");
+        default: return out_printf_u64(out, "simple(%llu)", tok->value);
+    }
+}
+
+
+static int
+write_separator(DiagOutput *out, const CBORToken *tok)
+{
+    switch (tok->parent) {
+        case CBOR_TOKEN_ARRAY:
+        case CBOR_TOKEN_BYTES_INDEF:
+        case CBOR_TOKEN_TEXT_INDEF:
+            if (tok->index)
+                return OUT_LITERAL(out, ", ");
+            break;
+        case CBOR_TOKEN_MAP:
+            if (tok->index % 2)
+                return OUT_LITERAL(out, ": ");
+            else if (tok->index)
+                return OUT_LITERAL(out, ", ");
+            break;
+    }
+    return 0;
+}
+
+
+static int
+write_container_start(DiagOutput *out, const CBORToken *tok, const char *bracket)
+{
+    Py_ssize_t length;
+
+    if (out_write(out, bracket, 1) == -1)
+        return -1;
+    if (tok->indefinite)
+        return OUT_LITERAL(out, "_ ");
+    length = out->length;
+    if (write_indicator(out, tok) == -1)
+        return -1;
+    // separate the indicator from the first item
+    if (tok->value && out->length != length)
+        return OUT_LITERAL(out, " ");
+    return 0;
+}
+
+
+static int
+write_token(DiagOutput *out, const CBORToken *tok)
+{
+    if (tok->type != CBOR_TOKEN_END && write_separator(out, tok) == -1)
+        return -1;
+
+    switch (tok->type) {
+        case CBOR_TOKEN_UINT:
+            if (out_printf_u64(out, "%llu", tok->value) == -1)
+                return -1;
+            return write_indicator(out, tok);
+        case CBOR_TOKEN_NEGINT:
+            if (tok->value == UINT64_MAX) {
+                if (OUT_LITERAL(out, "-18446744073709551616") == -1)
+                    return -1;
+            } else if (out_printf_u64(out, "-%llu", tok->value + 1) == -1)
+                return -1;
+            return write_indicator(out, tok);
+        case CBOR_TOKEN_BYTES:
+            return write_bytes(out, tok);
+        case CBOR_TOKEN_TEXT:
+            return write_text(out, tok);
+        case CBOR_TOKEN_BYTES_INDEF:
+        case CBOR_TOKEN_TEXT_INDEF:
+            return OUT_LITERAL(out, "(_ ");
+        case CBOR_TOKEN_ARRAY:
+            return write_container_start(out, tok, "[");
+        case CBOR_TOKEN_MAP:
+            return write_container_start(out, tok, "{");
+        case CBOR_TOKEN_TAG:
+            if (out_printf_u64(out, "%llu", tok->value) == -1)
+                return -1;
+            if (write_indicator(out, tok) == -1)
+                return -1;
+            return OUT_LITERAL(out, "(");
+        case CBOR_TOKEN_SIMPLE:
+            return write_simple(out, tok);
+        case CBOR_TOKEN_FLOAT:
+            return write_float(out, tok);
+        case CBOR_TOKEN_END:
+            switch (tok->closes) {
+                case CBOR_TOKEN_ARRAY: return OUT_LITERAL(out, "]");
+                case CBOR_TOKEN_MAP:   return OUT_LITERAL(out, "}");
+                default:               return OUT_LITERAL(out, ")");
+            }
+        default:
+            assert(0);
+            return -1;
+    }
+}
+
+
+// Raise the appropriate exception for the scanner's error state
+int
+_CBOR2_raise_scan_error(CBORScanner *scanner)
+{
+    switch (scanner->error) {
+        case CBOR_SCAN_NOMEM:
+            PyErr_NoMemory();
+            break;
+        case CBOR_SCAN_EOF:
+            PyErr_Format(_CBOR2_CBORDecodeEOF, "%s at offset %zu",
+                    cbor_scanner_strerror(scanner), scanner->error_pos);
+            break;
+        default:
+            PyErr_Format(_CBOR2_CBORDecodeValueError, "%s at offset %zu",
+                    cbor_scanner_strerror(scanner), scanner->error_pos);
+            break;
+    }
+    return -1;
+}
+
+
+static int
+diagnose_buffer(DiagOutput *out, const uint8_t *data, size_t length,
+                bool sequence)
+{
+    CBORScanner scanner;
+    CBORToken tok;
+    int ret = 0;
+
+    cbor_scanner_init(&scanner, data, length);
+    while (ret == 0) {
+        switch (cbor_scanner_next(&scanner, &tok)) {
+            case 1:
+                ret = write_token(out, &tok);
+                if (ret == 0 && cbor_scanner_item_done(&scanner)) {
+                    if (sequence) {
+                        if (OUT_LITERAL(out, "\n") == -1)
+                            ret = -1;
+                        else if (out->write && out->length >= DIAG_FLUSH_SIZE)
+                            ret = out_flush(out);
+                    } else if (!cbor_scanner_at_end(&scanner)) {
+                        PyErr_Format(_CBOR2_CBORDecodeValueError,
+                                "%zu bytes of trailing data after the "
+                                "first item", length - scanner.pos);
+                        ret = -1;
+                    } else
+                        ret = 1;
+                } else if (ret == 0 && out->write &&
+                        out->length >= DIAG_FLUSH_SIZE)
+                    ret = out_flush(out);
+                break;
+            case 0:
+                if (!sequence) {
+                    // nothing at all was found in the input
+                    scanner.error = CBOR_SCAN_EOF;
+                    ret = _CBOR2_raise_scan_error(&scanner);
+                } else
+                    ret = 1;
+                break;
+            default:
+                ret = _CBOR2_raise_scan_error(&scanner);
+                break;
+        }
+    }
+    cbor_scanner_free(&scanner);
+    return ret == 1 ? 0 : -1;
+}
+
+
+// diagnose(data, sequence=False, fp=None)
+PyObject *
+CBOR2_diagnose(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"data", "sequence", "fp", NULL};
+    PyObject *data, *fp = Py_None, *ret = NULL;
+    int sequence = 0;
+    DiagOutput out = {NULL, 0, 0, NULL};
+    Py_buffer view;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|pO", keywords,
+                &data, &sequence, &fp))
+        return NULL;
+    if (fp != Py_None) {
+        out.write = PyObject_GetAttr(fp, _CBOR2_str_write);
+        if (!out.write)
+            return NULL;
+    }
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) == 0) {
+        if (diagnose_buffer(&out, view.buf, view.len, sequence) == 0) {
+            if (out.write) {
+                if (out_flush(&out) == 0) {
+                    Py_INCREF(Py_None);
+                    ret = Py_None;
+                }
+            } else
+                ret = out_as_str(&out);
+        }
+        PyBuffer_Release(&view);
+    }
+    PyMem_Free(out.buf);
+    Py_XDECREF(out.write);
+    return ret;
+}
@@ -0,0 +1,6 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "scanner.h"
+
+PyObject * CBOR2_diagnose(PyObject *, PyObject *, PyObject *);
+int _CBOR2_raise_scan_error(CBORScanner *);
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include "emitter.h"
+
+
+// Emitter lifecycle /////////////////////////////////////////////////////////
+
+// Set up e to pass its output to flush (with ctx) in chunks of flush_size
+// bytes, or to keep all of it in memory if flush is NULL (starting with a
+// buffer of flush_size bytes). A flush_size of 0 picks the default
+void
+cbor_emitter_init(CBOREmitter *e, CBORFlushFunc flush, void *ctx,
+                  size_t flush_size)
+{
+    e->buf = NULL;
+    e->length = 0;
+    e->capacity = 0;
+    e->flush_size = flush_size ? flush_size : CBOR_EMIT_FLUSH_SIZE;
+    e->flush = flush;
+    e->ctx = ctx;
+    e->error = CBOR_EMIT_OK;
+}
+
+
+void
+cbor_emitter_free(CBOREmitter *e)
+{
+    free(e->buf);
+    e->buf = NULL;
+    e->length = e->capacity = 0;
+}
+
+
+// Pass any buffered output to the flush callback. Does nothing (leaving the
+// output in the buffer) if there isn't one
+int
+cbor_emitter_flush(CBOREmitter *e)
+{
+    size_t length = e->length;
+
+    if (!e->flush || !length)
+        return 0;
+    // the buffer is considered empty even if the callback fails; there's no
+    // telling how much of it was written
+    e->length = 0;
+    if (e->flush(e->ctx, e->buf, length) == -1) {
+        e->error = CBOR_EMIT_FLUSH;
+        return -1;
+    }
+    return 0;
+}
+
+
+// Output ////////////////////////////////////////////////////////////////////
+
+static int
+grow(CBOREmitter *e, size_t length)
+{
+    uint8_t *buf;
+    size_t capacity;
+
+    capacity = e->capacity ? e->capacity : e->flush_size;
+    while (capacity - e->length < length) {
+        if (capacity > SIZE_MAX / 2)
+            goto nomem;
+        capacity *= 2;
+    }
+    buf = realloc(e->buf, capacity);
+    if (!buf)
+        goto nomem;
+    e->buf = buf;
+    e->capacity = capacity;
+    return 0;
+
+nomem:
+    e->error = CBOR_EMIT_NOMEM;
+    return -1;
+}
+
+
+// The out-of-line part of cbor_emit_raw, for when buf doesn't fit in the
+// space left in the buffer
+int
+cbor_emit_raw_slow(CBOREmitter *e, const void *buf, size_t length)
+{
+    if (e->flush) {
+        if (e->length && cbor_emitter_flush(e) == -1)
+            return -1;
+        if (length >= e->flush_size) {
+            // large enough to be worth passing on without a copy
+            if (e->flush(e->ctx, buf, length) == -1) {
+                e->error = CBOR_EMIT_FLUSH;
+                return -1;
+            }
+            return 0;
+        }
+        if (!e->buf && grow(e, length) == -1)
+            return -1;
+    } else if (grow(e, length) == -1)
+        return -1;
+    memcpy(e->buf + e->length, buf, length);
+    e->length += length;
+    return 0;
+}
+
+
+// Append a definite length string of major type major (2 or 3)
+int
+cbor_emit_string(CBOREmitter *e, uint8_t major, const void *buf, size_t length)
+{
+    if (cbor_emit_head(e, major, length) == -1)
+        return -1;
+    return cbor_emit_raw(e, buf, length);
+}
+
+
+// Append count code points held kind (1, 2 or 4) bytes apiece at data (as in
+// a PEP 393 string) as UTF-8, transcoding straight into the buffer; length is
+// their UTF-8 length, from cbor_utf8_length. Text too long for the buffer of
+// a flushing emitter is transcoded and flushed a buffer-full at a time
+int
+cbor_emit_utf8(CBOREmitter *e, int kind, const void *data, size_t count,
+               size_t length)
+{
+    const uint8_t *p = data;
+    size_t units, written;
+
+    if (e->capacity - e->length < length) {
+        if (e->flush) {
+            if (e->length && cbor_emitter_flush(e) == -1)
+                return -1;
+            if (!e->buf && grow(e, 1) == -1)
+                return -1;
+        } else if (grow(e, length) == -1)
+            return -1;
+    }
+    while (e->capacity - e->length < length) {
+        // only possible when flushing, so the buffer is empty here
+        units = e->capacity / CBOR_UTF8_MAX_UNIT(kind);
+        written = cbor_utf8_encode(e->buf, kind, p, units);
+        e->length = written;
+        length -= written;
+        count -= units;
+        p += units * kind;
+        if (cbor_emitter_flush(e) == -1)
+            return -1;
+    }
+    e->length += cbor_utf8_encode(e->buf + e->length, kind, p, count);
+    return 0;
+}
+
+
+// Append the start of an indefinite length item of major type major (2-5)
+int
+cbor_emit_indefinite(CBOREmitter *e, uint8_t major)
+{
+    uint8_t lead = (uint8_t) (major << 5 | 31);
+
+    return cbor_emit_raw(e, &lead, 1);
+}
+
+
+int
+cbor_emit_break(CBOREmitter *e)
+{
+    return cbor_emit_raw(e, "\xff", 1);
+}
+
+
+// Append the item started (or ended) by tok, as produced by the scanner
+int
+cbor_emit_token(CBOREmitter *e, const CBORToken *tok)
+{
+    uint8_t buf[CBOR_MAX_HEAD_SIZE];
+    int i, size;
+
+    switch (tok->type) {
+        case CBOR_TOKEN_UINT:
+            return cbor_emit_head(e, 0, tok->value);
+        case CBOR_TOKEN_NEGINT:
+            return cbor_emit_head(e, 1, tok->value);
+        case CBOR_TOKEN_BYTES:
+        case CBOR_TOKEN_TEXT:
+            return cbor_emit_string(
+                e, tok->type == CBOR_TOKEN_BYTES ? 2 : 3, tok->data,
+                (size_t) tok->value);
+        case CBOR_TOKEN_BYTES_INDEF:
+            return cbor_emit_indefinite(e, 2);
+        case CBOR_TOKEN_TEXT_INDEF:
+            return cbor_emit_indefinite(e, 3);
+        case CBOR_TOKEN_ARRAY:
+        case CBOR_TOKEN_MAP:
+            if (tok->indefinite)
+                return cbor_emit_indefinite(
+                    e, tok->type == CBOR_TOKEN_ARRAY ? 4 : 5);
+            return cbor_emit_head(
+                e, tok->type == CBOR_TOKEN_ARRAY ? 4 : 5, tok->value);
+        case CBOR_TOKEN_TAG:
+            return cbor_emit_head(e, 6, tok->value);
+        case CBOR_TOKEN_SIMPLE:
+            return cbor_emit_head(e, 7, tok->value);
+        case CBOR_TOKEN_FLOAT:
+            // keep the original precision (value holds the raw bits)
+            size = cbor_argument_size(tok->ai);
+            buf[0] = 0xe0 | tok->ai;
+            for (i = 0; i < size; ++i)
+                buf[1 + i] = (uint8_t) (tok->value >> (8 * (size - 1 - i)));
+            return cbor_emit_raw(e, buf, 1 + size);
+        case CBOR_TOKEN_END:
+            // only indefinite length items have an explicit end
+            if (tok->indefinite)
+                return cbor_emit_break(e);
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+
+static int
+visit_token(void *ctx, const CBORToken *tok)
+{
+    return cbor_emit_token((CBOREmitter *) ctx, tok);
+}
+
+const CBORVisitor cbor_emitter_visitor = {
+    visit_token, visit_token, visit_token, visit_token, visit_token,
+    visit_token, visit_token, visit_token, visit_token, visit_token,
+    visit_token, visit_token,
+};
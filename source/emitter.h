@@ -0,0 +1,74 @@
+#ifndef CBOR2_EMITTER_H
+#define CBOR2_EMITTER_H
+
+// A buffered CBOR writer; the output counterpart of the scanner. Nothing in
+// here depends on Python.h. Output is collected in a buffer which is handed
+// to a flush callback whenever it fills up, or (without a callback) simply
+// grows to hold everything written.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "codec.h"
+#include "scanner.h"
+
+// Called with each chunk of output; returns 0 on success and -1 on failure
+typedef int (*CBORFlushFunc)(void *ctx, const uint8_t *buf, size_t length);
+
+typedef struct {
+    uint8_t *buf;
+    size_t length;        // bytes waiting in buf
+    size_t capacity;      // allocated size of buf
+    size_t flush_size;    // size of buf (its initial size without flush)
+    CBORFlushFunc flush;  // NULL to keep all the output in buf
+    void *ctx;
+    int error;
+} CBOREmitter;
+
+// Error codes stored in CBOREmitter.error
+#define CBOR_EMIT_OK 0
+#define CBOR_EMIT_NOMEM 1        // out of memory growing the buffer
+#define CBOR_EMIT_FLUSH 2        // the flush callback failed
+
+#define CBOR_EMIT_FLUSH_SIZE 8192
+
+void cbor_emitter_init(CBOREmitter *, CBORFlushFunc, void *, size_t);
+void cbor_emitter_free(CBOREmitter *);
+int cbor_emitter_flush(CBOREmitter *);
+int cbor_emit_raw_slow(CBOREmitter *, const void *, size_t);
+int cbor_emit_string(CBOREmitter *, uint8_t, const void *, size_t);
+int cbor_emit_utf8(CBOREmitter *, int, const void *, size_t, size_t);
+int cbor_emit_indefinite(CBOREmitter *, uint8_t);
+int cbor_emit_break(CBOREmitter *);
+int cbor_emit_token(CBOREmitter *, const CBORToken *);
+
+// Re-emits every token it visits to the CBOREmitter given as ctx, with all
+// heads in their shortest form
+extern const CBORVisitor cbor_emitter_visitor;
+
+
+// Append length bytes from buf to the output
+static inline int
+cbor_emit_raw(CBOREmitter *e, const void *buf, size_t length)
+{
+    if (e->capacity - e->length < length)
+        return cbor_emit_raw_slow(e, buf, length);
+    memcpy(e->buf + e->length, buf, length);
+    e->length += length;
+    return 0;
+}
+
+
+// Append the shortest head for major type major and argument value
+static inline int
+cbor_emit_head(CBOREmitter *e, uint8_t major, uint64_t value)
+{
+    uint8_t head[CBOR_MAX_HEAD_SIZE];
+
+    if (e->capacity - e->length < CBOR_MAX_HEAD_SIZE)
+        return cbor_emit_raw_slow(e, head, cbor_encode_head(head, major, value));
+    e->length += cbor_encode_head(e->buf + e->length, major, value);
+    return 0;
+}
+
+#endif
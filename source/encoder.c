@@ -15,6 +15,7 @@
 #include <datetime.h>
 #include "module.h"
 #include "halffloat.h"
+#include "codec.h"
 #include "tags.h"
 #include "encoder.h"
 
@@ -40,6 +41,8 @@ static PyObject * CBOREncoder_encode_int(CBOREncoderObject *, PyObject *);
 static PyObject * CBOREncoder_encode_float(CBOREncoderObject *, PyObject *);
 
 static int _CBOREncoder_set_fp(CBOREncoderObject *, PyObject *, void *);
+static int flush_output(void *, const uint8_t *, size_t);
+static int fp_flush(CBOREncoderObject *);
 static int _CBOREncoder_set_default(CBOREncoderObject *, PyObject *, void *);
 static int _CBOREncoder_set_timezone(CBOREncoderObject *, PyObject *, void *);
 
@@ -59,6 +62,9 @@ CBOREncoder_traverse(CBOREncoderObject *self, visitproc visit, void *arg)
     return 0;
 }
 
+static void
+key_cache_free(CBOREncoderObject *self);
+
 static int
 CBOREncoder_clear(CBOREncoderObject *self)
 {
@@ -69,6 +75,7 @@ CBOREncoder_clear(CBOREncoderObject *self)
     Py_CLEAR(self->tz);
     Py_CLEAR(self->shared_handler);
     Py_CLEAR(self->string_references);
+    key_cache_free(self);
     return 0;
 }
 
@@ -78,6 +85,7 @@ CBOREncoder_dealloc(CBOREncoderObject *self)
 {
     PyObject_GC_UnTrack(self);
     CBOREncoder_clear(self);
+    cbor_emitter_free(&self->out);
     Py_TYPE(self)->tp_free((PyObject *) self);
 }
 
@@ -108,37 +116,42 @@ CBOREncoder_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
         self->string_references = Py_None;
         self->enc_style = 0;
         self->timestamp_format = false;
+        self->extended_time = false;
         self->value_sharing = false;
         self->shared_handler = NULL;
         self->string_referencing = false;
         self->string_namespacing = false;
+        self->depth = 0;
+        self->key_cache = NULL;
+        cbor_emitter_init(&self->out, flush_output, self, 0);
     }
     return (PyObject *) self;
 }
 
 
-// CBOREncoder.__init__(self, fp=None, datetime_as_timestamp=0, timezone=None,
-//                      value_sharing=False, default=None, canonical=False,
-//                      date_as_datetime=False)
-int
-CBOREncoder_init(CBOREncoderObject *self, PyObject *args, PyObject *kwargs)
+static int
+encoder_init(CBOREncoderObject *self, PyObject *args, PyObject *kwargs,
+             const char *format)
 {
     static char *keywords[] = {
         "fp", "datetime_as_timestamp", "timezone", "value_sharing", "default",
-        "canonical", "date_as_datetime", "string_referencing", NULL
+        "canonical", "date_as_datetime", "string_referencing",
+        "datetime_as_extended_time", NULL
     };
     PyObject *tmp, *fp = NULL, *default_handler = NULL, *tz = NULL;
     int value_sharing = 0, timestamp_format = 0, enc_style = 0,
-	date_as_datetime = 0, string_referencing = 0;
+	date_as_datetime = 0, string_referencing = 0, extended_time = 0;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|pOpOppp", keywords,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords,
                 &fp, &timestamp_format, &tz, &value_sharing,
                 &default_handler, &enc_style, &date_as_datetime,
-                &string_referencing))
+                &string_referencing, &extended_time))
         return -1;
     // Predicate values are returned as ints, but need to be stored as bool or ubyte
     if (timestamp_format == 1)
 	self->timestamp_format = true;
+    if (extended_time == 1)
+	self->extended_time = true;
     if (value_sharing == 1)
 	self->value_sharing = true;
     if (enc_style == 1)
@@ -149,7 +162,7 @@ CBOREncoder_init(CBOREncoderObject *self, PyObject *args, PyObject *kwargs)
     }
 
 
-    if (_CBOREncoder_set_fp(self, fp, NULL) == -1)
+    if (fp && _CBOREncoder_set_fp(self, fp, NULL) == -1)
         return -1;
     if (default_handler && _CBOREncoder_set_default(self, default_handler, NULL) == -1)
         return -1;
@@ -194,13 +207,43 @@ CBOREncoder_init(CBOREncoderObject *self, PyObject *args, PyObject *kwargs)
 }
 
 
+// CBOREncoder.__init__(self, fp=None, datetime_as_timestamp=0, timezone=None,
+//                      value_sharing=False, default=None, canonical=False,
+//                      date_as_datetime=False, string_referencing=False,
+//                      datetime_as_extended_time=False)
+int
+CBOREncoder_init(CBOREncoderObject *self, PyObject *args, PyObject *kwargs)
+{
+    return encoder_init(self, args, kwargs, "O|pOpOpppp");
+}
+
+
+// Initialize an encoder whose output is passed to flush (with ctx) rather
+// than to a file object, or is left in self->out if flush is NULL (for the C
+// API); kwargs holds the other __init__ arguments
+int
+CBOREncoder_init_output(CBOREncoderObject *self, CBORFlushFunc flush,
+                        void *ctx, PyObject *kwargs)
+{
+    if (encoder_init(self, _CBOR2_empty_tuple, kwargs, "|OpOpOpppp") == -1)
+        return -1;
+    self->out.flush = flush;
+    self->out.ctx = ctx;
+    return 0;
+}
+
+
 // Property accessors ////////////////////////////////////////////////////////
 
 // CBOREncoder._get_fp(self)
 static PyObject *
 _CBOREncoder_get_fp(CBOREncoderObject *self, void *closure)
 {
-    PyObject *ret = PyMethod_GET_SELF(self->write);
+    PyObject *ret;
+
+    if (self->write == Py_None)
+        Py_RETURN_NONE;
+    ret = PyMethod_GET_SELF(self->write);
     Py_INCREF(ret);
     return ret;
 }
@@ -222,6 +265,11 @@ _CBOREncoder_set_fp(CBOREncoderObject *self, PyObject *value, void *closure)
                         "fp object must have a callable write method");
         return -1;
     }
+    // anything still buffered belongs to the old fp
+    if (fp_flush(self) == -1) {
+        Py_DECREF(write);
+        return -1;
+    }
 
     // It's a bit naughty caching the write method, but it does provide a
     // notable speed boost avoiding the lookup of the method on every write.
@@ -320,12 +368,14 @@ _CBOREncoder_get_canonical(CBOREncoderObject *self, void *closure)
 
 // Utility methods ///////////////////////////////////////////////////////////
 
+// The flush callback of self->out
 static int
-fp_write(CBOREncoderObject *self, const char *buf, const Py_ssize_t length)
+flush_output(void *ctx, const uint8_t *buf, size_t length)
 {
+    CBOREncoderObject *self = ctx;
     PyObject *bytes, *ret = NULL;
 
-    bytes = PyBytes_FromStringAndSize(buf, length);
+    bytes = PyBytes_FromStringAndSize((const char *) buf, length);
     if (bytes) {
         ret = PyObject_CallFunctionObjArgs(self->write, bytes, NULL);
         Py_XDECREF(ret);
@@ -335,6 +385,37 @@ fp_write(CBOREncoderObject *self, const char *buf, const Py_ssize_t length)
 }
 
 
+static int
+emit_error(CBOREncoderObject *self)
+{
+    // a failed flush has already raised an exception
+    if (self->out.error == CBOR_EMIT_NOMEM)
+        PyErr_NoMemory();
+    self->out.error = CBOR_EMIT_OK;
+    return -1;
+}
+
+
+static int
+fp_flush(CBOREncoderObject *self)
+{
+    if (cbor_emitter_flush(&self->out) == -1)
+        return emit_error(self);
+    return 0;
+}
+
+
+static int
+fp_write(CBOREncoderObject *self, const char *buf, const Py_ssize_t length)
+{
+    if (cbor_emit_raw(&self->out, buf, length) == -1)
+        return emit_error(self);
+    // Output is only held back within encode(); anything written by calling
+    // the other encode_* methods directly is passed straight on
+    return self->depth ? 0 : fp_flush(self);
+}
+
+
 // CBOREncoder.write(self, data)
 static PyObject *
 CBOREncoder_write(CBOREncoderObject *self, PyObject *data)
@@ -353,31 +434,9 @@ static int
 encode_length(CBOREncoderObject *self, const uint8_t major_tag,
               const uint64_t length)
 {
-    LeadByte *lead;
-    char buf[sizeof(LeadByte) + sizeof(uint64_t)];
-
-    lead = (LeadByte*)buf;
-    lead->major = major_tag;
-    if (length < 24) {
-        lead->subtype = (uint8_t) length;
-        return fp_write(self, buf, 1);
-    } else if (length <= UCHAR_MAX) {
-        lead->subtype = 24;
-        buf[1] = (uint8_t) length;
-        return fp_write(self, buf, sizeof(uint8_t) + 1);
-    } else if (length <= USHRT_MAX) {
-        lead->subtype = 25;
-        *((uint16_t*)(buf + 1)) = htobe16((uint16_t) length);
-        return fp_write(self, buf, sizeof(uint16_t) + 1);
-    } else if (length <= UINT_MAX) {
-        lead->subtype = 26;
-        *((uint32_t*)(buf + 1)) = htobe32((uint32_t) length);
-        return fp_write(self, buf, sizeof(uint32_t) + 1);
-    } else {
-        lead->subtype = 27;
-        *((uint64_t*)(buf + 1)) = htobe64(length);
-        return fp_write(self, buf, sizeof(uint64_t) + 1);
-    }
+    if (cbor_emit_head(&self->out, major_tag, length) == -1)
+        return emit_error(self);
+    return self->depth ? 0 : fp_flush(self);
 }
 
 
@@ -470,23 +529,11 @@ stringref(CBOREncoderObject *self, PyObject *value)
         uint64_t length = PyObject_Length(value);
         uint64_t next_index = PyDict_Size(self->string_references);
 
-        bool is_referenced = true;
-        if (next_index < 24) {
-            is_referenced = length >= 3;
-        } else if (next_index < 256) {
-            is_referenced = length >= 4;
-        } else if (next_index < 65536) {
-            is_referenced = length >= 5;
-        } else if (next_index < 4294967296ull) {
-            is_referenced = length >= 7;
-        } else {
-            is_referenced = length >= 11;
-        }
-
-        if (is_referenced) {
+        if (length >= cbor_stringref_min_length(next_index)) {
             index = PyLong_FromLongLong(next_index);
             if (index && PyDict_SetItem(self->string_references, value, index) == 0)
                 retcode = 0;
+            Py_XDECREF(index);
         } else {
             retcode = 0;
         }
@@ -677,6 +724,87 @@ CBOREncoder_encode_int(CBOREncoderObject *self, PyObject *value)
 }
 
 
+static PyObject *
+encode_string_data(CBOREncoderObject *self, const uint8_t major_tag,
+                   const char *buf, const Py_ssize_t length)
+{
+    if (encode_length(self, major_tag, length) == -1)
+        return NULL;
+    if (fp_write(self, buf, length) == -1)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+
+// Transcode the count code points of the given kind at data into a bytes
+// object of its own and hand that to write(), rather than a buffer-full at a
+// time through the output buffer
+static PyObject *
+write_text(CBOREncoderObject *self, int kind, const void *data,
+           Py_ssize_t count, size_t length)
+{
+    PyObject *bytes, *ret;
+
+    if (fp_flush(self) == -1)
+        return NULL;
+    bytes = PyBytes_FromStringAndSize(NULL, length);
+    if (!bytes)
+        return NULL;
+    cbor_utf8_encode((uint8_t *) PyBytes_AS_STRING(bytes), kind, data, count);
+    ret = PyObject_CallFunctionObjArgs(self->write, bytes, NULL);
+    Py_DECREF(bytes);
+    if (!ret)
+        return NULL;
+    Py_DECREF(ret);
+    Py_RETURN_NONE;
+}
+
+
+// Encode the str value as a text string straight from its internal (PEP 393)
+// form. PyUnicode_AsUTF8AndSize() would be simpler, but it caches a UTF-8
+// copy of every non-ASCII string it's given for as long as the string lives;
+// a copy that's already there is used, though
+static PyObject *
+encode_text(CBOREncoderObject *self, PyObject *value)
+{
+    PyCompactUnicodeObject *compact = (PyCompactUnicodeObject *) value;
+    const void *data;
+    Py_ssize_t count;
+    size_t length;
+    int kind;
+
+#if PY_VERSION_HEX < 0x030C0000
+    if (PyUnicode_READY(value) == -1)
+        return NULL;
+#endif
+    data = PyUnicode_DATA(value);
+    count = PyUnicode_GET_LENGTH(value);
+    if (PyUnicode_IS_ASCII(value))
+        return encode_string_data(self, 3, data, count);
+    if (compact->utf8)
+        return encode_string_data(self, 3, compact->utf8, compact->utf8_length);
+
+    kind = PyUnicode_KIND(value);
+    length = cbor_utf8_length(kind, data, count);
+    if (length == SIZE_MAX) {
+        // it contains a lone surrogate; let the codec raise the error
+        Py_XDECREF(PyUnicode_AsUTF8String(value));
+        return NULL;
+    }
+    if (encode_length(self, 3, length) == -1)
+        return NULL;
+    if (self->out.flush == flush_output && length >= self->out.flush_size)
+        return write_text(self, kind, data, count, length);
+    if (cbor_emit_utf8(&self->out, kind, data, count, length) == -1) {
+        emit_error(self);
+        return NULL;
+    }
+    if (!self->depth && fp_flush(self) == -1)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+
 // CBOREncoder.encode_bytestring(self, value)
 static PyObject *
 CBOREncoder_encode_bytestring(CBOREncoderObject *self, PyObject *value)
@@ -693,11 +821,7 @@ CBOREncoder_encode_bytestring(CBOREncoderObject *self, PyObject *value)
             case  1: Py_RETURN_NONE;
         }
     }
-    if (encode_length(self, 2, length) == -1)
-        return NULL;
-    if (fp_write(self, buf, length) == -1)
-        return NULL;
-    Py_RETURN_NONE;
+    return encode_string_data(self, 2, buf, length);
 }
 
 
@@ -706,8 +830,6 @@ static PyObject *
 CBOREncoder_encode_bytearray(CBOREncoderObject *self, PyObject *value)
 {
     // major type 2 (again)
-    Py_ssize_t length;
-
     if (!PyByteArray_Check(value)) {
         PyErr_Format(_CBOR2_CBOREncodeValueError,
                 "invalid bytearray value %R", value);
@@ -721,34 +843,197 @@ CBOREncoder_encode_bytearray(CBOREncoderObject *self, PyObject *value)
         }
     }
 
-    length = PyByteArray_GET_SIZE(value);
-    if (encode_length(self, 2, length) == -1)
+    return encode_string_data(
+            self, 2, PyByteArray_AS_STRING(value), PyByteArray_GET_SIZE(value));
+}
+
+
+// Hand the contents of value to write() as they are, in a memoryview of
+// their own (of unsigned bytes, like the Python encoder's, whatever the
+// format of value) rather than copying them into a bytes object
+static PyObject *
+write_buffer(CBOREncoderObject *self, PyObject *value)
+{
+    PyObject *view, *bytes_view, *ret;
+
+    if (fp_flush(self) == -1)
+        return NULL;
+    view = PyMemoryView_FromObject(value);
+    if (!view)
         return NULL;
-    if (fp_write(self, PyByteArray_AS_STRING(value), length) == -1)
+    bytes_view = PyObject_CallMethod(view, "cast", "s", "B");
+    Py_DECREF(view);
+    if (!bytes_view)
         return NULL;
+    ret = PyObject_CallFunctionObjArgs(self->write, bytes_view, NULL);
+    Py_DECREF(bytes_view);
+    if (!ret)
+        return NULL;
+    Py_DECREF(ret);
     Py_RETURN_NONE;
 }
 
 
+// CBOREncoder.encode_buffer(self, value)
+static PyObject *
+CBOREncoder_encode_buffer(CBOREncoderObject *self, PyObject *value)
+{
+    // major type 2 (from any C-contiguous buffer)
+    PyObject *bytes, *ret = NULL;
+    Py_buffer view;
+
+    if (PyObject_GetBuffer(value, &view, PyBUF_FULL_RO) == -1)
+        return NULL;
+    if (!PyBuffer_IsContiguous(&view, 'C'))
+        PyErr_Format(_CBOR2_CBOREncodeValueError,
+                "cannot serialize non-contiguous buffer %R", value);
+    else if (self->string_referencing) {
+        // references are keyed by value, which needs something hashable
+        bytes = PyBytes_FromStringAndSize(view.buf, view.len);
+        if (bytes) {
+            ret = CBOREncoder_encode_bytestring(self, bytes);
+            Py_DECREF(bytes);
+        }
+    } else if (self->out.flush == flush_output &&
+               (size_t) view.len >= self->out.flush_size) {
+        if (encode_length(self, 2, view.len) == 0)
+            ret = write_buffer(self, value);
+    } else
+        ret = encode_string_data(self, 2, view.buf, view.len);
+    PyBuffer_Release(&view);
+    return ret;
+}
+
+
 // CBOREncoder.encode_string(self, value)
 static PyObject *
 CBOREncoder_encode_string(CBOREncoderObject *self, PyObject *value)
 {
     // major type 3
-    const char *buf;
-    Py_ssize_t length;
-
-    buf = PyUnicode_AsUTF8AndSize(value, &length);
-    if (!buf)
-        return NULL;
     if (self->string_referencing)
         switch (stringref(self, value)) {
             case -1: return NULL;
             case  1: Py_RETURN_NONE;
         }
-    if (encode_length(self, 3, length) == -1)
+    return encode_text(self, value);
+}
+
+
+// Dict keys tend to be the same few strings over and over, so the encoded
+// forms of (short) str keys are kept in a small table indexed by their hash.
+// A slot is filled by the first key that lands in it and kept for the life
+// of the encoder; keys colliding with it are just encoded each time. Keys are
+// usually the very same objects each time, so they're compared by identity
+// before resorting to their hashes and contents
+#define KEY_CACHE_SIZE 256          // must be a power of 2
+#define KEY_CACHE_MAX_LENGTH 64     // in code points
+
+static void
+key_cache_free(CBOREncoderObject *self)
+{
+    size_t i;
+
+    if (self->key_cache) {
+        for (i = 0; i < KEY_CACHE_SIZE; ++i) {
+            Py_XDECREF(self->key_cache[i].key);
+            Py_XDECREF(self->key_cache[i].encoded);
+        }
+        PyMem_Free(self->key_cache);
+        self->key_cache = NULL;
+    }
+}
+
+
+// Return a new bytes object holding the head and UTF-8 of the str value,
+// or NULL if it can't be encoded (without setting an error)
+static PyObject *
+encode_key_bytes(PyObject *value)
+{
+    CBOREmitter out;
+    const void *data;
+    size_t count, length;
+    PyObject *ret = NULL;
+    int kind;
+
+    data = PyUnicode_DATA(value);
+    count = PyUnicode_GET_LENGTH(value);
+    kind = PyUnicode_KIND(value);
+    length = PyUnicode_IS_ASCII(value) ?
+        count : cbor_utf8_length(kind, data, count);
+    if (length == SIZE_MAX)
         return NULL;
-    if (fp_write(self, buf, length) == -1)
+    cbor_emitter_init(&out, NULL, NULL, CBOR_MAX_HEAD_SIZE + length);
+    if (cbor_emit_head(&out, 3, length) == 0 &&
+            cbor_emit_utf8(&out, kind, data, count, length) == 0)
+        ret = PyBytes_FromStringAndSize((const char *) out.buf, out.length);
+    cbor_emitter_free(&out);
+    if (!ret)
+        PyErr_Clear();
+    return ret;
+}
+
+
+static inline bool
+key_equal(CBORKeyCacheEntry *entry, PyObject *value, Py_hash_t hash)
+{
+    Py_ssize_t length = PyUnicode_GET_LENGTH(value);
+    int kind = PyUnicode_KIND(value);
+
+    return entry->hash == hash &&
+        PyUnicode_GET_LENGTH(entry->key) == length &&
+        PyUnicode_KIND(entry->key) == kind &&
+        memcmp(PyUnicode_DATA(entry->key), PyUnicode_DATA(value),
+               length * kind) == 0;
+}
+
+
+// Encode the str dict key value, from the key cache where possible. Not for
+// use with string references, which could replace the key with a reference
+static PyObject *
+encode_key(CBOREncoderObject *self, PyObject *value)
+{
+    CBORKeyCacheEntry *entry;
+    PyObject *encoded;
+    Py_hash_t hash;
+    int ret;
+
+#if PY_VERSION_HEX < 0x030C0000
+    if (PyUnicode_READY(value) == -1)
+        return NULL;
+#endif
+    if (PyUnicode_GET_LENGTH(value) > KEY_CACHE_MAX_LENGTH)
+        return encode_text(self, value);
+    // keys of existing dicts have their hash cached already
+    hash = PyObject_Hash(value);
+    if (hash == -1)
+        return NULL;
+    if (!self->key_cache) {
+        self->key_cache = PyMem_Calloc(KEY_CACHE_SIZE, sizeof(CBORKeyCacheEntry));
+        if (!self->key_cache)
+            return PyErr_NoMemory();
+    }
+    entry = &self->key_cache[(size_t) hash & (KEY_CACHE_SIZE - 1)];
+    if (entry->key != value) {
+        if (entry->key) {
+            if (!key_equal(entry, value, hash))
+                return encode_text(self, value);
+        } else {
+            encoded = encode_key_bytes(value);
+            if (!encoded)
+                return encode_text(self, value);
+            Py_INCREF(value);
+            entry->key = value;
+            entry->hash = hash;
+            entry->encoded = encoded;
+        }
+    }
+    // hold on to the encoded key in case writing it re-enters the encoder
+    // (through fp.write) and evicts it
+    encoded = entry->encoded;
+    Py_INCREF(encoded);
+    ret = fp_write(self, PyBytes_AS_STRING(encoded), PyBytes_GET_SIZE(encoded));
+    Py_DECREF(encoded);
+    if (ret == -1)
         return NULL;
     Py_RETURN_NONE;
 }
@@ -802,7 +1087,10 @@ encode_dict(CBOREncoderObject *self, PyObject *value)
     if (encode_length(self, 5, PyDict_Size(value)) == 0) {
         while (PyDict_Next(value, &pos, &key, &val)) {
             Py_INCREF(key);
-            ret = CBOREncoder_encode(self, key);
+            if (PyUnicode_CheckExact(key) && !self->string_referencing)
+                ret = encode_key(self, key);
+            else
+                ret = CBOREncoder_encode(self, key);
             Py_DECREF(key);
             if (ret)
                 Py_DECREF(ret);
@@ -821,49 +1109,114 @@ encode_dict(CBOREncoderObject *self, PyObject *value)
 }
 
 
+// Returns true if value is a dict (or a subclass) whose iteration order is
+// the dict's own, so that PyDict_Next() visits its items in the same order
+// as items() does. OrderedDict keeps an order of its own and doesn't qualify.
+static inline bool
+plain_dict(PyObject *value)
+{
+    return PyDict_CheckExact(value) || (
+            PyDict_Check(value) && Py_TYPE(value)->tp_iter == PyDict_Type.tp_iter);
+}
+
+
+// Returns an iterator over the items() of the mapping, which is asked for
+// them lazily rather than through PyMapping_Items(), so that mappings like
+// ChainMap aren't copied into a list first
+static PyObject *
+mapping_items_iter(PyObject *value)
+{
+    PyObject *items, *ret;
+
+    items = PyObject_CallMethodObjArgs(value, _CBOR2_str_items, NULL);
+    if (!items)
+        return NULL;
+    ret = PyObject_GetIter(items);
+    Py_DECREF(items);
+    return ret;
+}
+
+
+// Fetches the next (key, value) pair from an iterator returned by
+// mapping_items_iter(). Returns 1 with a new reference in *item, 0 when the
+// iterator is exhausted, or -1 on error
+static int
+mapping_items_next(PyObject *iter, PyObject **item)
+{
+    *item = PyIter_Next(iter);
+    if (!*item)
+        return PyErr_Occurred() ? -1 : 0;
+    if (!PyTuple_Check(*item) || PyTuple_GET_SIZE(*item) != 2) {
+        PyErr_Format(
+            _CBOR2_CBOREncodeTypeError,
+            "items() of %R must yield (key, value) pairs", Py_TYPE(*item));
+        Py_CLEAR(*item);
+        return -1;
+    }
+    return 1;
+}
+
+
+static int
+mapping_size_changed(PyObject *value)
+{
+    PyErr_Format(
+        _CBOR2_CBOREncodeValueError,
+        "%R changed size during encoding", Py_TYPE(value));
+    return -1;
+}
+
+
 static PyObject *
 encode_mapping(CBOREncoderObject *self, PyObject *value)
 {
-    PyObject **items, *list, *fast, *ret = NULL;
+    PyObject *iter, *item, *ret;
     Py_ssize_t length;
+    int status;
 
-    list = PyMapping_Items(value);
-    if (list) {
-        fast = PySequence_Fast(list, "internal error");
-        if (fast) {
-            length = PySequence_Fast_GET_SIZE(fast);
-            items = PySequence_Fast_ITEMS(fast);
-            if (encode_length(self, 5, length) == 0) {
-                while (length) {
-                    ret = CBOREncoder_encode(self, PyTuple_GET_ITEM(*items, 0));
-                    if (ret)
-                        Py_DECREF(ret);
-                    else
-                        goto error;
-                    ret = CBOREncoder_encode(self, PyTuple_GET_ITEM(*items, 1));
-                    if (ret)
-                        Py_DECREF(ret);
-                    else
-                        goto error;
-                    items++;
-                    length--;
-                }
-                ret = Py_None;
-                Py_INCREF(ret);
-            }
-error:
-            Py_DECREF(fast);
+    // The header needs the length up front; the items are then encoded as
+    // they come and checked against it at the end
+    length = PyObject_Size(value);
+    if (length == -1)
+        return NULL;
+    if (encode_length(self, 5, length) == -1)
+        return NULL;
+    iter = mapping_items_iter(value);
+    if (!iter)
+        return NULL;
+    while ((status = mapping_items_next(iter, &item)) == 1) {
+        if (length == 0) {
+            Py_DECREF(item);
+            status = mapping_size_changed(value);
+            break;
         }
-        Py_DECREF(list);
+        ret = CBOREncoder_encode(self, PyTuple_GET_ITEM(item, 0));
+        if (ret) {
+            Py_DECREF(ret);
+            ret = CBOREncoder_encode(self, PyTuple_GET_ITEM(item, 1));
+        }
+        Py_DECREF(item);
+        if (ret)
+            Py_DECREF(ret);
+        else {
+            status = -1;
+            break;
+        }
+        length--;
     }
-    return ret;
+    Py_DECREF(iter);
+    if (status == 0 && length)
+        status = mapping_size_changed(value);
+    if (status == -1)
+        return NULL;
+    Py_RETURN_NONE;
 }
 
 
 static PyObject *
 CBOREncoder__encode_map(CBOREncoderObject *self, PyObject *value)
 {
-    if (PyDict_Check(value))
+    if (plain_dict(value))
         return encode_dict(self, value);
     else
         return encode_mapping(self, value);
@@ -936,30 +1289,36 @@ CBOREncoder_encode_semantic(CBOREncoderObject *self, PyObject *value)
 static PyObject *
 encode_datestr(CBOREncoderObject *self, PyObject *datestr)
 {
+    PyObject *bytes, *ret = NULL;
     const char *buf;
     Py_ssize_t length, match;
 
     match = PyUnicode_Tailmatch(
         datestr, _CBOR2_str_utc_suffix, PyUnicode_GET_LENGTH(datestr) - 6,
         PyUnicode_GET_LENGTH(datestr), 1);
-    if (match != -1) {
-        buf = PyUnicode_AsUTF8AndSize(datestr, &length);
-        if (buf) {
-            if (fp_write(self, "\xC0", 1) == 0) {
-                if (match) {
-                    if (encode_length(self, 3, length - 5) == 0)
-                        if (fp_write(self, buf, length - 6) == 0)
-                            if (fp_write(self, "Z", 1) == 0)
-                                Py_RETURN_NONE;
-                } else {
-                    if (encode_length(self, 3, length) == 0)
-                        if (fp_write(self, buf, length) == 0)
-                            Py_RETURN_NONE;
-                }
-            }
+    if (match == -1)
+        return NULL;
+    // isoformat() only ever returns ASCII, but don't count on it
+    bytes = PyUnicode_AsUTF8String(datestr);
+    if (!bytes)
+        return NULL;
+    buf = PyBytes_AS_STRING(bytes);
+    length = PyBytes_GET_SIZE(bytes);
+    if (fp_write(self, "\xC0", 1) == 0) {
+        if (match) {
+            if (encode_length(self, 3, length - 5) == 0)
+                if (fp_write(self, buf, length - 6) == 0)
+                    if (fp_write(self, "Z", 1) == 0)
+                        ret = Py_None;
+        } else {
+            if (encode_length(self, 3, length) == 0)
+                if (fp_write(self, buf, length) == 0)
+                    ret = Py_None;
         }
     }
-    return NULL;
+    Py_DECREF(bytes);
+    Py_XINCREF(ret);
+    return ret;
 }
 
 
@@ -984,11 +1343,83 @@ encode_timestamp(CBOREncoderObject *self, PyObject *timestamp)
 }
 
 
+// The number of days from 1970-01-01 to the given date (of the proleptic
+// Gregorian calendar), from http://howardhinnant.github.io/date_algorithms.html
+static int64_t
+days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+    int64_t era;
+    unsigned yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned) (y - era * 400);
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t) doe - 719468;
+}
+
+
+static PyObject *
+encode_extended_time(CBOREncoderObject *self, PyObject *value)
+{
+    // semantic type 1001, with the fraction of a second in microseconds
+    // (key -6); worked out in integers, so it's exact
+    PyObject *offset;
+    int64_t seconds, micros;
+
+    offset = PyObject_CallMethodObjArgs(value, _CBOR2_str_utcoffset, NULL);
+    if (!offset)
+        return NULL;
+    if (!PyDelta_Check(offset)) {
+        PyErr_Format(_CBOR2_CBOREncodeValueError,
+                     "datetime %R has no UTC offset", value);
+        Py_DECREF(offset);
+        return NULL;
+    }
+    seconds = days_from_civil(
+            PyDateTime_GET_YEAR(value),
+            PyDateTime_GET_MONTH(value),
+            PyDateTime_GET_DAY(value)) * 86400
+        + PyDateTime_DATE_GET_HOUR(value) * 3600
+        + PyDateTime_DATE_GET_MINUTE(value) * 60
+        + PyDateTime_DATE_GET_SECOND(value)
+        - (int64_t) PyDateTime_DELTA_GET_DAYS(offset) * 86400
+        - PyDateTime_DELTA_GET_SECONDS(offset);
+    micros = PyDateTime_DATE_GET_MICROSECOND(value)
+        - PyDateTime_DELTA_GET_MICROSECONDS(offset);
+    Py_DECREF(offset);
+    if (micros < 0) {
+        micros += 1000000;
+        seconds--;
+    }
+
+    // the tag, a map of one or two entries, and the key of the base time
+    if (fp_write(self, micros ? "\xD9\x03\xE9\xA2\x01" : "\xD9\x03\xE9\xA1\x01",
+                 5) == -1)
+        return NULL;
+    if (seconds < 0) {
+        if (encode_length(self, 1, -1 - seconds) == -1)
+            return NULL;
+    } else {
+        if (encode_length(self, 0, seconds) == -1)
+            return NULL;
+    }
+    if (micros) {
+        if (fp_write(self, "\x25", 1) == -1)
+            return NULL;
+        if (encode_length(self, 0, micros) == -1)
+            return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
 // CBOREncoder.encode_datetime(self, value)
 static PyObject *
 CBOREncoder_encode_datetime(CBOREncoderObject *self, PyObject *value)
 {
-    // semantic type 0 or 1
+    // semantic type 0, 1 or 1001
     PyObject *tmp, *ret = NULL;
 
     if (PyDateTime_Check(value)) {
@@ -1017,7 +1448,10 @@ CBOREncoder_encode_datetime(CBOREncoderObject *self, PyObject *value)
         }
 
         if (value) {
-            if (self->timestamp_format) {
+            if (self->extended_time) {
+                tmp = NULL;
+                ret = encode_extended_time(self, value);
+            } else if (self->timestamp_format) {
                 tmp = PyObject_CallMethodObjArgs(
                         value, _CBOR2_str_timestamp, NULL);
                 if (tmp)
@@ -1788,52 +2222,47 @@ dict_to_canonical_list(CBOREncoderObject *self, PyObject *value)
 static PyObject *
 mapping_to_canonical_list(CBOREncoderObject *self, PyObject *value)
 {
-    PyObject **items, *map_items, *fast, *bytes, *length, *tuple, *ret, *list;
-    Py_ssize_t fast_len, index;
+    PyObject *iter, *item, *bytes, *length, *tuple, *list;
+    Py_ssize_t expected;
+    int status;
 
-    ret = list = PyList_New(PyMapping_Size(value));
-    if (list) {
-        map_items = PyMapping_Items(value);
-        if (map_items) {
-            fast = PySequence_Fast(map_items, "internal error");
-            if (fast) {
-                index = 0;
-                fast_len = PySequence_Fast_GET_SIZE(fast);
-                items = PySequence_Fast_ITEMS(fast);
-                while (ret && fast_len) {
-                    bytes = CBOREncoder_encode_to_bytes(self,
-                        PyTuple_GET_ITEM(*items, 0));
-                    if (bytes) {
-                        length = PyLong_FromSsize_t(PyBytes_GET_SIZE(bytes));
-                        if (length) {
-                            tuple = PyTuple_Pack(4,
-                                length, bytes,
-                                PyTuple_GET_ITEM(*items, 0),
-                                PyTuple_GET_ITEM(*items, 1));
-                            if (tuple)
-                                PyList_SET_ITEM(list, index, tuple); // steals ref
-                            else
-                                ret = NULL;
-                            Py_DECREF(length);
-                        } else
-                            ret = NULL;
-                        Py_DECREF(bytes);
-                    } else
-                        ret = NULL;
-                    items++;
-                    index++;
-                    fast_len--;
-                }
-                Py_DECREF(fast);
-            } else
-                ret = NULL;
-            Py_DECREF(map_items);
-        } else
-            ret = NULL;
-        if (!ret)
-            Py_DECREF(list);
+    expected = PyObject_Size(value);
+    if (expected == -1)
+        return NULL;
+    iter = mapping_items_iter(value);
+    if (!iter)
+        return NULL;
+    list = PyList_New(0);
+    if (!list) {
+        Py_DECREF(iter);
+        return NULL;
     }
-    return ret;
+    while ((status = mapping_items_next(iter, &item)) == 1) {
+        tuple = NULL;
+        bytes = CBOREncoder_encode_to_bytes(self, PyTuple_GET_ITEM(item, 0));
+        if (bytes) {
+            length = PyLong_FromSsize_t(PyBytes_GET_SIZE(bytes));
+            if (length) {
+                tuple = PyTuple_Pack(4, length, bytes,
+                        PyTuple_GET_ITEM(item, 0), PyTuple_GET_ITEM(item, 1));
+                Py_DECREF(length);
+            }
+            Py_DECREF(bytes);
+        }
+        Py_DECREF(item);
+        if (!tuple || PyList_Append(list, tuple) == -1) {
+            Py_XDECREF(tuple);
+            status = -1;
+            break;
+        }
+        Py_DECREF(tuple);
+    }
+    Py_DECREF(iter);
+    if (status == 0 && PyList_GET_SIZE(list) != expected)
+        status = mapping_size_changed(value);
+    if (status == -1)
+        Py_CLEAR(list);
+    return list;
 }
 
 
@@ -1845,7 +2274,7 @@ encode_canonical_map(CBOREncoderObject *self, PyObject *value)
 
     // Don't generate string references when sorting keys
     self->string_referencing = false;
-    if (PyDict_Check(value))
+    if (plain_dict(value))
         list = dict_to_canonical_list(self, value);
     else
         list = mapping_to_canonical_list(self, value);
@@ -1951,11 +2380,35 @@ CBOREncoder_encode_canonical_set(CBOREncoderObject *self, PyObject *value)
 
 // Main entry points /////////////////////////////////////////////////////////
 
-static inline PyObject *
-encode(CBOREncoderObject *self, PyObject *value)
+// Encode value with the encoder registered for its type (or a superclass of
+// it) in self->encoders, or the default handler
+static PyObject *
+encode_by_lookup(CBOREncoderObject *self, PyObject *value)
 {
     PyObject *encoder, *ret = NULL;
 
+    encoder = CBOREncoder_find_encoder(self, (PyObject *)Py_TYPE(value));
+    if (encoder) {
+        if (encoder != Py_None)
+            ret = PyObject_CallFunctionObjArgs(encoder, self, value, NULL);
+        else if (self->default_handler != Py_None)
+            ret = PyObject_CallFunctionObjArgs(
+                    self->default_handler, self, value, NULL);
+        else
+            PyErr_Format(
+                _CBOR2_CBOREncodeTypeError,
+                "cannot serialize type %R", (PyObject *)Py_TYPE(value));
+        Py_DECREF(encoder);
+    }
+    return ret;
+}
+
+
+// The general encoder loop, used while value sharing or string references are
+// enabled (or enc_style has a custom value)
+static PyObject *
+encode_full(CBOREncoderObject *self, PyObject *value)
+{
     switch (self->enc_style) {
         case 1:
             // canonical encoders
@@ -1996,23 +2449,52 @@ encode(CBOREncoderObject *self, PyObject *value)
                 return CBOREncoder_encode_set(self, value);
             // fall-thru
         default:
-            // lookup type (or subclass) in self->encoders
-            encoder = CBOREncoder_find_encoder(self, (PyObject *)Py_TYPE(value));
-            if (encoder) {
-                if (encoder != Py_None)
-                    ret = PyObject_CallFunctionObjArgs(
-                            encoder, self, value, NULL);
-                else if (self->default_handler != Py_None)
-                    ret = PyObject_CallFunctionObjArgs(
-                            self->default_handler, self, value, NULL);
-                else
-                    PyErr_Format(
-                        _CBOR2_CBOREncodeTypeError,
-                        "cannot serialize type %R", (PyObject *)Py_TYPE(value));
-                Py_DECREF(encoder);
-            }
+            return encode_by_lookup(self, value);
+    }
+}
+
+
+// Without value sharing, containers are only recorded in self->shared to
+// detect cycles. The specialised loops below skip that until the nesting gets
+// this deep: a cycle recurses without end so it's still caught there, while
+// the ordinary (shallow) data doesn't pay for a dict insert and delete per
+// container
+#define CYCLE_CHECK_DEPTH 32
+
+static inline PyObject *
+encode_unshared(CBOREncoderObject *self, EncodeFunction *encoder,
+                PyObject *value)
+{
+    if (self->depth < CYCLE_CHECK_DEPTH)
+        return encoder(self, value);
+    return encode_shared(self, encoder, value);
+}
+
+#define VARIANT(name) name##_plain
+#define CANONICAL 0
+#include "encoder_variant.h"
+
+#define VARIANT(name) name##_canonical
+#define CANONICAL 1
+#include "encoder_variant.h"
+
+
+// Picks the cheapest loop for the encoder's current options; value sharing
+// and string references need the general one. This is done for every call
+// to CBOREncoder_encode() rather than once, as the options can be changed
+// at any time (and are by the stringref namespace tag), but calls from
+// within a specialised loop stay in that loop
+static inline PyObject *
+encode(CBOREncoderObject *self, PyObject *value)
+{
+    if (self->value_sharing || self->string_referencing ||
+            self->string_namespacing)
+        return encode_full(self, value);
+    switch (self->enc_style) {
+        case 0:  return encode_value_plain(self, value);
+        case 1:  return encode_value_canonical(self, value);
+        default: return encode_full(self, value);
     }
-    return ret;
 }
 
 
@@ -2025,36 +2507,39 @@ CBOREncoder_encode(CBOREncoderObject *self, PyObject *value)
     // TODO reset shared dict?
     if (Py_EnterRecursiveCall(" in CBOREncoder.encode"))
         return NULL;
+    self->depth++;
     ret = encode(self, value);
+    if (--self->depth == 0) {
+        // the output of a failed encode is incomplete anyway
+        if (!ret)
+            self->out.length = 0;
+        else if (fp_flush(self) == -1)
+            Py_CLEAR(ret);
+    }
     Py_LeaveRecursiveCall();
     return ret;
 }
 
 
+// CBOREncoder.encode_to_bytes(self, value)
 static PyObject *
 CBOREncoder_encode_to_bytes(CBOREncoderObject *self, PyObject *value)
 {
-    PyObject *save_write, *buf, *ret = NULL;
-
-    if (!_CBOR2_BytesIO && _CBOR2_init_BytesIO() == -1)
-        return NULL;
+    CBOREmitter save_out = self->out;
+    PyObject *ret;
 
-    save_write = self->write;
-    buf = PyObject_CallFunctionObjArgs(_CBOR2_BytesIO, NULL);
-    if (buf) {
-        self->write = PyObject_GetAttr(buf, _CBOR2_str_write);
-        if (self->write) {
-            ret = CBOREncoder_encode(self, value);
-            if (ret) {
-                assert(ret == Py_None);
-                Py_DECREF(ret);
-                ret = PyObject_CallMethodObjArgs(buf, _CBOR2_str_getvalue, NULL);
-            }
-            Py_DECREF(self->write);
-        }
-        Py_DECREF(buf);
+    // encode into a separate in-memory buffer, leaving anything pending in
+    // the main one where it is
+    cbor_emitter_init(&self->out, NULL, NULL, 64);
+    ret = CBOREncoder_encode(self, value);
+    if (ret) {
+        assert(ret == Py_None);
+        Py_DECREF(ret);
+        ret = PyBytes_FromStringAndSize(
+            (const char *) self->out.buf, self->out.length);
     }
-    self->write = save_write;
+    cbor_emitter_free(&self->out);
+    self->out = save_out;
     return ret;
 }
 
@@ -2069,6 +2554,8 @@ static PyMemberDef CBOREncoder_members[] = {
         "anything else is custom)"},
     {"datetime_as_timestamp", T_BOOL, offsetof(CBOREncoderObject, timestamp_format), 0,
         "the sub-type to use when encoding datetime objects"},
+    {"datetime_as_extended_time", T_BOOL, offsetof(CBOREncoderObject, extended_time), 0,
+        "if True, encode datetime objects as extended times (tag 1001)"},
     {"value_sharing", T_BOOL, offsetof(CBOREncoderObject, value_sharing), 0,
         "if True, then efficiently encode recursive structures"},
     {NULL}
@@ -2121,6 +2608,8 @@ static PyMethodDef CBOREncoder_methods[] = {
         "encode the specified bytes *value* to the output"},
     {"encode_bytearray", (PyCFunction) CBOREncoder_encode_bytearray, METH_O,
         "encode the specified bytearray *value* to the output"},
+    {"encode_buffer", (PyCFunction) CBOREncoder_encode_buffer, METH_O,
+        "encode the contents of the buffer *value* to the output"},
     {"encode_string", (PyCFunction) CBOREncoder_encode_string, METH_O,
         "encode the specified string *value* to the output"},
     {"encode_array", (PyCFunction) CBOREncoder_encode_array, METH_O,
@@ -2197,6 +2686,12 @@ PyDoc_STRVAR(CBOREncoder__doc__,
 "    when True, use \"canonical\" CBOR representation; this typically\n"
 "    involves sorting maps, sets, etc. into a pre-determined order ensuring\n"
 "    that serializations are comparable without decoding\n"
+":param bool datetime_as_extended_time:\n"
+"    set to ``True`` to serialize datetimes as extended times (CBOR tag\n"
+"    1001): integer seconds since the epoch plus, if needed, an integer\n"
+"    number of microseconds, so they're exact but as concise as\n"
+"    timestamps (this takes precedence over ``datetime_as_timestamp``,\n"
+"    and also loses the timezone information)\n"
 "\n"
 ".. _CBOR: https://cbor.io/\n"
 );
@@ -2,6 +2,7 @@
 #include <Python.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "emitter.h"
 
 // Constants for decimal_classify
 #define DC_NORMAL 0
@@ -9,6 +10,13 @@
 #define DC_NAN 2
 #define DC_ERROR -1
 
+// A str dict key along with its encoded form, for the encoder's key cache
+typedef struct {
+    PyObject *key;
+    Py_hash_t hash;
+    PyObject *encoded;  // bytes holding the key's head and UTF-8
+} CBORKeyCacheEntry;
+
 typedef struct {
     PyObject_HEAD
     PyObject *write;    // cached write() method of fp
@@ -20,13 +28,19 @@ typedef struct {
     PyObject *shared_handler;
     uint8_t enc_style;  // 0=regular, 1=canonical, 2=custom
     bool timestamp_format;
+    bool extended_time;
     bool value_sharing;
     bool string_referencing;
     bool string_namespacing;
+    Py_ssize_t depth;   // nesting of encode() calls; output is flushed at 0
+    CBORKeyCacheEntry *key_cache;  // allocated on first use
+    CBOREmitter out;    // buffered output, flushed to write()
 } CBOREncoderObject;
 
 extern PyTypeObject CBOREncoderType;
 
 PyObject * CBOREncoder_new(PyTypeObject *, PyObject *, PyObject *);
 int CBOREncoder_init(CBOREncoderObject *, PyObject *, PyObject *);
+int CBOREncoder_init_output(CBOREncoderObject *, CBORFlushFunc, void *,
+                            PyObject *);
 PyObject * CBOREncoder_encode(CBOREncoderObject *, PyObject *);
@@ -0,0 +1,139 @@
+// The type dispatch of the encoder and the container encoders it recurses
+// through, specialised for encoders without value sharing or string
+// references. encoder.c includes this file once per variant, defining:
+//
+//   VARIANT(name)  the name given to each function in this variant
+//   CANONICAL      1 to encode floats, dicts and sets canonically
+//
+// Items of lists, tuples and dicts are encoded by the same variant without
+// going back through CBOREncoder_encode(). Other types go to the general
+// encoders, whose own calls to CBOREncoder_encode() pick the loop for the
+// options in effect at that point. There's deliberately no include guard.
+
+static PyObject * VARIANT(encode)(CBOREncoderObject *, PyObject *);
+
+
+static PyObject *
+VARIANT(encode_array)(CBOREncoderObject *self, PyObject *value)
+{
+    PyObject **items, *fast, *ret = NULL;
+    Py_ssize_t length;
+
+    fast = PySequence_Fast(value, "argument must be iterable");
+    if (fast) {
+        length = PySequence_Fast_GET_SIZE(fast);
+        items = PySequence_Fast_ITEMS(fast);
+        if (encode_length(self, 4, length) == 0) {
+            while (length) {
+                ret = VARIANT(encode)(self, *items);
+                if (ret)
+                    Py_DECREF(ret);
+                else
+                    goto error;
+                items++;
+                length--;
+            }
+            Py_INCREF(Py_None);
+            ret = Py_None;
+        }
+error:
+        Py_DECREF(fast);
+    }
+    return ret;
+}
+
+
+#if !CANONICAL
+static PyObject *
+VARIANT(encode_dict)(CBOREncoderObject *self, PyObject *value)
+{
+    PyObject *key, *val, *ret;
+    Py_ssize_t pos = 0;
+
+    if (encode_length(self, 5, PyDict_Size(value)) == -1)
+        return NULL;
+    while (PyDict_Next(value, &pos, &key, &val)) {
+        Py_INCREF(key);
+        if (PyUnicode_CheckExact(key))
+            ret = encode_key(self, key);
+        else
+            ret = VARIANT(encode)(self, key);
+        Py_DECREF(key);
+        if (ret)
+            Py_DECREF(ret);
+        else
+            return NULL;
+        Py_INCREF(val);
+        ret = VARIANT(encode)(self, val);
+        Py_DECREF(val);
+        if (ret)
+            Py_DECREF(ret);
+        else
+            return NULL;
+    }
+    Py_RETURN_NONE;
+}
+#endif
+
+
+static PyObject *
+VARIANT(encode_value)(CBOREncoderObject *self, PyObject *value)
+{
+#if CANONICAL
+    if (PyFloat_CheckExact(value))
+        return CBOREncoder_encode_minimal_float(self, value);
+    else if (PyDict_CheckExact(value))
+        return CBOREncoder_encode_canonical_map(self, value);
+    else if (PyAnySet_CheckExact(value))
+        return CBOREncoder_encode_canonical_set(self, value);
+#else
+    if (PyFloat_CheckExact(value))
+        return CBOREncoder_encode_float(self, value);
+    else if (PyDict_CheckExact(value))
+        return encode_unshared(self, &VARIANT(encode_dict), value);
+    else if (PyAnySet_CheckExact(value))
+        return CBOREncoder_encode_set(self, value);
+#endif
+    else if (PyUnicode_CheckExact(value))
+        return encode_text(self, value);
+    else if (PyLong_CheckExact(value))
+        return CBOREncoder_encode_int(self, value);
+    else if (PyList_CheckExact(value) || PyTuple_CheckExact(value))
+        return encode_unshared(self, &VARIANT(encode_array), value);
+    else if (PyBytes_CheckExact(value))
+        return encode_string_data(
+                self, 2, PyBytes_AS_STRING(value), PyBytes_GET_SIZE(value));
+    else if (PyByteArray_CheckExact(value))
+        return encode_string_data(
+                self, 2, PyByteArray_AS_STRING(value),
+                PyByteArray_GET_SIZE(value));
+    else if (PyBool_Check(value))
+        return CBOREncoder_encode_boolean(self, value);
+    else if (value == Py_None)
+        return CBOREncoder_encode_none(self, value);
+    else if (value == undefined)
+        return CBOREncoder_encode_undefined(self, value);
+    else if (PyDateTime_CheckExact(value))
+        return CBOREncoder_encode_datetime(self, value);
+    else
+        return encode_by_lookup(self, value);
+}
+
+
+static PyObject *
+VARIANT(encode)(CBOREncoderObject *self, PyObject *value)
+{
+    PyObject *ret;
+
+    if (Py_EnterRecursiveCall(" in CBOREncoder.encode"))
+        return NULL;
+    self->depth++;
+    ret = VARIANT(encode_value)(self, value);
+    self->depth--;
+    Py_LeaveRecursiveCall();
+    return ret;
+}
+
+
+#undef CANONICAL
+#undef VARIANT
@@ -1,6 +1,7 @@
-#include <Python.h>
+// Nothing in here depends on Python.h (see benchmarks/kernels.c)
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <math.h>
 #if __FreeBSD__
 #include <sys/endian.h>
@@ -20,6 +21,15 @@
 #define htobe16(x) _byteswap_ushort(x)
 #endif
 
+// Normally provided by pyconfig.h
+#ifndef PY_BIG_ENDIAN
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define PY_BIG_ENDIAN 1
+#else
+#define PY_BIG_ENDIAN 0
+#endif
+#endif
+
 // Based upon ftp://ftp.fox-toolkit.org/pub/fasthalffloatconversion.pdf ("Fast
 // Half Float Conversions") referenced by the Wikipedia article on
 // half-precision floating point:
@@ -0,0 +1,132 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "module.h"
+#include "scanner.h"
+#include "diagnose.h"
+#include "index.h"
+
+// Everything up to CBOR2_index_items runs without the GIL and must not touch
+// any Python objects or allocators
+
+typedef struct {
+    uint8_t type;         // CBOR_TOKEN_ARRAY or CBOR_TOKEN_MAP
+    bool shared;          // tag 28 or 29 was seen
+    size_t *offsets;
+    size_t count;
+    size_t capacity;
+} CBORItemIndex;
+
+
+static int
+index_append(CBORScanner *scanner, CBORItemIndex *ix, size_t offset)
+{
+    size_t *offsets;
+
+    if (ix->count == ix->capacity) {
+        ix->capacity = ix->capacity ? ix->capacity * 2 : 1024;
+        offsets = realloc(ix->offsets, ix->capacity * sizeof(size_t));
+        if (!offsets) {
+            scanner->error = CBOR_SCAN_NOMEM;
+            return -1;
+        }
+        ix->offsets = offsets;
+    }
+    ix->offsets[ix->count++] = offset;
+    return 0;
+}
+
+
+// Record the offset of each item in the array or map at the top of the
+// buffer (looking through a self-describe tag), followed by the offset at
+// which the last of them ends. Returns 0 on success, 1 if the top-level item
+// isn't an array or map and -1 on error (see scanner->error)
+static int
+index_scan(CBORScanner *scanner, CBORItemIndex *ix)
+{
+    CBORToken tok;
+    size_t depth = 0;
+    int ret;
+
+    ret = cbor_scanner_next(scanner, &tok);
+    if (ret == 1 && tok.type == CBOR_TOKEN_TAG && tok.value == 55799) {
+        depth = 1;
+        ret = cbor_scanner_next(scanner, &tok);
+    }
+    if (ret == 0) {
+        // nothing at all was found in the input
+        scanner->error = CBOR_SCAN_EOF;
+        return -1;
+    } else if (ret == -1)
+        return -1;
+    if (tok.type != CBOR_TOKEN_ARRAY && tok.type != CBOR_TOKEN_MAP)
+        return 1;
+    ix->type = tok.type;
+
+    for (;;) {
+        if (cbor_scanner_next(scanner, &tok) != 1)
+            return -1;
+        if (tok.type == CBOR_TOKEN_END) {
+            if (tok.depth == depth)
+                return index_append(scanner, ix, tok.offset);
+        } else {
+            if (tok.type == CBOR_TOKEN_TAG && (tok.value == 28 || tok.value == 29))
+                ix->shared = true;
+            if (tok.depth == depth + 1 &&
+                    index_append(scanner, ix, tok.offset) == -1)
+                return -1;
+        }
+    }
+}
+
+
+// index_items(data)
+PyObject *
+CBOR2_index_items(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"data", NULL};
+    PyObject *data, *offsets, *offset, *ret = NULL;
+    CBORScanner scanner;
+    CBORItemIndex ix = {0};
+    Py_buffer view;
+    size_t i;
+    int result;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keywords, &data))
+        return NULL;
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) == -1)
+        return NULL;
+
+    cbor_scanner_init(&scanner, view.buf, view.len);
+    Py_BEGIN_ALLOW_THREADS
+    result = index_scan(&scanner, &ix);
+    Py_END_ALLOW_THREADS
+
+    if (result == 0) {
+        offsets = PyList_New(ix.count);
+        if (offsets) {
+            for (i = 0; i < ix.count; ++i) {
+                offset = PyLong_FromSize_t(ix.offsets[i]);
+                if (!offset) {
+                    Py_CLEAR(offsets);
+                    break;
+                }
+                PyList_SET_ITEM(offsets, i, offset);
+            }
+        }
+        if (offsets)
+            ret = Py_BuildValue("(sNO)",
+                    ix.type == CBOR_TOKEN_ARRAY ? "array" : "map",
+                    offsets, ix.shared ? Py_True : Py_False);
+    } else if (result == 1)
+        PyErr_SetString(_CBOR2_CBORDecodeValueError,
+                "the top-level item is not an array or map");
+    else
+        _CBOR2_raise_scan_error(&scanner);
+    cbor_scanner_free(&scanner);
+    free(ix.offsets);
+    PyBuffer_Release(&view);
+    return ret;
+}
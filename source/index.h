@@ -0,0 +1,4 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+PyObject * CBOR2_index_items(PyObject *, PyObject *, PyObject *);
@@ -5,6 +5,10 @@
 #include "tags.h"
 #include "encoder.h"
 #include "decoder.h"
+#include "diagnose.h"
+#include "stats.h"
+#include "index.h"
+#include "cbor2_capi.h"
 
 
 // Some notes on conventions in this code. All methods conform to a couple of
@@ -147,6 +151,7 @@ PyObject _undefined_obj = {
 // CBORSimpleValue namedtuple ////////////////////////////////////////////////
 
 PyTypeObject CBORSimpleValueType;
+static PyObject *simple_values[256];
 
 static PyStructSequence_Field CBORSimpleValueFields[] = {
     {.name = "value"},
@@ -164,11 +169,46 @@ static PyStructSequence_Desc CBORSimpleValueDesc = {
     .n_in_sequence = 1,
 };
 
+static PyObject *
+simple_value_new(PyTypeObject *type, uint8_t val)
+{
+    PyObject *value, *ret;
+
+    ret = PyStructSequence_New(type);
+    if (ret) {
+        value = PyLong_FromLong(val);
+        if (value)
+            PyStructSequence_SET_ITEM(ret, 0, value);
+        else
+            Py_CLEAR(ret);
+    }
+    return ret;
+}
+
+static int
+init_simple_values(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        simple_values[i] = simple_value_new(&CBORSimpleValueType, i);
+        if (!simple_values[i])
+            return -1;
+    }
+    return 0;
+}
+
+PyObject *
+CBORSimpleValue_FromByte(uint8_t val)
+{
+    Py_INCREF(simple_values[val]);
+    return simple_values[val];
+}
+
 static PyObject *
 CBORSimpleValue_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
     static char *keywords[] = {"value", NULL};
-    PyObject *value = NULL, *ret;
     Py_ssize_t val;
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", keywords, &val))
@@ -179,15 +219,10 @@ CBORSimpleValue_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
         return NULL;
     }
 
-    ret = PyStructSequence_New(type);
-    if (ret) {
-        value = PyLong_FromSsize_t(val);
-        if (value)
-            PyStructSequence_SET_ITEM(ret, 0, value);
-    }
-    return ret;
+    if (type == &CBORSimpleValueType)
+        return CBORSimpleValue_FromByte(val);
+    return simple_value_new(type, val);
 }
-
 static PyObject *
 CBORSimpleValue_richcompare(PyObject *a, PyObject *b, int op)
 {
@@ -374,6 +409,161 @@ CBOR2_loads(PyObject *module, PyObject *args, PyObject *kwargs)
 }
 
 
+// C API /////////////////////////////////////////////////////////////////////
+
+static int
+capi_check_kwargs(PyObject **kwargs)
+{
+    if (*kwargs == Py_None)
+        *kwargs = NULL;
+    else if (*kwargs && !PyDict_Check(*kwargs)) {
+        PyErr_Format(PyExc_TypeError, "kwargs must be a dict, not %R",
+                     (PyObject *) Py_TYPE(*kwargs));
+        return -1;
+    }
+    return 0;
+}
+
+
+// An encoder whose output goes to write (or stays in its buffer if write is
+// NULL) rather than to a file object
+static CBOREncoderObject *
+capi_encoder(PyObject *kwargs, CBORFlushFunc write, void *ctx)
+{
+    CBOREncoderObject *self;
+
+    if (capi_check_kwargs(&kwargs) == -1)
+        return NULL;
+    self = (CBOREncoderObject *)CBOREncoder_new(&CBOREncoderType, NULL, NULL);
+    if (self && CBOREncoder_init_output(self, write, ctx, kwargs) == -1)
+        Py_CLEAR(self);
+    return self;
+}
+
+
+static PyObject *
+capi_dumps(PyObject *obj, PyObject *kwargs)
+{
+    CBOREncoderObject *self;
+    PyObject *ret = NULL;
+
+    self = capi_encoder(kwargs, NULL, NULL);
+    if (self) {
+        ret = CBOREncoder_encode(self, obj);
+        if (ret) {
+            Py_DECREF(ret);
+            ret = PyBytes_FromStringAndSize(
+                (const char *) self->out.buf, self->out.length);
+        }
+        Py_DECREF(self);
+    }
+    return ret;
+}
+
+
+static int
+capi_dump_to(PyObject *obj, PyObject *kwargs, CBOR2_WriteFunc write, void *ctx)
+{
+    CBOREncoderObject *self;
+    PyObject *ret = NULL;
+
+    if (!write) {
+        PyErr_SetString(PyExc_ValueError, "write function must not be NULL");
+        return -1;
+    }
+    self = capi_encoder(kwargs, write, ctx);
+    if (self) {
+        ret = CBOREncoder_encode(self, obj);
+        Py_XDECREF(ret);
+        Py_DECREF(self);
+    }
+    return ret ? 0 : -1;
+}
+
+
+static PyObject *
+capi_loads(const char *buf, Py_ssize_t length, PyObject *kwargs)
+{
+    CBORDecoderObject *self;
+    PyObject *ret = NULL;
+
+    if (capi_check_kwargs(&kwargs) == -1)
+        return NULL;
+    if (length < 0) {
+        PyErr_SetString(PyExc_ValueError, "length must not be negative");
+        return NULL;
+    }
+    if (!buf) {
+        // an empty buffer, at most; a NULL buf would mean reading from fp
+        buf = "";
+        length = 0;
+    }
+    self = (CBORDecoderObject *)CBORDecoder_new(&CBORDecoderType, NULL, NULL);
+    if (self) {
+        if (CBORDecoder_init_buffer(self, buf, length, kwargs) == 0)
+            ret = CBORDecoder_decode(self);
+        // a hook may have kept a reference to the decoder
+        CBORDecoder_init_buffer(self, NULL, 0, NULL);
+        Py_DECREF(self);
+    }
+    return ret;
+}
+
+
+static PyObject *
+capi_tag_new(uint64_t tag, PyObject *value)
+{
+    PyObject *ret;
+
+    ret = CBORTag_New(tag);
+    if (ret && value && CBORTag_SetValue(ret, value) == -1)
+        Py_CLEAR(ret);
+    return ret;
+}
+
+
+static int
+capi_encoder_encode(PyObject *encoder, PyObject *obj)
+{
+    PyObject *ret;
+
+    if (!PyObject_TypeCheck(encoder, &CBOREncoderType)) {
+        PyErr_Format(PyExc_TypeError, "expected CBOREncoder, not %R",
+                     (PyObject *) Py_TYPE(encoder));
+        return -1;
+    }
+    ret = CBOREncoder_encode((CBOREncoderObject *) encoder, obj);
+    Py_XDECREF(ret);
+    return ret ? 0 : -1;
+}
+
+
+static PyObject *
+capi_decoder_decode(PyObject *decoder)
+{
+    if (!PyObject_TypeCheck(decoder, &CBORDecoderType)) {
+        PyErr_Format(PyExc_TypeError, "expected CBORDecoder, not %R",
+                     (PyObject *) Py_TYPE(decoder));
+        return NULL;
+    }
+    return CBORDecoder_decode((CBORDecoderObject *) decoder);
+}
+
+
+static CBOR2_CAPI capi = {
+    .version = CBOR2_CAPI_VERSION,
+    .EncoderType = &CBOREncoderType,
+    .DecoderType = &CBORDecoderType,
+    .TagType = &CBORTagType,
+    .Dumps = capi_dumps,
+    .DumpTo = capi_dump_to,
+    .Loads = capi_loads,
+    .Tag_New = capi_tag_new,
+    .Encoder_Encode = capi_encoder_encode,
+    .Decoder_Decode = capi_decoder_decode,
+};
+
+
 // Cache-init functions //////////////////////////////////////////////////////
 
 int
@@ -580,6 +770,7 @@ error:
 
 PyObject *_CBOR2_empty_bytes = NULL;
 PyObject *_CBOR2_empty_str = NULL;
+PyObject *_CBOR2_empty_tuple = NULL;
 PyObject *_CBOR2_str_as_string = NULL;
 PyObject *_CBOR2_str_as_tuple = NULL;
 PyObject *_CBOR2_str_bit_length = NULL;
@@ -603,6 +794,7 @@ PyObject *_CBOR2_str_ip_network = NULL;
 PyObject *_CBOR2_str_is_infinite = NULL;
 PyObject *_CBOR2_str_is_nan = NULL;
 PyObject *_CBOR2_str_isoformat = NULL;
+PyObject *_CBOR2_str_items = NULL;
 PyObject *_CBOR2_str_join = NULL;
 PyObject *_CBOR2_str_match = NULL;
 PyObject *_CBOR2_str_network_address = NULL;
@@ -619,6 +811,7 @@ PyObject *_CBOR2_str_timestamp = NULL;
 PyObject *_CBOR2_str_timezone = NULL;
 PyObject *_CBOR2_str_update = NULL;
 PyObject *_CBOR2_str_utc = NULL;
+PyObject *_CBOR2_str_utcoffset = NULL;
 PyObject *_CBOR2_str_utc_suffix = NULL;
 PyObject *_CBOR2_str_UUID = NULL;
 PyObject *_CBOR2_str_write = NULL;
@@ -670,6 +863,9 @@ cbor2_free(PyObject *m)
     Py_CLEAR(_CBOR2_CBORError);
     Py_CLEAR(_CBOR2_default_encoders);
     Py_CLEAR(_CBOR2_canonical_encoders);
+    for (int i = 0; i < 256; i++)
+        Py_CLEAR(simple_values[i]);
+    CBORTag_ClearFreeList();
 }
 
 static PyMethodDef _cbor2methods[] = {
@@ -681,6 +877,12 @@ static PyMethodDef _cbor2methods[] = {
         "decode a value from the stream"},
     {"loads", (PyCFunction) CBOR2_loads, METH_VARARGS | METH_KEYWORDS,
         "decode a value from a byte-string"},
+    {"diagnose", (PyCFunction) CBOR2_diagnose, METH_VARARGS | METH_KEYWORDS,
+        "return the diagnostic notation of a byte-string"},
+    {"scan_stats", (PyCFunction) CBOR2_scan_stats, METH_VARARGS | METH_KEYWORDS,
+        "return statistics on the structure of a byte-string"},
+    {"index_items", (PyCFunction) CBOR2_index_items, METH_VARARGS | METH_KEYWORDS,
+        "return the offsets of the items of the array or map in a byte-string"},
     {NULL}
 };
 
@@ -781,7 +983,7 @@ init_canonical_encoders(void)
 PyMODINIT_FUNC
 PyInit__cbor2(void)
 {
-    PyObject *module, *base;
+    PyObject *module, *base, *capsule;
 
     PyDateTime_IMPORT;
     if (!PyDateTimeAPI)
@@ -876,6 +1078,9 @@ PyInit__cbor2(void)
     if (PyStructSequence_InitType2(&CBORSimpleValueType, &CBORSimpleValueDesc) == -1)
         goto error;
 
+    if (init_simple_values() == -1)
+        goto error;
+
     Py_INCREF((PyObject *) &CBORSimpleValueType);
     CBORSimpleValueType.tp_new = CBORSimpleValue_new;
     CBORSimpleValueType.tp_richcompare = CBORSimpleValue_richcompare;
@@ -903,6 +1108,14 @@ PyInit__cbor2(void)
     if (PyModule_AddObject(module, "undefined", undefined) == -1)
         goto error;
 
+    capsule = PyCapsule_New(&capi, CBOR2_CAPI_NAME, NULL);
+    if (!capsule)
+        goto error;
+    if (PyModule_AddObject(module, "_C_API", capsule) == -1) {
+        Py_DECREF(capsule);
+        goto error;
+    }
+
 #define INTERN_STRING(name)                                           \
     if (!_CBOR2_str_##name &&                                         \
             !(_CBOR2_str_##name = PyUnicode_InternFromString(#name))) \
@@ -930,6 +1143,7 @@ PyInit__cbor2(void)
     INTERN_STRING(is_infinite);
     INTERN_STRING(is_nan);
     INTERN_STRING(isoformat);
+    INTERN_STRING(items);
     INTERN_STRING(join);
     INTERN_STRING(match);
     INTERN_STRING(network_address);
@@ -946,6 +1160,7 @@ PyInit__cbor2(void)
     INTERN_STRING(timezone);
     INTERN_STRING(update);
     INTERN_STRING(utc);
+    INTERN_STRING(utcoffset);
     INTERN_STRING(UUID);
     INTERN_STRING(write);
 
@@ -967,6 +1182,8 @@ PyInit__cbor2(void)
     if (!_CBOR2_empty_str &&
             !(_CBOR2_empty_str = PyUnicode_FromStringAndSize(NULL, 0)))
         goto error;
+    if (!_CBOR2_empty_tuple && !(_CBOR2_empty_tuple = PyTuple_New(0)))
+        goto error;
 
     return module;
 error:
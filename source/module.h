@@ -1,5 +1,6 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <stdint.h>
 
 // structure of the lead-byte for all CBOR records
 typedef
@@ -26,12 +27,15 @@ extern PyObject _undefined_obj;
 #define undefined (&_undefined_obj)
 #define CBOR2_RETURN_UNDEFINED return Py_INCREF(undefined), undefined
 
-// CBORSimpleValue namedtuple type
+// CBORSimpleValue namedtuple type, and a new reference to its instance for
+// each value (all 256 are created up front)
 extern PyTypeObject CBORSimpleValueType;
+PyObject * CBORSimpleValue_FromByte(uint8_t);
 
 // Various interned strings
 extern PyObject *_CBOR2_empty_bytes;
 extern PyObject *_CBOR2_empty_str;
+extern PyObject *_CBOR2_empty_tuple;
 extern PyObject *_CBOR2_str_as_string;
 extern PyObject *_CBOR2_str_as_tuple;
 extern PyObject *_CBOR2_str_bit_length;
@@ -55,6 +59,7 @@ extern PyObject *_CBOR2_str_ip_network;
 extern PyObject *_CBOR2_str_is_infinite;
 extern PyObject *_CBOR2_str_is_nan;
 extern PyObject *_CBOR2_str_isoformat;
+extern PyObject *_CBOR2_str_items;
 extern PyObject *_CBOR2_str_join;
 extern PyObject *_CBOR2_str_match;
 extern PyObject *_CBOR2_str_network_address;
@@ -71,6 +76,7 @@ extern PyObject *_CBOR2_str_timestamp;
 extern PyObject *_CBOR2_str_timezone;
 extern PyObject *_CBOR2_str_update;
 extern PyObject *_CBOR2_str_utc;
+extern PyObject *_CBOR2_str_utcoffset;
 extern PyObject *_CBOR2_str_utc_suffix;
 extern PyObject *_CBOR2_str_UUID;
 extern PyObject *_CBOR2_str_write;
@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "codec.h"
+#include "scanner.h"
+
+
+// Scanner lifecycle /////////////////////////////////////////////////////////
+
+void
+cbor_scanner_init(CBORScanner *s, const uint8_t *buf, size_t length)
+{
+    s->buf = buf;
+    s->length = length;
+    s->pos = 0;
+    s->stack = NULL;
+    s->depth = 0;
+    s->capacity = 0;
+    s->max_depth = 0;
+    s->error = CBOR_SCAN_OK;
+    s->error_pos = 0;
+}
+
+
+void
+cbor_scanner_free(CBORScanner *s)
+{
+    free(s->stack);
+    s->stack = NULL;
+    s->depth = s->capacity = 0;
+}
+
+
+const char *
+cbor_scanner_strerror(const CBORScanner *s)
+{
+    switch (s->error) {
+        case CBOR_SCAN_OK:       return "no error";
+        case CBOR_SCAN_EOF:      return "premature end of stream";
+        case CBOR_SCAN_INVALID:  return "invalid CBOR data";
+        case CBOR_SCAN_NOMEM:    return "out of memory";
+        case CBOR_SCAN_TOO_DEEP: return "maximum nesting depth exceeded";
+        case CBOR_SCAN_ABORTED:  return "aborted by visitor";
+        default:                 return "unknown error";
+    }
+}
+
+
+// Utility functions /////////////////////////////////////////////////////////
+
+static inline int
+scan_error(CBORScanner *s, int error, size_t pos)
+{
+    s->error = error;
+    s->error_pos = pos;
+    return -1;
+}
+
+
+static double
+half_to_double(uint16_t half)
+{
+    // See RFC 8949, appendix D
+    int exp = (half >> 10) & 0x1f;
+    int mant = half & 0x3ff;
+    double ret;
+
+    if (exp == 0)
+        ret = ldexp(mant, -24);
+    else if (exp != 31)
+        ret = ldexp(mant + 1024, exp - 25);
+    else
+        ret = mant == 0 ? INFINITY : NAN;
+    return half & 0x8000 ? -ret : ret;
+}
+
+
+static int
+push_frame(CBORScanner *s, uint8_t type, bool indefinite, uint64_t remaining)
+{
+    CBORFrame *stack;
+    size_t capacity;
+
+    if (s->max_depth && s->depth >= s->max_depth)
+        return scan_error(s, CBOR_SCAN_TOO_DEEP, s->pos);
+    if (s->depth == s->capacity) {
+        capacity = s->capacity ? s->capacity * 2 : 16;
+        stack = realloc(s->stack, capacity * sizeof(CBORFrame));
+        if (!stack)
+            return scan_error(s, CBOR_SCAN_NOMEM, s->pos);
+        s->stack = stack;
+        s->capacity = capacity;
+    }
+    s->stack[s->depth].type = type;
+    s->stack[s->depth].indefinite = indefinite;
+    s->stack[s->depth].remaining = remaining;
+    s->stack[s->depth].count = 0;
+    s->depth++;
+    return 0;
+}
+
+
+static inline void
+pop_frame(CBORScanner *s, CBORToken *tok)
+{
+    CBORFrame *frame = &s->stack[--s->depth];
+
+    tok->type = CBOR_TOKEN_END;
+    tok->closes = frame->type;
+    tok->indefinite = frame->indefinite;
+    tok->value = frame->count;
+    tok->data = NULL;
+    tok->depth = s->depth;
+    tok->offset = s->pos;
+    if (s->depth) {
+        tok->parent = s->stack[s->depth - 1].type;
+        tok->index = s->stack[s->depth - 1].count - 1;
+    } else {
+        tok->parent = CBOR_PARENT_NONE;
+        tok->index = 0;
+    }
+}
+
+
+// Tokenizer /////////////////////////////////////////////////////////////////
+
+// Read the next token from the buffer into *tok. Returns 1 if a token was
+// produced, 0 if the end of the buffer was reached cleanly (between top-level
+// items) and -1 on error (see s->error)
+int
+cbor_scanner_next(CBORScanner *s, CBORToken *tok)
+{
+    CBORFrame *parent = NULL;
+    uint8_t lead, major, ai;
+    uint64_t value;
+    size_t start, arg_len;
+
+    if (s->error)
+        return -1;
+
+    // Close any definite containers which have received all their items
+    if (s->depth) {
+        parent = &s->stack[s->depth - 1];
+        if (!parent->indefinite && parent->remaining == 0) {
+            pop_frame(s, tok);
+            return 1;
+        }
+    } else if (s->pos >= s->length)
+        return 0;
+
+    start = s->pos;
+    if (start >= s->length)
+        return scan_error(s, CBOR_SCAN_EOF, start);
+    lead = s->buf[start];
+    major = lead >> 5;
+    ai = lead & 0x1f;
+
+    if (lead == 0xff) {
+        // break code
+        if (!(parent && parent->indefinite))
+            return scan_error(s, CBOR_SCAN_INVALID, start);
+        // an indefinite map must not end between a key and its value
+        if (parent->type == CBOR_TOKEN_MAP && parent->count % 2)
+            return scan_error(s, CBOR_SCAN_INVALID, start);
+        s->pos++;
+        pop_frame(s, tok);
+        tok->offset = start;
+        return 1;
+    }
+
+    if (ai < 24) {
+        value = ai;
+        arg_len = 0;
+    } else if (ai < 28) {
+        arg_len = (size_t)1 << (ai - 24);
+        if (s->length - start - 1 < arg_len)
+            return scan_error(s, CBOR_SCAN_EOF, start);
+        value = cbor_read_argument(s->buf + start + 1, (int) arg_len);
+    } else if (ai == 31 && major >= 2 && major <= 5) {
+        value = 0;
+        arg_len = 0;
+    } else
+        return scan_error(s, CBOR_SCAN_INVALID, start);
+
+    if (parent && (parent->type == CBOR_TOKEN_BYTES_INDEF ||
+                   parent->type == CBOR_TOKEN_TEXT_INDEF)) {
+        // chunks of indefinite length strings must be definite length
+        // strings of the same major type
+        if (ai == 31 || major !=
+                (parent->type == CBOR_TOKEN_BYTES_INDEF ? 2 : 3))
+            return scan_error(s, CBOR_SCAN_INVALID, start);
+    }
+
+    tok->ai = ai;
+    tok->value = value;
+    tok->offset = start;
+    tok->depth = s->depth;
+    tok->indefinite = false;
+    tok->data = NULL;
+    if (parent) {
+        tok->parent = parent->type;
+        tok->index = parent->count++;
+        if (!parent->indefinite)
+            parent->remaining--;
+    } else {
+        tok->parent = CBOR_PARENT_NONE;
+        tok->index = 0;
+    }
+    s->pos = start + 1 + arg_len;
+
+    switch (major) {
+        case 0:
+            tok->type = CBOR_TOKEN_UINT;
+            break;
+        case 1:
+            tok->type = CBOR_TOKEN_NEGINT;
+            break;
+        case 2:
+        case 3:
+            if (ai == 31) {
+                tok->type = major == 2 ?
+                    CBOR_TOKEN_BYTES_INDEF : CBOR_TOKEN_TEXT_INDEF;
+                tok->indefinite = true;
+                if (push_frame(s, tok->type, true, 0) == -1)
+                    return -1;
+            } else {
+                if (value > s->length - s->pos)
+                    return scan_error(s, CBOR_SCAN_EOF, start);
+                tok->type = major == 2 ? CBOR_TOKEN_BYTES : CBOR_TOKEN_TEXT;
+                tok->data = s->buf + s->pos;
+                s->pos += (size_t) value;
+            }
+            break;
+        case 4:
+        case 5:
+            tok->type = major == 4 ? CBOR_TOKEN_ARRAY : CBOR_TOKEN_MAP;
+            tok->indefinite = ai == 31;
+            if (major == 5 && !tok->indefinite) {
+                // the item count of the map must fit in 64 bits
+                if (value > UINT64_MAX / 2)
+                    return scan_error(s, CBOR_SCAN_INVALID, start);
+                if (push_frame(s, tok->type, false, value * 2) == -1)
+                    return -1;
+            } else if (push_frame(s, tok->type, tok->indefinite, value) == -1)
+                return -1;
+            break;
+        case 6:
+            tok->type = CBOR_TOKEN_TAG;
+            if (push_frame(s, CBOR_TOKEN_TAG, false, 1) == -1)
+                return -1;
+            break;
+        case 7:
+            if (ai <= 24) {
+                // two byte simple values below 32 are not well-formed
+                if (ai == 24 && value < 32)
+                    return scan_error(s, CBOR_SCAN_INVALID, start);
+                tok->type = CBOR_TOKEN_SIMPLE;
+            } else {
+                tok->type = CBOR_TOKEN_FLOAT;
+                if (ai == 25) {
+                    tok->fvalue = half_to_double((uint16_t) value);
+                } else if (ai == 26) {
+                    union { uint32_t i; float f; } u;
+                    u.i = (uint32_t) value;
+                    tok->fvalue = u.f;
+                } else {
+                    union { uint64_t i; double f; } u;
+                    u.i = value;
+                    tok->fvalue = u.f;
+                }
+            }
+            break;
+    }
+    return 1;
+}
+
+
+// Skip over the next complete item (and all of its children). Returns 1 if
+// an item was skipped, 0 at the end of the buffer and -1 on error
+int
+cbor_scanner_skip(CBORScanner *s)
+{
+    CBORToken tok;
+    size_t depth = s->depth;
+    int ret;
+
+    do {
+        ret = cbor_scanner_next(s, &tok);
+        if (ret != 1)
+            return ret;
+    } while (s->depth > depth);
+    return 1;
+}
+
+
+// Visitor ///////////////////////////////////////////////////////////////////
+
+static inline CBORVisitFunc
+visit_func(const CBORVisitor *v, uint8_t type)
+{
+    switch (type) {
+        case CBOR_TOKEN_UINT:        return v->on_uint;
+        case CBOR_TOKEN_NEGINT:      return v->on_negint;
+        case CBOR_TOKEN_BYTES:       return v->on_bytes;
+        case CBOR_TOKEN_TEXT:        return v->on_text;
+        case CBOR_TOKEN_BYTES_INDEF: return v->on_bytes_start;
+        case CBOR_TOKEN_TEXT_INDEF:  return v->on_text_start;
+        case CBOR_TOKEN_ARRAY:       return v->on_array;
+        case CBOR_TOKEN_MAP:         return v->on_map;
+        case CBOR_TOKEN_TAG:         return v->on_tag;
+        case CBOR_TOKEN_SIMPLE:      return v->on_simple;
+        case CBOR_TOKEN_FLOAT:       return v->on_float;
+        default:                     return v->on_end;
+    }
+}
+
+
+// Walk the next complete item, calling the visitor's callbacks for each of
+// its tokens in order. Returns 1 if an item was walked, 0 at the end of the
+// buffer and -1 on error (including a callback failing)
+int
+cbor_scanner_walk(CBORScanner *s, const CBORVisitor *v, void *ctx)
+{
+    CBORToken tok;
+    CBORVisitFunc func;
+    size_t depth = s->depth, skip_to;
+    int ret;
+
+    do {
+        ret = cbor_scanner_next(s, &tok);
+        if (ret != 1)
+            return ret;
+        func = visit_func(v, tok.type);
+        ret = func ? func(ctx, &tok) : 0;
+        if (ret == -1)
+            return scan_error(s, CBOR_SCAN_ABORTED, tok.offset);
+        if (ret == CBOR_WALK_SKIP && s->depth > tok.depth) {
+            // pass over the contents up to (and including) the matching end
+            skip_to = tok.depth;
+            do {
+                // the scanner can't run out cleanly inside a container
+                if (cbor_scanner_next(s, &tok) != 1)
+                    return -1;
+            } while (s->depth > skip_to);
+            if (v->on_end && v->on_end(ctx, &tok) == -1)
+                return scan_error(s, CBOR_SCAN_ABORTED, tok.offset);
+        }
+    } while (s->depth > depth);
+    return 1;
+}
@@ -0,0 +1,105 @@
+#ifndef CBOR2_SCANNER_H
+#define CBOR2_SCANNER_H
+
+// A pull-style tokenizer for CBOR data held in memory, which can also drive
+// a push-style visitor (see cbor_scanner_walk). Nothing in here depends on
+// Python.h so it can be run with the GIL released.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    CBOR_TOKEN_UINT = 0,    // major type 0; value is the integer
+    CBOR_TOKEN_NEGINT,      // major type 1; value is the encoded argument (-1 - n)
+    CBOR_TOKEN_BYTES,       // definite bytestring (or a chunk of an indefinite one)
+    CBOR_TOKEN_TEXT,        // definite text string (or a chunk of an indefinite one)
+    CBOR_TOKEN_BYTES_INDEF, // start of an indefinite length bytestring
+    CBOR_TOKEN_TEXT_INDEF,  // start of an indefinite length text string
+    CBOR_TOKEN_ARRAY,       // start of an array; value is the length
+    CBOR_TOKEN_MAP,         // start of a map; value is the number of pairs
+    CBOR_TOKEN_TAG,         // start of a tagged item; value is the tag number
+    CBOR_TOKEN_SIMPLE,      // simple value (including false, true, null, ...)
+    CBOR_TOKEN_FLOAT,       // half, single or double precision float
+    CBOR_TOKEN_END,         // end of the container given by "closes"
+} CBORTokenType;
+
+#define CBOR_PARENT_NONE 0xFF
+
+typedef struct {
+    uint8_t type;         // one of CBORTokenType
+    uint8_t ai;           // additional information of the head (encoding width)
+    bool indefinite;      // true for indefinite length containers and strings
+    uint8_t parent;       // type of the enclosing container or CBOR_PARENT_NONE
+    uint8_t closes;       // for CBOR_TOKEN_END, the type of container closed
+    uint64_t value;       // integer, length, tag number or simple value
+    uint64_t index;       // position of this item within its parent
+    double fvalue;        // for CBOR_TOKEN_FLOAT
+    const uint8_t *data;  // payload of CBOR_TOKEN_BYTES / CBOR_TOKEN_TEXT
+    size_t offset;        // offset of the head within the buffer
+    size_t depth;         // nesting depth of the item (0 for top-level items)
+} CBORToken;
+
+typedef struct {
+    uint8_t type;         // CBOR_TOKEN_ARRAY, _MAP, _TAG, _BYTES_INDEF, _TEXT_INDEF
+    bool indefinite;
+    uint64_t remaining;   // items left in a definite container
+    uint64_t count;       // items started so far
+} CBORFrame;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t length;
+    size_t pos;
+    CBORFrame *stack;
+    size_t depth;
+    size_t capacity;
+    size_t max_depth;     // 0 for no limit
+    int error;
+    size_t error_pos;
+} CBORScanner;
+
+// Error codes stored in CBORScanner.error
+#define CBOR_SCAN_OK 0
+#define CBOR_SCAN_EOF 1          // premature end of data
+#define CBOR_SCAN_INVALID 2      // malformed data
+#define CBOR_SCAN_NOMEM 3        // out of memory growing the container stack
+#define CBOR_SCAN_TOO_DEEP 4     // max_depth exceeded
+#define CBOR_SCAN_ABORTED 5      // a visitor callback failed
+
+// Callbacks for cbor_scanner_walk, each given the walk's ctx and the current
+// token. They return 0 to carry on, -1 to abort the walk or (when starting a
+// container, tag or indefinite string) CBOR_WALK_SKIP to pass over its
+// contents; the matching on_end call is still made. Any of them may be NULL.
+typedef int (*CBORVisitFunc)(void *ctx, const CBORToken *tok);
+
+#define CBOR_WALK_SKIP 1
+
+typedef struct {
+    CBORVisitFunc on_uint;
+    CBORVisitFunc on_negint;
+    CBORVisitFunc on_bytes;
+    CBORVisitFunc on_text;
+    CBORVisitFunc on_bytes_start;
+    CBORVisitFunc on_text_start;
+    CBORVisitFunc on_array;
+    CBORVisitFunc on_map;
+    CBORVisitFunc on_tag;
+    CBORVisitFunc on_simple;
+    CBORVisitFunc on_float;
+    CBORVisitFunc on_end;
+} CBORVisitor;
+
+void cbor_scanner_init(CBORScanner *, const uint8_t *, size_t);
+void cbor_scanner_free(CBORScanner *);
+int cbor_scanner_next(CBORScanner *, CBORToken *);
+int cbor_scanner_skip(CBORScanner *);
+int cbor_scanner_walk(CBORScanner *, const CBORVisitor *, void *);
+const char * cbor_scanner_strerror(const CBORScanner *);
+
+// True if the last token returned completed a top-level item
+#define cbor_scanner_item_done(s) ((s)->depth == 0)
+// True if the entire buffer has been consumed
+#define cbor_scanner_at_end(s) ((s)->pos >= (s)->length)
+
+#endif
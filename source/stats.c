@@ -0,0 +1,629 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "module.h"
+#include "codec.h"
+#include "scanner.h"
+#include "diagnose.h"
+#include "stats.h"
+
+// Everything up to CBOR2_scan_stats runs without the GIL and must not touch
+// any Python objects or allocators
+
+#define STATS_BUCKETS 65
+
+enum {
+    STATS_UNSIGNED = 0,
+    STATS_NEGATIVE,
+    STATS_BYTES,
+    STATS_TEXT,
+    STATS_ARRAY,
+    STATS_MAP,
+    STATS_TAG,
+    STATS_SIMPLE,
+    STATS_FLOAT,
+    STATS_MAJOR_COUNT
+};
+
+static const char *major_names[] = {
+    "unsigned", "negative", "bytes", "text", "array", "map", "tag", "simple",
+    "float",
+};
+
+enum {
+    ROLE_NONE = 0,
+    ROLE_KEY,
+    ROLE_VALUE,
+};
+
+// Rough cost of a reference to a shared item in packed CBOR
+#define PACKED_REF_SIZE 2
+// Size of the tag 256 head which opens a stringref namespace
+#define STRINGREF_NAMESPACE_SIZE 3
+// Size of the tag 25 head of a stringref
+#define STRINGREF_TAG_SIZE 2
+
+typedef struct {
+    const uint8_t *data;    // NULL for an empty slot
+    uint64_t length;
+    uint64_t hash;
+    uint64_t count;
+    uint64_t generation;    // stringref namespace this string belongs to
+    uint64_t index;         // index within that namespace
+    uint8_t major;
+} StringEntry;
+
+typedef struct {
+    uint64_t tag;
+    uint64_t count;         // 0 for an empty slot
+} TagEntry;
+
+typedef struct {
+    uint64_t items;
+    uint64_t length;
+    uint64_t major[STATS_MAJOR_COUNT];
+    uint64_t indefinite;
+    uint64_t max_depth;
+    uint64_t sizes[4][STATS_BUCKETS];   // bytes, text, array, map
+    uint64_t key_bytes;
+    uint64_t value_bytes;
+    uint64_t floats[3];                 // half, single, double
+    uint64_t shrinkable_floats;
+    uint64_t float_savings;
+    uint64_t repeated_strings;
+    int64_t stringref_savings;
+    uint64_t packed_savings;
+
+    TagEntry *tags;
+    size_t tags_used;
+    size_t tags_size;
+    StringEntry *strings;
+    size_t strings_used;
+    size_t strings_size;
+    uint8_t *roles;
+    size_t roles_size;
+    uint64_t generation;
+    uint64_t namespace_size;
+} CBORStats;
+
+
+// Utility functions /////////////////////////////////////////////////////////
+
+static inline int
+size_bucket(uint64_t value)
+{
+    int ret = 0;
+
+    while (value) {
+        ret++;
+        value >>= 1;
+    }
+    return ret;
+}
+
+
+static inline uint64_t
+hash_bytes(const uint8_t *data, uint64_t length)
+{
+    // FNV-1a
+    uint64_t ret = 14695981039346656037ULL;
+
+    while (length--) {
+        ret ^= *data++;
+        ret *= 1099511628211ULL;
+    }
+    return ret;
+}
+
+
+// Hash tables ///////////////////////////////////////////////////////////////
+
+static int
+count_tag(CBORStats *st, uint64_t tag)
+{
+    TagEntry *entry, *old;
+    size_t i, mask, old_size;
+
+    if ((st->tags_used + 1) * 2 > st->tags_size) {
+        old = st->tags;
+        old_size = st->tags_size;
+        st->tags_size = old_size ? old_size * 2 : 16;
+        st->tags = calloc(st->tags_size, sizeof(TagEntry));
+        if (!st->tags) {
+            st->tags = old;
+            st->tags_size = old_size;
+            return -1;
+        }
+        st->tags_used = 0;
+        for (i = 0; i < old_size; ++i) {
+            if (old[i].count) {
+                mask = st->tags_size - 1;
+                entry = &st->tags[(old[i].tag * 11400714819323198485ULL) & mask];
+                while (entry->count)
+                    entry = &st->tags[(entry - st->tags + 1) & mask];
+                *entry = old[i];
+                st->tags_used++;
+            }
+        }
+        free(old);
+    }
+    mask = st->tags_size - 1;
+    entry = &st->tags[(tag * 11400714819323198485ULL) & mask];
+    while (entry->count && entry->tag != tag)
+        entry = &st->tags[(entry - st->tags + 1) & mask];
+    if (!entry->count) {
+        entry->tag = tag;
+        st->tags_used++;
+    }
+    entry->count++;
+    return 0;
+}
+
+
+static StringEntry *
+find_string(CBORStats *st, const CBORToken *tok, uint64_t hash)
+{
+    StringEntry *entry;
+    size_t mask = st->strings_size - 1;
+    uint8_t major = tok->type == CBOR_TOKEN_BYTES ? 2 : 3;
+
+    entry = &st->strings[hash & mask];
+    while (entry->data && !(
+            entry->hash == hash && entry->major == major &&
+            entry->length == tok->value &&
+            memcmp(entry->data, tok->data, (size_t) tok->value) == 0))
+        entry = &st->strings[(entry - st->strings + 1) & mask];
+    return entry;
+}
+
+
+static int
+grow_strings(CBORStats *st)
+{
+    StringEntry *old = st->strings, *entry;
+    size_t i, mask, old_size = st->strings_size;
+
+    st->strings_size = old_size ? old_size * 2 : 64;
+    st->strings = calloc(st->strings_size, sizeof(StringEntry));
+    if (!st->strings) {
+        st->strings = old;
+        st->strings_size = old_size;
+        return -1;
+    }
+    mask = st->strings_size - 1;
+    for (i = 0; i < old_size; ++i) {
+        if (old[i].data) {
+            entry = &st->strings[old[i].hash & mask];
+            while (entry->data)
+                entry = &st->strings[(entry - st->strings + 1) & mask];
+            *entry = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+
+// Track repeated strings and work out what string referencing would save
+static int
+count_string(CBORStats *st, const CBORToken *tok)
+{
+    StringEntry *entry;
+    uint64_t hash;
+
+    if ((st->strings_used + 1) * 2 > st->strings_size && grow_strings(st) == -1)
+        return -1;
+    hash = hash_bytes(tok->data, tok->value);
+    entry = find_string(st, tok, hash);
+    if (!entry->data) {
+        entry->data = tok->data;
+        entry->length = tok->value;
+        entry->hash = hash;
+        entry->major = tok->type == CBOR_TOKEN_BYTES ? 2 : 3;
+        st->strings_used++;
+    }
+    entry->count++;
+    if (entry->generation == st->generation) {
+        st->stringref_savings += (int64_t) (
+                cbor_head_size(tok->value) + tok->value -
+                STRINGREF_TAG_SIZE - cbor_head_size(entry->index));
+    } else if (tok->value >= cbor_stringref_min_length(st->namespace_size)) {
+        entry->generation = st->generation;
+        entry->index = st->namespace_size++;
+    }
+    return 0;
+}
+
+
+// Scanning //////////////////////////////////////////////////////////////////
+
+// True if value (which must be finite) is exactly representable as a half
+// precision float
+static bool
+fits_half(double value)
+{
+    double mant;
+    int exp;
+
+    if (fabs(value) < ldexp(1.0, -14))
+        // zero or subnormal: a multiple of 2**-24
+        return ldexp(value, 24) == floor(ldexp(value, 24));
+    mant = frexp(value, &exp);
+    // 11 significant bits with an exponent of at most 15
+    return exp <= 16 && ldexp(mant, 11) == floor(ldexp(mant, 11));
+}
+
+
+static void
+count_float(CBORStats *st, const CBORToken *tok)
+{
+    int width = tok->ai - 25, minimum;
+    float single;
+    static const uint64_t float_sizes[] = {3, 5, 9};
+
+    st->floats[width]++;
+    if (isnan(tok->fvalue) || isinf(tok->fvalue))
+        minimum = 0;
+    else {
+        single = (float) tok->fvalue;
+        if ((double) single != tok->fvalue)
+            minimum = 2;
+        else
+            minimum = fits_half(tok->fvalue) ? 0 : 1;
+    }
+    if (minimum < width) {
+        st->shrinkable_floats++;
+        st->float_savings += float_sizes[width] - float_sizes[minimum];
+    }
+}
+
+
+static int
+set_role(CBORStats *st, size_t depth, uint8_t role)
+{
+    uint8_t *roles;
+    size_t size;
+
+    if (depth >= st->roles_size) {
+        size = st->roles_size ? st->roles_size * 2 : 64;
+        roles = realloc(st->roles, size);
+        if (!roles)
+            return -1;
+        st->roles = roles;
+        st->roles_size = size;
+    }
+    st->roles[depth] = role;
+    return 0;
+}
+
+
+static int
+scan_stats(CBORScanner *scanner, CBORStats *st, bool sequence)
+{
+    CBORToken tok;
+    uint64_t indef_length = 0, used;
+    size_t start;
+    uint8_t role;
+    int ret;
+
+    st->length = scanner->length;
+    for (;;) {
+        start = scanner->pos;
+        ret = cbor_scanner_next(scanner, &tok);
+        if (ret == 0) {
+            if (!st->items && !sequence) {
+                // nothing at all was found in the input
+                scanner->error = CBOR_SCAN_EOF;
+                return -1;
+            }
+            return 0;
+        } else if (ret == -1)
+            return -1;
+        used = scanner->pos - start;
+
+        if (tok.type == CBOR_TOKEN_END)
+            role = st->roles[tok.depth];
+        else if (tok.parent == CBOR_TOKEN_MAP)
+            role = tok.index % 2 ? ROLE_VALUE : ROLE_KEY;
+        else if (tok.depth)
+            role = st->roles[tok.depth - 1];
+        else {
+            // start of a new top-level item (and stringref namespace)
+            role = ROLE_NONE;
+            st->items++;
+            st->generation++;
+            st->namespace_size = 0;
+            st->stringref_savings -= STRINGREF_NAMESPACE_SIZE;
+        }
+        if (role == ROLE_KEY)
+            st->key_bytes += used;
+        else if (role == ROLE_VALUE)
+            st->value_bytes += used;
+        if (scanner->depth > st->max_depth)
+            st->max_depth = scanner->depth;
+
+        switch (tok.type) {
+            case CBOR_TOKEN_UINT:
+                st->major[STATS_UNSIGNED]++;
+                break;
+            case CBOR_TOKEN_NEGINT:
+                st->major[STATS_NEGATIVE]++;
+                break;
+            case CBOR_TOKEN_BYTES:
+            case CBOR_TOKEN_TEXT:
+                if (tok.parent == CBOR_TOKEN_BYTES_INDEF ||
+                        tok.parent == CBOR_TOKEN_TEXT_INDEF)
+                    indef_length += tok.value;
+                else {
+                    st->major[tok.type == CBOR_TOKEN_BYTES ?
+                        STATS_BYTES : STATS_TEXT]++;
+                    st->sizes[tok.type - CBOR_TOKEN_BYTES]
+                        [size_bucket(tok.value)]++;
+                    if (count_string(st, &tok) == -1)
+                        goto nomem;
+                }
+                break;
+            case CBOR_TOKEN_BYTES_INDEF:
+            case CBOR_TOKEN_TEXT_INDEF:
+                st->major[tok.type == CBOR_TOKEN_BYTES_INDEF ?
+                    STATS_BYTES : STATS_TEXT]++;
+                st->indefinite++;
+                indef_length = 0;
+                break;
+            case CBOR_TOKEN_ARRAY:
+            case CBOR_TOKEN_MAP:
+                st->major[tok.type == CBOR_TOKEN_ARRAY ?
+                    STATS_ARRAY : STATS_MAP]++;
+                if (tok.indefinite)
+                    st->indefinite++;
+                else
+                    st->sizes[tok.type - CBOR_TOKEN_ARRAY + 2]
+                        [size_bucket(tok.value)]++;
+                break;
+            case CBOR_TOKEN_TAG:
+                st->major[STATS_TAG]++;
+                if (count_tag(st, tok.value) == -1)
+                    goto nomem;
+                break;
+            case CBOR_TOKEN_SIMPLE:
+                st->major[STATS_SIMPLE]++;
+                break;
+            case CBOR_TOKEN_FLOAT:
+                st->major[STATS_FLOAT]++;
+                count_float(st, &tok);
+                break;
+            case CBOR_TOKEN_END:
+                if (tok.closes == CBOR_TOKEN_BYTES_INDEF ||
+                        tok.closes == CBOR_TOKEN_TEXT_INDEF)
+                    st->sizes[tok.closes - CBOR_TOKEN_BYTES_INDEF]
+                        [size_bucket(indef_length)]++;
+                else if (tok.indefinite)
+                    // the width of indefinite containers is only known now
+                    st->sizes[tok.closes - CBOR_TOKEN_ARRAY + 2]
+                        [size_bucket(tok.closes == CBOR_TOKEN_MAP ?
+                                     tok.value / 2 : tok.value)]++;
+                break;
+        }
+
+        // remember the role of any container just opened for its children
+        if (tok.type != CBOR_TOKEN_END && scanner->depth > tok.depth &&
+                set_role(st, tok.depth, role) == -1)
+            goto nomem;
+
+        if (cbor_scanner_item_done(scanner) && !sequence &&
+                !cbor_scanner_at_end(scanner))
+            return 1;
+    }
+
+nomem:
+    scanner->error = CBOR_SCAN_NOMEM;
+    return -1;
+}
+
+
+static void
+finish_stats(CBORStats *st)
+{
+    size_t i;
+    uint64_t size, cost;
+
+    for (i = 0; i < st->strings_size; ++i) {
+        if (st->strings[i].data && st->strings[i].count > 1) {
+            st->repeated_strings++;
+            size = cbor_head_size(st->strings[i].length) + st->strings[i].length;
+            cost = size + st->strings[i].count * PACKED_REF_SIZE;
+            if (size * st->strings[i].count > cost)
+                st->packed_savings += size * st->strings[i].count - cost;
+        }
+    }
+}
+
+
+static void
+free_stats(CBORStats *st)
+{
+    free(st->tags);
+    free(st->strings);
+    free(st->roles);
+}
+
+
+// Conversion to Python //////////////////////////////////////////////////////
+
+static int
+set_item(PyObject *dict, const char *key, PyObject *value)
+{
+    int ret = -1;
+
+    if (value) {
+        ret = PyDict_SetItemString(dict, key, value);
+        Py_DECREF(value);
+    }
+    return ret;
+}
+
+
+#define SET_U64(dict, key, value) \
+    set_item((dict), (key), PyLong_FromUnsignedLongLong(value))
+
+
+static PyObject *
+histogram_to_dict(const uint64_t *buckets)
+{
+    PyObject *ret, *key, *value;
+    int i;
+
+    ret = PyDict_New();
+    if (ret) {
+        for (i = 0; i < STATS_BUCKETS; ++i) {
+            if (!buckets[i])
+                continue;
+            key = PyLong_FromUnsignedLongLong(i ? 1ULL << (i - 1) : 0);
+            value = PyLong_FromUnsignedLongLong(buckets[i]);
+            if (!key || !value || PyDict_SetItem(ret, key, value) == -1) {
+                Py_XDECREF(key);
+                Py_XDECREF(value);
+                Py_DECREF(ret);
+                return NULL;
+            }
+            Py_DECREF(key);
+            Py_DECREF(value);
+        }
+    }
+    return ret;
+}
+
+
+static int
+compare_tags(const void *a, const void *b)
+{
+    uint64_t x = ((const TagEntry *) a)->tag, y = ((const TagEntry *) b)->tag;
+
+    return x < y ? -1 : x > y;
+}
+
+
+static PyObject *
+tags_to_dict(CBORStats *st)
+{
+    PyObject *ret, *key, *value;
+    size_t i, j;
+
+    // compact the table and sort it so the tags come out in order
+    for (i = j = 0; i < st->tags_size; ++i)
+        if (st->tags[i].count)
+            st->tags[j++] = st->tags[i];
+    if (j)
+        qsort(st->tags, j, sizeof(TagEntry), compare_tags);
+    ret = PyDict_New();
+    if (ret) {
+        for (i = 0; i < j; ++i) {
+            key = PyLong_FromUnsignedLongLong(st->tags[i].tag);
+            value = PyLong_FromUnsignedLongLong(st->tags[i].count);
+            if (!key || !value || PyDict_SetItem(ret, key, value) == -1) {
+                Py_XDECREF(key);
+                Py_XDECREF(value);
+                Py_DECREF(ret);
+                return NULL;
+            }
+            Py_DECREF(key);
+            Py_DECREF(value);
+        }
+    }
+    return ret;
+}
+
+
+static PyObject *
+stats_to_dict(CBORStats *st)
+{
+    PyObject *ret, *majors, *floats;
+    int i;
+
+    ret = PyDict_New();
+    if (!ret)
+        return NULL;
+    majors = PyDict_New();
+    floats = PyDict_New();
+    if (majors && floats) {
+        for (i = 0; i < STATS_MAJOR_COUNT; ++i)
+            if (SET_U64(majors, major_names[i], st->major[i]) == -1)
+                goto error;
+        if (SET_U64(floats, "half", st->floats[0]) == -1 ||
+                SET_U64(floats, "single", st->floats[1]) == -1 ||
+                SET_U64(floats, "double", st->floats[2]) == -1 ||
+                SET_U64(floats, "shrinkable", st->shrinkable_floats) == -1 ||
+                SET_U64(floats, "shrink_savings", st->float_savings) == -1)
+            goto error;
+        if (SET_U64(ret, "items", st->items) == 0 &&
+                SET_U64(ret, "bytes", st->length) == 0 &&
+                PyDict_SetItemString(ret, "major_types", majors) == 0 &&
+                set_item(ret, "tags", tags_to_dict(st)) == 0 &&
+                SET_U64(ret, "indefinite", st->indefinite) == 0 &&
+                SET_U64(ret, "max_depth", st->max_depth) == 0 &&
+                set_item(ret, "bytes_sizes", histogram_to_dict(st->sizes[0])) == 0 &&
+                set_item(ret, "text_sizes", histogram_to_dict(st->sizes[1])) == 0 &&
+                set_item(ret, "array_sizes", histogram_to_dict(st->sizes[2])) == 0 &&
+                set_item(ret, "map_sizes", histogram_to_dict(st->sizes[3])) == 0 &&
+                SET_U64(ret, "key_bytes", st->key_bytes) == 0 &&
+                SET_U64(ret, "value_bytes", st->value_bytes) == 0 &&
+                PyDict_SetItemString(ret, "floats", floats) == 0 &&
+                SET_U64(ret, "repeated_strings", st->repeated_strings) == 0 &&
+                set_item(ret, "stringref_savings",
+                    PyLong_FromLongLong(st->stringref_savings)) == 0 &&
+                SET_U64(ret, "packed_savings", st->packed_savings) == 0) {
+            Py_DECREF(majors);
+            Py_DECREF(floats);
+            return ret;
+        }
+    }
+error:
+    Py_XDECREF(majors);
+    Py_XDECREF(floats);
+    Py_DECREF(ret);
+    return NULL;
+}
+
+
+// scan_stats(data, sequence=False)
+PyObject *
+CBOR2_scan_stats(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"data", "sequence", NULL};
+    PyObject *data, *ret = NULL;
+    int sequence = 0, result;
+    CBORScanner scanner;
+    CBORStats st;
+    Py_buffer view;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|p", keywords,
+                &data, &sequence))
+        return NULL;
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) == -1)
+        return NULL;
+
+    memset(&st, 0, sizeof(st));
+    cbor_scanner_init(&scanner, view.buf, view.len);
+    Py_BEGIN_ALLOW_THREADS
+    result = scan_stats(&scanner, &st, sequence);
+    if (result == 0)
+        finish_stats(&st);
+    Py_END_ALLOW_THREADS
+
+    if (result == 0)
+        ret = stats_to_dict(&st);
+    else if (result == 1)
+        PyErr_Format(_CBOR2_CBORDecodeValueError,
+                "%zu bytes of trailing data after the first item",
+                scanner.length - scanner.pos);
+    else
+        _CBOR2_raise_scan_error(&scanner);
+    cbor_scanner_free(&scanner);
+    free_stats(&st);
+    PyBuffer_Release(&view);
+    return ret;
+}
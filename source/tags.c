@@ -1,12 +1,46 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <stdint.h>
-#include "structmember.h"
+#include "module.h"
 #include "tags.h"
 
 
 // Constructors and destructors //////////////////////////////////////////////
 
+// Instances of CBORTag itself are kept for reuse once freed, as the decoder
+// creates one for every tag it has no decoder for
+#define CBORTAG_FREELIST_SIZE 256
+static CBORTagObject *free_list[CBORTAG_FREELIST_SIZE];
+static int free_count = 0;
+
+static CBORTagObject *
+CBORTag_alloc(void)
+{
+    CBORTagObject *ret;
+
+    if (free_count) {
+        ret = free_list[--free_count];
+        PyObject_Init((PyObject *) ret, &CBORTagType);
+    } else {
+        ret = PyObject_GC_New(CBORTagObject, &CBORTagType);
+        if (!ret)
+            return NULL;
+    }
+    ret->tag = 0;
+    Py_INCREF(Py_None);
+    ret->value = Py_None;
+    ret->hash = -1;
+    PyObject_GC_Track(ret);
+    return ret;
+}
+
+void
+CBORTag_ClearFreeList(void)
+{
+    while (free_count)
+        PyObject_GC_Del(free_list[--free_count]);
+}
+
 static int
 CBORTag_traverse(CBORTagObject *self, visitproc visit, void *arg)
 {
@@ -27,7 +61,10 @@ CBORTag_dealloc(CBORTagObject *self)
 {
     PyObject_GC_UnTrack(self);
     CBORTag_clear(self);
-    Py_TYPE(self)->tp_free((PyObject *) self);
+    if (CBORTag_CheckExact(self) && free_count < CBORTAG_FREELIST_SIZE)
+        free_list[free_count++] = self;
+    else
+        Py_TYPE(self)->tp_free((PyObject *) self);
 }
 
 
@@ -37,31 +74,26 @@ CBORTag_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
     CBORTagObject *self;
 
+    if (type == &CBORTagType)
+        return (PyObject *) CBORTag_alloc();
     self = (CBORTagObject *) type->tp_alloc(type, 0);
     if (self) {
         self->tag = 0;
         Py_INCREF(Py_None);
         self->value = Py_None;
+        self->hash = -1;
     }
     return (PyObject *) self;
 }
 
 
-// CBORTag.__init__(self, tag=None, value=None)
 static int
-CBORTag_init(CBORTagObject *self, PyObject *args, PyObject *kwargs)
+tag_from_object(PyObject *obj, uint64_t *tag)
 {
-    static char *keywords[] = {"tag", "value", NULL};
-    PyObject *tmp, *value, *tmp_tag = NULL;
-    uint64_t tag = 0;
-
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", keywords,
-                &tmp_tag, &value))
-        return -1;
     // Raises an overflow error if it doesn't work
-    tag = PyLong_AsUnsignedLongLong(tmp_tag);
+    *tag = PyLong_AsUnsignedLongLong(obj);
 
-    if (tag == (uint64_t)-1) {
+    if (*tag == (uint64_t)-1) {
         if (PyErr_Occurred()){
             if (PyErr_ExceptionMatches(PyExc_OverflowError)) {
                 PyErr_Clear(); // clear the overflow error
@@ -70,7 +102,25 @@ CBORTag_init(CBORTagObject *self, PyObject *args, PyObject *kwargs)
             return -1;
         } // otherwise it's 2**64-1 which is fine :)
     }
+    return 0;
+}
+
+
+// CBORTag.__init__(self, tag=None, value=None)
+static int
+CBORTag_init(CBORTagObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"tag", "value", NULL};
+    PyObject *tmp, *value, *tmp_tag = NULL;
+    uint64_t tag = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", keywords,
+                &tmp_tag, &value))
+        return -1;
+    if (tag_from_object(tmp_tag, &tag) == -1)
+        return -1;
     self->tag = tag;
+    self->hash = -1;
 
     if (value) {
         tmp = self->value;
@@ -139,15 +189,51 @@ CBORTag_richcompare(PyObject *aobj, PyObject *bobj, int op)
 }
 
 
+// Returns true if the hash of value can't change: it is immutable all the
+// way down, or (like frozenset and FrozenDict) caches its own hash anyway
+static int
+hash_is_fixed(PyObject *value)
+{
+    Py_ssize_t i;
+
+    if (value == Py_None || PyBool_Check(value) || PyLong_CheckExact(value) ||
+            PyFloat_CheckExact(value) || PyComplex_CheckExact(value) ||
+            PyUnicode_CheckExact(value) || PyBytes_CheckExact(value) ||
+            PyFrozenSet_CheckExact(value) ||
+            (_CBOR2_FrozenDict && Py_TYPE(value) == (PyTypeObject *) _CBOR2_FrozenDict))
+        return 1;
+    if (PyTuple_CheckExact(value)) {
+        for (i = 0; i < PyTuple_GET_SIZE(value); i++)
+            if (!hash_is_fixed(PyTuple_GET_ITEM(value, i)))
+                return 0;
+        return 1;
+    }
+    return 0;
+}
+
+
+// The hash is kept until the tag or value is replaced, but only if the
+// value's own hash can't change; a nested tag, say, can still be modified
 static Py_hash_t
 CBORTag_hash(CBORTagObject *self)
 {
-    PyObject *tmp = Py_BuildValue("(KO)", self->tag, self->value);
+    PyObject *tmp;
+    Py_hash_t ret;
+
+    if (self->hash != -1)
+        return self->hash;
+    if (!self->value) {
+        PyErr_SetString(PyExc_AttributeError, "value");
+        return -1;
+    }
+    tmp = Py_BuildValue("(KO)", self->tag, self->value);
     if(!tmp){ // if tmp is NULL, Py_BuildValue has already set the error
         return -1;
     }
-    Py_hash_t ret = PyObject_Hash(tmp);
+    ret = PyObject_Hash(tmp);
     Py_DECREF(tmp);
+    if (ret != -1 && hash_is_fixed(self->value))
+        self->hash = ret;
     return ret;
 }
 
@@ -157,14 +243,11 @@ CBORTag_hash(CBORTagObject *self)
 PyObject *
 CBORTag_New(uint64_t tag)
 {
-    CBORTagObject *ret = NULL;
+    CBORTagObject *ret;
 
-    ret = PyObject_GC_New(CBORTagObject, &CBORTagType);
-    if (ret) {
+    ret = CBORTag_alloc();
+    if (ret)
         ret->tag = tag;
-        Py_INCREF(Py_None);
-        ret->value = Py_None;
-    }
     return (PyObject *)ret;
 }
 
@@ -183,6 +266,56 @@ CBORTag_SetValue(PyObject *tag, PyObject *value)
     tmp = self->value;
     Py_INCREF(value);
     self->value = value;
+    self->hash = -1;
+    Py_XDECREF(tmp);
+    return 0;
+}
+
+
+// Attributes ////////////////////////////////////////////////////////////////
+
+static PyObject *
+CBORTag_get_tag(CBORTagObject *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->tag);
+}
+
+static int
+CBORTag_set_tag(CBORTagObject *self, PyObject *value, void *closure)
+{
+    uint64_t tag;
+
+    if (!value) {
+        PyErr_SetString(PyExc_AttributeError, "cannot delete tag attribute");
+        return -1;
+    }
+    if (tag_from_object(value, &tag) == -1)
+        return -1;
+    self->tag = tag;
+    self->hash = -1;
+    return 0;
+}
+
+static PyObject *
+CBORTag_get_value(CBORTagObject *self, void *closure)
+{
+    if (!self->value) {
+        PyErr_SetString(PyExc_AttributeError, "value");
+        return NULL;
+    }
+    Py_INCREF(self->value);
+    return self->value;
+}
+
+static int
+CBORTag_set_value(CBORTagObject *self, PyObject *value, void *closure)
+{
+    PyObject *tmp;
+
+    tmp = self->value;
+    Py_XINCREF(value);
+    self->value = value;
+    self->hash = -1;
     Py_XDECREF(tmp);
     return 0;
 }
@@ -190,11 +323,11 @@ CBORTag_SetValue(PyObject *tag, PyObject *value)
 
 // Tag class definition //////////////////////////////////////////////////////
 
-static PyMemberDef CBORTag_members[] = {
-    {"tag", T_ULONGLONG, offsetof(CBORTagObject, tag), 0,
-        "the semantic tag associated with the value"},
-    {"value", T_OBJECT_EX, offsetof(CBORTagObject, value), 0,
-        "the tagged value"},
+static PyGetSetDef CBORTag_getsetters[] = {
+    {"tag", (getter) CBORTag_get_tag, (setter) CBORTag_set_tag,
+        "the semantic tag associated with the value", NULL},
+    {"value", (getter) CBORTag_get_value, (setter) CBORTag_set_value,
+        "the tagged value", NULL},
     {NULL}
 };
 
@@ -216,7 +349,7 @@ PyTypeObject CBORTagType = {
     .tp_dealloc = (destructor) CBORTag_dealloc,
     .tp_traverse = (traverseproc) CBORTag_traverse,
     .tp_clear = (inquiry) CBORTag_clear,
-    .tp_members = CBORTag_members,
+    .tp_getset = CBORTag_getsetters,
     .tp_repr = (reprfunc) CBORTag_repr,
     .tp_hash = (hashfunc) CBORTag_hash,
     .tp_richcompare = CBORTag_richcompare,
@@ -6,11 +6,13 @@ typedef struct {
     PyObject_HEAD
     uint64_t tag;
     PyObject *value;
+    Py_hash_t hash;  // hash of (tag, value) once calculated, otherwise -1
 } CBORTagObject;
 
 extern PyTypeObject CBORTagType;
 
 PyObject * CBORTag_New(uint64_t);
 int CBORTag_SetValue(PyObject *, PyObject *);
+void CBORTag_ClearFreeList(void);
 
 #define CBORTag_CheckExact(op) (Py_TYPE(op) == &CBORTagType)
@@ -2,7 +2,10 @@ import platform
 import struct
 
 import cbor2.decoder
+import cbor2.diagnostic
 import cbor2.encoder
+import cbor2.index
+import cbor2.stats
 import cbor2.types
 import pytest
 
@@ -45,7 +48,14 @@ def impl(request):
         # implementations, even if the top-level package has imported the
         # _cbor2 module
         module = Module()
-        for source in (cbor2.types, cbor2.encoder, cbor2.decoder):
+        for source in (
+            cbor2.types,
+            cbor2.encoder,
+            cbor2.decoder,
+            cbor2.diagnostic,
+            cbor2.stats,
+            cbor2.index,
+        ):
             for name in dir(source):
                 setattr(module, name, getattr(source, name))
         return module
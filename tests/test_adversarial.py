@@ -0,0 +1,188 @@
+"""
+Pathological inputs, each decoded under a time and a memory budget.
+
+An input of N bytes must decode (or fail to decode) in time comparable to an
+array of N small integers, without allocating much more than N bytes along the
+way, no matter what lengths it claims.
+"""
+import struct
+import time
+import tracemalloc
+from io import BytesIO
+
+import pytest
+
+# Decoding may take this many times as long as decoding an array of as many
+# small integers as the input has bytes (plus some slack for tiny inputs)
+TIME_FACTOR = 10
+TIME_SLACK = 0.05
+# ... and allocate this many times as much memory as the input holds, which
+# leaves room for results made of many small objects
+MEMORY_FACTOR = 32
+MEMORY_SLACK = 4 << 20
+
+COLLIDING_MODULUS = 2**61 - 1  # hash(n) == hash(n + COLLIDING_MODULUS)
+
+
+def head(major, length):
+    return struct.pack(">BQ", major << 5 | 27, length)
+
+
+def reference_time(impl, size):
+    data = head(4, size) + b"\x00" * size
+    start = time.perf_counter()
+    impl.loads(data)
+    return time.perf_counter() - start
+
+
+def check_budget(impl, data, exception=None, open_fp=None):
+    def decode():
+        with (open_fp or BytesIO)(data) as fp:
+            if exception is None:
+                return impl.load(fp)
+            with pytest.raises(exception):
+                impl.load(fp)
+
+    # the first run imports modules and fills caches which would otherwise be
+    # charged to the input
+    decode()
+    start = time.perf_counter()
+    decode()
+    elapsed = time.perf_counter() - start
+    assert elapsed <= TIME_FACTOR * reference_time(impl, len(data)) + TIME_SLACK
+
+    tracemalloc.start()
+    try:
+        result = decode()
+        _, peak = tracemalloc.get_traced_memory()
+    finally:
+        tracemalloc.stop()
+    assert peak <= MEMORY_FACTOR * len(data) + MEMORY_SLACK
+    return result
+
+
+@pytest.fixture
+def open_file(tmp_path):
+    # Unlike BytesIO, file objects allocate the full amount asked of read()
+    def open_file(data):
+        path = tmp_path / "input.cbor"
+        path.write_bytes(data)
+        return open(path, "rb")
+
+    return open_file
+
+
+@pytest.mark.parametrize("major", [2, 3], ids=["bytes", "text"])
+@pytest.mark.parametrize("length", [0xFFFFFFF0, 1 << 40], ids=["4GiB", "1TiB"])
+@pytest.mark.parametrize("source", ["bytesio", "file"])
+def test_huge_claimed_string_length(impl, major, length, source, open_file):
+    data = head(major, length) + b"x" * 1000
+    check_budget(
+        impl, data, impl.CBORDecodeEOF, open_file if source == "file" else None
+    )
+
+
+@pytest.mark.parametrize("major", [4, 5], ids=["array", "map"])
+def test_huge_claimed_container_length(impl, major):
+    check_budget(impl, head(major, 1 << 40) + b"\x00" * 1000, impl.CBORDecodeEOF)
+
+
+@pytest.mark.parametrize("prefix", [b"", b"\xd9\x01\x02"], ids=["list", "tuple"])
+def test_nested_claimed_lengths(impl, prefix):
+    # Every level claims 65535 items; preallocating for them would take half
+    # a megabyte per level
+    data = prefix + b"\x99\xff\xff" * 500
+    check_budget(impl, data, (impl.CBORDecodeEOF, RecursionError))
+
+
+@pytest.mark.parametrize(
+    "level",
+    [b"\x81", b"\x9f", b"\xa1\x00", b"\xd8\x64", b"\xd8\x1c", b"\xd9\x01\x00"],
+    ids=["array", "indefinite_array", "map", "tag", "shareable", "stringref_namespace"],
+)
+def test_deep_nesting(impl, level):
+    check_budget(impl, level * 100000 + b"\x00", RecursionError)
+
+
+@pytest.mark.parametrize(
+    "chunk, count",
+    [
+        (b"\x40", 100000),
+        (b"\x41x", 100000),
+        (b"\x42xy", 50000),
+        (b"\x60", 100000),
+        (b"\x61x", 100000),
+        (b"\x62xy", 50000),
+    ],
+    ids=["bytes0", "bytes1", "bytes2", "text0", "text1", "text2"],
+)
+def test_tiny_indefinite_chunks(impl, chunk, count):
+    start = b"\x5f" if chunk[0] >> 5 == 2 else b"\x7f"
+    result = check_budget(impl, start + chunk * count + b"\xff")
+    assert len(result) == (len(chunk) - 1) * count
+
+
+def test_stringref_chain(impl):
+    count = 50000
+    data = (
+        b"\xd9\x01\x00\x82\x78\x40"
+        + b"a" * 0x40
+        + head(4, count)
+        + b"\xd8\x19\x00" * count
+    )
+    result = check_budget(impl, data)
+    assert len(result[1]) == count
+    assert all(value is result[0] for value in result[1])
+
+
+def test_sharedref_chain(impl):
+    count = 50000
+    data = b"\xd8\x1c" + head(4, count) + b"\xd8\x1d\x00" * count
+    result = check_budget(impl, data)
+    assert all(value is result for value in result)
+
+
+def test_many_shareables(impl):
+    count = 50000
+    data = head(4, count) + b"\xd8\x1c\x00" * count
+    assert check_budget(impl, data) == [0] * count
+
+
+def test_tag_bomb(impl):
+    count = 50000
+    data = head(4, count) + b"\xd8\x64\x00" * count
+    result = check_budget(impl, data)
+    assert len(result) == count
+
+
+@pytest.mark.parametrize("tag", [2, 3], ids=["positive", "negative"])
+def test_giant_bignum(impl, tag):
+    data = bytes([0xC0 | tag]) + head(2, 1 << 20) + b"\xff" * (1 << 20)
+    expected = (1 << (8 << 20)) - 1
+    assert check_budget(impl, data) == (expected if tag == 2 else -expected - 1)
+
+
+@pytest.mark.parametrize("tag", [4, 5], ids=["fraction", "bigfloat"])
+@pytest.mark.parametrize("position", [0, 1], ids=["exponent", "mantissa"])
+def test_giant_decimal(impl, tag, position):
+    # Converting huge ints to Decimal is quadratic, so they're refused
+    bignum = b"\xc2" + head(2, 1 << 16) + b"\xff" * (1 << 16)
+    payload = [b"\x01", b"\x01"]
+    payload[position] = bignum
+    data = bytes([0xC0 | tag, 0x82]) + b"".join(payload)
+    check_budget(impl, data, impl.CBORDecodeValueError)
+
+
+@pytest.mark.xfail(
+    reason="dict insertion is quadratic in the number of keys with the same hash",
+    strict=False,
+)
+def test_colliding_keys(impl):
+    # Strings are hashed with a random key but ints aren't, so these keys all
+    # share a hash
+    count = 4096
+    data = head(5, count) + b"".join(
+        b"\xc2\x4a" + (i * COLLIDING_MODULUS).to_bytes(10, "big") + b"\x00"
+        for i in range(1, count + 1)
+    )
+    assert len(check_budget(impl, data)) == count
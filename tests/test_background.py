@@ -0,0 +1,84 @@
+from io import BytesIO
+
+import pytest
+from cbor2.background import BackgroundReader, BackgroundWriter
+
+RECORDS = [{"id": i, "name": "record %d" % i, "tags": ["a"] * (i % 5)} for i in range(1003)]
+
+
+class FailingFile:
+    def write(self, data):
+        raise OSError("disk full")
+
+    def read(self, amount):
+        raise OSError("connection reset")
+
+
+class ShortWriteFile(BytesIO):
+    def __init__(self):
+        super().__init__()
+        self.calls = 0
+
+    def write(self, data):
+        # every other call writes nothing, as a non-blocking stream might
+        self.calls += 1
+        if self.calls % 2:
+            return None
+        return super().write(bytes(data[:100]))
+
+
+def test_roundtrip(impl):
+    fp = BytesIO()
+    with BackgroundWriter(fp, chunk_size=1024) as out:
+        for record in RECORDS:
+            impl.dump(record, out)
+    assert fp.getvalue() == b"".join(impl.dumps(record) for record in RECORDS)
+
+    fp.seek(0)
+    with BackgroundReader(fp, chunk_size=1024) as src:
+        decoder = impl.CBORDecoder(src)
+        assert [decoder.decode() for _ in RECORDS] == RECORDS
+        with pytest.raises(impl.CBORDecodeEOF):
+            decoder.decode()
+
+
+def test_writer_flush(impl):
+    fp = BytesIO()
+    out = BackgroundWriter(fp)
+    impl.dump(RECORDS, out)
+    out.flush()
+    assert fp.getvalue() == impl.dumps(RECORDS)
+    out.close()
+    assert not fp.closed
+
+
+def test_writer_short_write(impl):
+    fp = ShortWriteFile()
+    with BackgroundWriter(fp, chunk_size=5000) as out:
+        impl.dump(RECORDS, out)
+    assert fp.getvalue() == impl.dumps(RECORDS)
+
+
+def test_writer_error(impl):
+    out = BackgroundWriter(FailingFile(), chunk_size=16)
+    with pytest.raises(OSError, match="disk full"):
+        impl.dump(RECORDS, out)
+        out.flush()
+    with pytest.raises(OSError, match="disk full"):
+        out.close()
+    assert out.closed
+
+
+def test_reader_error(impl):
+    with BackgroundReader(FailingFile()) as src:
+        with pytest.raises(OSError, match="connection reset"):
+            impl.load(src)
+
+
+def test_reader_close_early(impl):
+    fp = BytesIO(b"".join(impl.dumps(record) for record in RECORDS))
+    src = BackgroundReader(fp, chunk_size=16, depth=1)
+    assert impl.load(src) == RECORDS[0]
+    src.close()
+    assert src.closed
+    assert not fp.closed
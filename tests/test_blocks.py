@@ -0,0 +1,128 @@
+from concurrent.futures import ThreadPoolExecutor
+from io import BytesIO
+
+import pytest
+from cbor2 import dumps
+from cbor2.blocks import BlockReader, BlockWriter, dumps_blocks
+from cbor2.types import CBORDecodeValueError
+
+RECORDS = [{"id": i, "name": "record %d" % i, "tags": ["a"] * (i % 5)} for i in range(1003)]
+
+
+@pytest.mark.parametrize("compress", [True, False], ids=["compressed", "uncompressed"])
+def test_roundtrip(compress):
+    data = dumps_blocks(RECORDS, records_per_block=100, compress=compress)
+    with BlockReader(data) as reader:
+        assert len(reader) == 1003
+        assert reader.block_count == 11
+        assert list(reader) == RECORDS
+
+
+def test_random_access():
+    with BlockReader(dumps_blocks(RECORDS, records_per_block=64)) as reader:
+        assert reader[0] == RECORDS[0]
+        assert reader[500] == RECORDS[500]
+        assert reader[-1] == RECORDS[-1]
+        assert reader.read_encoded(7) == b"\xa3bid\x07dnamehrecord 7dtags\x82aaaa"
+        with pytest.raises(IndexError):
+            reader[1003]
+
+
+def test_parallel():
+    with BlockReader(dumps_blocks(RECORDS, records_per_block=10)) as reader:
+        with ThreadPoolExecutor(2) as executor:
+            assert list(reader.iter_parallel(executor, prefetch=3)) == RECORDS
+
+
+def test_file(tmpdir):
+    path = tmpdir.join("records.cbb")
+    with path.open("wb") as fp:
+        with BlockWriter(fp, records_per_block=100) as writer:
+            for record in RECORDS:
+                writer.write(record)
+            writer.write_encoded(b"\x01")
+            assert len(writer) == 1004
+
+    with BlockReader(str(path)) as reader:
+        assert reader[1003] == 1
+        assert reader[250] == RECORDS[250]
+
+    with path.open("rb") as fp:
+        with BlockReader(fp) as reader:
+            assert len(reader) == 1004
+
+
+def test_decoder_options():
+    data = dumps_blocks([{"a": 1}], records_per_block=1)
+    with BlockReader(data, object_hook=lambda decoder, value: sorted(value)) as reader:
+        assert reader[0] == ["a"]
+
+
+def test_empty():
+    with BlockReader(dumps_blocks([])) as reader:
+        assert len(reader) == 0
+        assert list(reader) == []
+
+
+def test_write_after_close():
+    writer = BlockWriter(BytesIO())
+    writer.close()
+    with pytest.raises(ValueError, match="closed"):
+        writer.write(1)
+
+
+@pytest.mark.parametrize(
+    "data, message",
+    [
+        pytest.param(b"garbage", "not a CBOR block container", id="magic"),
+        pytest.param(dumps_blocks([1])[:-1], "index is missing", id="truncated"),
+        pytest.param(dumps_blocks([1, 2], records_per_block=1)[:8], "not a CBOR", id="short"),
+    ],
+)
+def test_invalid(data, message):
+    with pytest.raises(CBORDecodeValueError, match=message):
+        BlockReader(data)
+
+
+def container(**index):
+    index = dict({"version": 1, "records_per_block": 2, "records": 3}, **index)
+    index.setdefault("blocks", [[8, 0, 2, False], [8, 0, 1, False]])
+    return b"CBOR2BLK" + dumps(index) + (8).to_bytes(8, "big") + b"CBOR2IDX"
+
+
+@pytest.mark.parametrize(
+    "data, message",
+    [
+        pytest.param(container(version=2), "unsupported", id="version"),
+        pytest.param(container(records_per_block=None), "records_per_block", id="no_per_block"),
+        pytest.param(container(records_per_block=0), "records_per_block", id="zero_per_block"),
+        pytest.param(container(records="3"), "record count", id="records_type"),
+        pytest.param(container(records=-1), "record count", id="negative_records"),
+        pytest.param(container(blocks={}), "block list", id="blocks_type"),
+        pytest.param(container(blocks=[[8, 0, 2]]), "entry for block 0", id="short_entry"),
+        pytest.param(container(blocks=[8]), "entry for block 0", id="entry_type"),
+        pytest.param(
+            container(blocks=[[8, 0, 2, False], [8, 0, 1.0, False]]),
+            "entry for block 1",
+            id="count_type",
+        ),
+        pytest.param(
+            container(blocks=[[8, 0, 2, False], [8, 0, 1, 1]]), "entry for block 1", id="flag_type"
+        ),
+        pytest.param(container(blocks=[[0, 0, 2, False]]), "block 0 lies", id="before_blocks"),
+        pytest.param(container(blocks=[[8, 1, 2, False]]), "block 0 lies", id="past_index"),
+        pytest.param(
+            container(blocks=[[8, 0, 1, False], [8, 0, 2, False]]), "block 0 holds", id="partial"
+        ),
+        pytest.param(container(blocks=[[8, 0, 2, False], [8, 0, 3, False]]), "block 1", id="over"),
+        pytest.param(container(records=1, blocks=[[8, 0, 2, False]]), "counts", id="total"),
+        pytest.param(
+            container(records_per_block=0, records=0, blocks=[[8, 0, 0, False]]),
+            "records_per_block",
+            id="zero_single_block",
+        ),
+    ],
+)
+def test_invalid_index(data, message):
+    with pytest.raises(CBORDecodeValueError, match=message):
+        BlockReader(data)
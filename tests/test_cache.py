@@ -0,0 +1,54 @@
+import pytest
+from cbor2 import CBORDecodeEOF, CBORTag, dumps, loads
+from cbor2.cache import DecodeCache
+from cbor2.types import FrozenDict
+
+PAYLOAD = dumps({"flags": ["a", "b"], "limits": {"x": 1}})
+
+
+def test_loads():
+    cache = DecodeCache()
+    value = cache.loads(PAYLOAD)
+    assert value == FrozenDict({"flags": ("a", "b"), "limits": FrozenDict({"x": 1})})
+    assert cache.loads(bytearray(PAYLOAD)) is value
+    assert cache.loads(memoryview(PAYLOAD)) is value
+    assert cache.loads(dumps([1])) == (1,)
+    assert (cache.hits, cache.misses, len(cache)) == (2, 2, 2)
+    assert cache.hit_rate == 0.5
+    cache.clear()
+    assert (cache.hits, cache.misses, len(cache), cache.hit_rate) == (0, 0, 0, 0.0)
+    assert cache.loads(PAYLOAD) is not value
+
+
+def test_maxsize():
+    cache = DecodeCache(maxsize=2)
+    first = cache.loads(dumps([1]))
+    cache.loads(dumps([2]))
+    cache.loads(dumps([1]))
+    cache.loads(dumps([3]))
+    assert len(cache) == 2
+    assert cache.loads(dumps([1])) is first
+    assert cache.misses == 3
+
+
+def test_options():
+    cache = DecodeCache(tag_hook=lambda decoder, tag: tag.value * 2)
+    assert cache.loads(dumps(CBORTag(6000, [1]))) == (1, 1)
+
+
+def test_errors():
+    cache = DecodeCache()
+    for _ in range(2):
+        with pytest.raises(CBORDecodeEOF):
+            cache.loads(PAYLOAD[:-1])
+    assert (cache.hits, cache.misses, len(cache)) == (0, 2, 0)
+
+
+def test_tag_hook():
+    cache = DecodeCache()
+    payload = dumps([CBORTag(24, PAYLOAD), CBORTag(24, PAYLOAD), CBORTag(6000, 1)])
+    value = loads(payload, tag_hook=cache.tag_hook)
+    assert value[0] == cache.loads(PAYLOAD)
+    assert value[0] is value[1]
+    assert value[2] == CBORTag(6000, 1)
+    assert (cache.hits, cache.misses) == (2, 1)
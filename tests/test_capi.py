@@ -0,0 +1,135 @@
+"""
+Exercises the C API capsule through ctypes, the way another extension would
+use it through cbor2_capi.h.
+"""
+import ctypes
+from datetime import datetime, timezone
+from io import BytesIO
+
+import pytest
+
+_cbor2 = pytest.importorskip("_cbor2")
+
+WriteFunc = ctypes.CFUNCTYPE(
+    ctypes.c_int, ctypes.c_void_p, ctypes.POINTER(ctypes.c_char), ctypes.c_size_t
+)
+
+
+class CBOR2_CAPI(ctypes.Structure):
+    _fields_ = [
+        ("version", ctypes.c_int),
+        ("EncoderType", ctypes.c_void_p),
+        ("DecoderType", ctypes.c_void_p),
+        ("TagType", ctypes.c_void_p),
+        ("Dumps", ctypes.PYFUNCTYPE(ctypes.py_object, ctypes.py_object, ctypes.py_object)),
+        (
+            "DumpTo",
+            ctypes.PYFUNCTYPE(
+                ctypes.c_int, ctypes.py_object, ctypes.py_object, WriteFunc, ctypes.c_void_p
+            ),
+        ),
+        (
+            "Loads",
+            ctypes.PYFUNCTYPE(
+                ctypes.py_object, ctypes.c_char_p, ctypes.c_ssize_t, ctypes.py_object
+            ),
+        ),
+        ("Tag_New", ctypes.PYFUNCTYPE(ctypes.py_object, ctypes.c_uint64, ctypes.py_object)),
+        ("Encoder_Encode", ctypes.PYFUNCTYPE(ctypes.c_int, ctypes.py_object, ctypes.py_object)),
+        ("Decoder_Decode", ctypes.PYFUNCTYPE(ctypes.py_object, ctypes.py_object)),
+    ]
+
+
+@pytest.fixture(scope="module")
+def api():
+    get_pointer = ctypes.pythonapi.PyCapsule_GetPointer
+    get_pointer.restype = ctypes.c_void_p
+    get_pointer.argtypes = [ctypes.py_object, ctypes.c_char_p]
+    pointer = get_pointer(_cbor2._C_API, b"_cbor2._C_API")
+    return ctypes.cast(pointer, ctypes.POINTER(CBOR2_CAPI)).contents
+
+
+def test_version(api):
+    assert api.version == 1
+
+
+def test_dumps(api):
+    assert api.Dumps([1, "a", b"b"], None) == _cbor2.dumps([1, "a", b"b"])
+    value = {"b": 1, "a": 2}
+    assert api.Dumps(value, {"canonical": True}) == _cbor2.dumps(value, canonical=True)
+
+
+def test_dumps_error(api):
+    with pytest.raises(_cbor2.CBOREncodeTypeError):
+        api.Dumps(object(), None)
+    with pytest.raises(TypeError):
+        api.Dumps(1, {"nonexistent": True})
+
+
+def test_dump_to(api):
+    chunks = []
+
+    @WriteFunc
+    def write(ctx, buf, length):
+        chunks.append(buf[:length])
+        return 0
+
+    value = [
+        b"x" * 100000,
+        memoryview(b"z" * 100000),
+        list(range(10000)),
+        datetime(2023, 1, 2, tzinfo=timezone.utc),
+    ]
+    assert api.DumpTo(value, {"datetime_as_timestamp": True}, write, None) == 0
+    assert len(chunks) > 1
+    assert b"".join(chunks) == _cbor2.dumps(value, datetime_as_timestamp=True)
+
+
+def test_loads(api):
+    data = _cbor2.dumps({"a": [1, 2.5, None]})
+    assert api.Loads(data, len(data), None) == {"a": [1, 2.5, None]}
+    data = b"\xd8\x64\x01"
+    assert api.Loads(data, len(data), {"tag_hook": lambda decoder, tag: tag.tag}) == 100
+
+
+def test_loads_buffer(api):
+    data = _cbor2.dumps([b"x" * 100000, "y" * 100000, _cbor2.CBORTag(24, _cbor2.dumps([1]))])
+
+    def tag_hook(decoder, tag):
+        assert decoder.fp is None
+        return decoder.decode_from_bytes(tag.value)
+
+    assert api.Loads(data, len(data), {"tag_hook": tag_hook}) == [
+        b"x" * 100000,
+        "y" * 100000,
+        [1],
+    ]
+
+
+def test_loads_error(api):
+    with pytest.raises(_cbor2.CBORDecodeEOF):
+        api.Loads(b"\x82\x01", 2, None)
+    with pytest.raises(_cbor2.CBORDecodeEOF):
+        api.Loads(b"\x5a\xff\xff\xff\xff\x00", 6, None)
+    with pytest.raises(_cbor2.CBORDecodeEOF):
+        api.Loads(None, 0, None)
+    with pytest.raises(ValueError):
+        api.Loads(b"\x01", -1, None)
+
+
+def test_tag_new(api):
+    assert api.Tag_New(6000, "foo") == _cbor2.CBORTag(6000, "foo")
+    assert api.Tag_New(1 << 63, None).value is None
+
+
+def test_encoder_decoder(api):
+    with BytesIO() as stream:
+        assert api.Encoder_Encode(_cbor2.CBOREncoder(stream), [1, 2]) == 0
+        assert stream.getvalue() == b"\x82\x01\x02"
+        stream.seek(0)
+        assert api.Decoder_Decode(_cbor2.CBORDecoder(stream)) == [1, 2]
+
+    with pytest.raises(TypeError):
+        api.Encoder_Encode(object(), 1)
+    with pytest.raises(TypeError):
+        api.Decoder_Decode(object())
@@ -0,0 +1,172 @@
+"""
+Checks the cffi binding of the scanner (built on PyPy) against the pure Python
+scanner and decoder it stands in for.
+"""
+import base64
+import math
+from io import BytesIO
+
+import pytest
+
+pytest.importorskip("_cbor2_cffi")
+
+from cbor2 import decoder, scanner  # noqa: E402
+from cbor2.encoder import dumps  # noqa: E402
+from cbor2.types import (  # noqa: E402
+    CBORDecodeEOF,
+    CBORDecodeValueError,
+    CBORSimpleValue,
+    FrozenDict,
+    undefined,
+)
+
+with open("tests/examples.cbor.b64") as f:
+    examples = base64.b64decode(f.read())
+
+
+def token_fields(tok):
+    if tok is None:
+        return None
+    fields = {name: getattr(tok, name) for name in scanner.CBORToken.__slots__}
+    if tok.data is not None:
+        fields["data"] = bytes(tok.data)
+    if isinstance(tok.value, float) and math.isnan(tok.value):
+        fields["value"] = "nan"
+    return fields
+
+
+@pytest.mark.parametrize(
+    "payload",
+    [
+        "00",
+        "3bffffffffffffffff",
+        "6449455446",
+        "7f657374726561646d696e67ff",
+        "5f42010243030405ff",
+        "83010203",
+        "9f018202039f0405ffff",
+        "bf61610161629f0203ffff",
+        "c11a514b67b0",
+        "f97e00fa47c35000fb7e37e43c8800759c",
+        "f4f5f6f7f0f820",
+        "8080a0",
+    ],
+)
+def test_scanner_tokens(payload):
+    data = bytes.fromhex(payload) * 2
+    native = scanner.NativeCBORScanner(data)
+    python = scanner.PyCBORScanner(data)
+    while True:
+        depth = python.depth
+        tokens = [token_fields(tok) for tok in (next(native, None), next(python, None))]
+        assert tokens[0] == tokens[1]
+        if tokens[1] is None:
+            break
+        assert native.pos == python.pos
+        assert native.depth == python.depth
+        assert native.item_done == python.item_done
+        assert native.at_end == python.at_end
+    assert depth == 0
+
+
+def test_scanner_examples():
+    native = [token_fields(tok) for tok in scanner.NativeCBORScanner(examples)]
+    assert native == [token_fields(tok) for tok in scanner.PyCBORScanner(examples)]
+
+
+@pytest.mark.parametrize(
+    "payload, max_depth, exception, message",
+    [
+        ("8301", 0, CBORDecodeEOF, "premature end of stream at offset 2"),
+        ("1b0102", 0, CBORDecodeEOF, "premature end of stream at offset 0"),
+        ("ff", 0, CBORDecodeValueError, "invalid CBOR data at offset 0"),
+        ("5f01ff", 0, CBORDecodeValueError, "invalid CBOR data at offset 1"),
+        ("818181818100", 3, CBORDecodeValueError, "maximum nesting depth exceeded at offset 4"),
+    ],
+)
+def test_scanner_errors(payload, max_depth, exception, message):
+    data = bytes.fromhex(payload)
+    for cls in (scanner.NativeCBORScanner, scanner.PyCBORScanner):
+        with pytest.raises(exception) as exc:
+            for tok in cls(data, max_depth=max_depth):
+                pass
+        assert str(exc.value) == message
+
+
+def test_scanner_skip():
+    data = bytes.fromhex("8301820203820405") + bytes.fromhex("a16161f5")
+    native = scanner.NativeCBORScanner(data)
+    assert native.skip()
+    assert native.pos == 8
+    assert native.skip()
+    assert not native.skip()
+
+
+@pytest.mark.parametrize(
+    "payload, expected",
+    [
+        ("1bffffffffffffffff", 18446744073709551615),
+        ("3903e7", -1000),
+        ("4401020304", b"\x01\x02\x03\x04"),
+        ("62c3bc", "ü"),
+        ("7f657374726561646d696e67ff", "streaming"),
+        ("5f42010243030405ff", b"\x01\x02\x03\x04\x05"),
+        ("fb3ff199999999999a", 1.1),
+        ("f97c00", float("inf")),
+        ("f4", False),
+        ("f6", None),
+        ("f7", undefined),
+        ("f0", CBORSimpleValue(16)),
+        ("f8ff", CBORSimpleValue(255)),
+        ("9f018202039f0405ffff", [1, [2, 3], [4, 5]]),
+        ("a26161016162820203", {"a": 1, "b": [2, 3]}),
+        ("a1820102a1820304f5", {(1, 2): FrozenDict({(3, 4): True})}),
+        ("a201020104", {1: 4}),
+    ],
+)
+def test_loads_native(payload, expected):
+    data = bytes.fromhex(payload)
+    result = decoder._loads_native(data, "strict")
+    assert result == expected
+    assert type(result) is type(expected)
+    assert result == decoder.CBORDecoder(BytesIO(data)).decode()
+
+
+@pytest.mark.parametrize(
+    "payload",
+    [
+        # tags, invalid UTF-8, malformed and truncated data are all left to
+        # CBORDecoder
+        "c11a514b67b0",
+        "8261616180",
+        "62c328",
+        "ff",
+        "8301",
+        "",
+    ],
+)
+def test_loads_native_unsupported(payload):
+    with pytest.raises(decoder._Unsupported):
+        decoder._loads_native(bytes.fromhex(payload), "strict")
+
+
+def test_loads_fallback():
+    assert decoder.loads(bytes.fromhex("62c328"), str_errors="replace") == "�("
+    with pytest.raises(UnicodeDecodeError):
+        decoder.loads(bytes.fromhex("62c328"))
+    with pytest.raises(CBORDecodeEOF):
+        decoder.loads(bytes.fromhex("8301"))
+    assert decoder.loads(bytes.fromhex("820102ff")) == [1, 2]
+    assert decoder.loads(bytearray(b"\x81\x01")) == [1]
+
+
+def test_loads_document():
+    value = {
+        "name": "sensor",
+        "readings": [{"t": i, "v": i * 0.5, "ok": i % 3 != 0} for i in range(100)],
+        "raw": [bytes(range(i)) for i in range(20)],
+        (1, "key"): None,
+    }
+    data = dumps(value)
+    assert decoder._loads_native(data, "strict") == value
+    assert decoder.loads(data) == value
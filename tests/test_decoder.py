@@ -76,6 +76,20 @@ def test_str_errors_attr(impl):
             del decoder.str_errors
 
 
+def test_map_type_attr(impl):
+    with BytesIO(b"foobar") as stream:
+        with pytest.raises(ValueError):
+            impl.CBORDecoder(stream, map_type=dict)
+        with pytest.raises(ValueError):
+            impl.CBORDecoder(stream, map_type="list")
+        decoder = impl.CBORDecoder(stream)
+        assert decoder.map_type == "dict"
+        decoder.map_type = "pairs"
+        assert decoder.map_type == "pairs"
+        with pytest.raises(AttributeError):
+            del decoder.map_type
+
+
 def test_read(impl):
     with BytesIO(b"foobar") as stream:
         decoder = impl.CBORDecoder(stream)
@@ -330,6 +344,7 @@ def test_simple_value(impl, simple_value):
     decoded = impl.loads(unhexlify(payload))
     assert decoded == expected
     assert decoded == wrapped
+    assert impl.loads(unhexlify(payload)) is decoded
 
 
 def test_simple_val_as_key(impl):
@@ -426,6 +441,66 @@ def test_bad_datetime(impl):
     assert str(excinfo.value) == "invalid datetime string: '0000-123-01'"
 
 
+@pytest.mark.parametrize(
+    "payload, expected",
+    [
+        ("d903e9a1011a514b67b0", datetime(2013, 3, 21, 20, 4, 0, tzinfo=timezone.utc)),
+        (
+            "d903e9a2011a514b67b0251a0001e240",
+            datetime(2013, 3, 21, 20, 4, 0, 123456, tzinfo=timezone.utc),
+        ),
+        (
+            "d903e9a2011a514b67b0281a075bcd15",
+            datetime(2013, 3, 21, 20, 4, 0, 123456, tzinfo=timezone.utc),
+        ),
+        (
+            "d903e9a3011a514b67b02205076178",
+            datetime(2013, 3, 21, 20, 4, 0, 5000, tzinfo=timezone.utc),
+        ),
+        (
+            "d903e9a101fb41d452d9ec200000",
+            datetime(2013, 3, 21, 20, 4, 0, 500000, tzinfo=timezone.utc),
+        ),
+        (
+            "d903e9a2013a12cff77f251a0007a120",
+            datetime(1960, 1, 1, 0, 0, 0, 500000, tzinfo=timezone.utc),
+        ),
+    ],
+    ids=["seconds", "micro", "nano", "milli+elective", "float", "before epoch"],
+)
+def test_extended_time(impl, payload, expected):
+    assert impl.loads(unhexlify(payload)) == expected
+    assert impl.loads(unhexlify(payload), map_type="pairs", immutable=True) == expected
+
+
+@pytest.mark.parametrize(
+    "payload",
+    [
+        "d903e9a2011a514b67b0251a000f4240",
+        "d903e9a3011a514b67b022012501",
+        "d903e9a2011a514b67b02000",
+        "d903e9a12501",
+        "d903e9a201fb3ff80000000000002501",
+        "d903e9811a514b67b0",
+        "d903e9a1011b0000010000000000",
+        "d903e9a1016a31333633383936323430",
+    ],
+    ids=[
+        "fraction too large",
+        "two fractions",
+        "critical key",
+        "no base time",
+        "float with fraction",
+        "not a map",
+        "out of range",
+        "string",
+    ],
+)
+def test_bad_extended_time(impl, payload):
+    with pytest.raises(impl.CBORDecodeValueError, match="invalid extended time value"):
+        impl.loads(unhexlify(payload))
+
+
 def test_positive_bignum(impl):
     # Example from RFC 8949 section 3.4.3.
     decoded = impl.loads(unhexlify("c249010000000000000000"))
@@ -652,6 +727,25 @@ def test_premature_end_of_stream(impl):
         assert isinstance(exc, EOFError)
 
 
+@pytest.mark.parametrize(
+    "payload, expected",
+    [
+        ("82437879", "expected to read 3 bytes, got 2 instead"),
+        ("8201", "expected to read 1 bytes, got 0 instead"),
+        ("8219ff", "expected to read 2 bytes, got 1 instead"),
+    ],
+)
+def test_premature_end_of_stream_message(impl, payload, expected):
+    with pytest.raises(impl.CBORDecodeEOF, match=expected):
+        impl.loads(unhexlify(payload))
+
+
+@pytest.mark.parametrize("buffer_type", [bytes, bytearray, memoryview])
+def test_loads_buffer_types(impl, buffer_type):
+    payload = unhexlify("8401a16161f9400063666f6f4262ff")
+    assert impl.loads(buffer_type(payload)) == [1, {"a": 2.0}, "foo", b"b\xff"]
+
+
 def test_tag_hook(impl):
     def reverse(decoder, tag):
         return tag.value[::-1]
@@ -689,6 +783,136 @@ def test_object_hook(impl):
     assert decoded.state == {"a": 3, "b": 5}
 
 
+@pytest.mark.parametrize(
+    "map_type, received, key_immutable",
+    [("dict", dict, True), ("pairs", list, False)],
+    ids=["dict", "pairs"],
+)
+@pytest.mark.parametrize("immutable", [False, True], ids=["mutable", "immutable"])
+def test_object_hook_type(impl, map_type, received, key_immutable, immutable):
+    # the hook gets the mutable container even where the result must be
+    # immutable (a dict key, or everything), and checks decoder.immutable itself
+    calls = []
+
+    def object_hook(decoder, value):
+        calls.append((type(value), decoder.immutable))
+        return "frozen" if decoder.immutable else value
+
+    # {{"a": 1}: 2}
+    payload = unhexlify("a1a161610102")
+    impl.loads(payload, object_hook=object_hook, map_type=map_type, immutable=immutable)
+    assert calls == [(received, key_immutable or immutable), (received, immutable)]
+
+
+@pytest.mark.parametrize("payload", [bytes, bytearray, memoryview])
+def test_loads_hook_fp(impl, payload):
+    # [4000(0), 1] with two raw bytes after the tag, which the hook reads itself
+    def tag_hook(decoder, tag):
+        return tag.value, decoder.fp.read(2)
+
+    decoded = impl.loads(payload(unhexlify("82d90fa000616201")), tag_hook=tag_hook)
+    assert decoded == [(0, b"ab"), 1]
+
+
+def test_object_hook_exception(impl):
+    def object_hook(decoder, value):
+        raise RuntimeError("foo")
+
+    for payload in ("81a16161f6", "d9010281a16161f6"):
+        with pytest.raises(RuntimeError, match="foo"):
+            impl.loads(unhexlify(payload), object_hook=object_hook)
+
+
+def test_object_hook_changed(impl):
+    # [{"a": 1}, shareable({"b": [sharedref(0)]})], twice
+    payload = unhexlify("82a1616101d81ca1616281d81d00") * 2
+    with BytesIO(payload) as stream:
+        decoder = impl.CBORDecoder(stream)
+        decoded = decoder.decode()
+        assert decoded == [{"a": 1}, {"b": [decoded[1]]}]
+        decoder.object_hook = lambda decoder, value: sorted(value)
+        decoded = decoder.decode()
+        assert decoded == [["a"], ["b"]]
+
+
+@pytest.mark.parametrize(
+    "payload, expected",
+    [
+        ("a0", []),
+        ("a201020304", [(1, 2), (3, 4)]),
+        ("a2616201616102", [("b", 1), ("a", 2)]),
+        ("a2010201f5", [(1, 2), (1, True)]),
+        ("a18201028201a16161f6", [([1, 2], [1, [("a", None)]])]),
+        ("bf61610161629f0203ffff", [("a", 1), ("b", [2, 3])]),
+        ("d9010281a10102", {((1, 2),)}),
+        ("a1a1010203", [([(1, 2)], 3)]),
+        ("d90105a144c0a800641818", ip_network("192.168.0.100/24", False)),
+    ],
+    ids=[
+        "empty",
+        "definite",
+        "wire order",
+        "duplicate keys",
+        "unhashable keys",
+        "indefinite",
+        "in a set",
+        "map key",
+        "ipnetwork",
+    ],
+)
+def test_map_pairs(impl, payload, expected):
+    value = impl.loads(unhexlify(payload), map_type="pairs")
+    assert value == expected
+    assert type(value) is type(expected)
+
+
+def test_map_pairs_large(impl):
+    pairs = [(i, str(i)) for i in range(1000)]
+    payload = impl.dumps(dict(pairs))
+    assert impl.loads(payload, map_type="pairs") == pairs
+    with pytest.raises(impl.CBORDecodeEOF):
+        impl.loads(payload[:-1], map_type="pairs")
+
+
+def test_map_pairs_hooks(impl):
+    # shareable({"a": sharedref(0)})
+    decoded = impl.loads(unhexlify("d81ca16161d81d00"), map_type="pairs")
+    assert decoded[0][1] is decoded
+    decoded = impl.loads(
+        unhexlify("a2616201616102"),
+        map_type="pairs",
+        object_hook=lambda decoder, value: value[::-1],
+    )
+    assert decoded == [("a", 2), ("b", 1)]
+
+
+@pytest.mark.parametrize(
+    "payload, kwargs, expected",
+    [
+        ("83018202038104", {}, (1, (2, 3), (4,))),
+        ("9f01820203ff", {}, (1, (2, 3))),
+        ("a1616182a1616201f6", {}, FrozenDict({"a": (FrozenDict({"b": 1}), None)})),
+        ("d9010282016162", {}, frozenset([1, "b"])),
+        ("a2616201616182f4f5", {"map_type": "pairs"}, (("b", 1), ("a", (False, True)))),
+        ("d90105a1440a0000001818", {}, ip_network("10.0.0.0/24")),
+        ("d90105a1440a0000001818", {"map_type": "pairs"}, ip_network("10.0.0.0/24")),
+    ],
+    ids=["array", "indefinite array", "map", "set", "pairs", "ipnetwork", "ipnetwork pairs"],
+)
+def test_immutable(impl, payload, kwargs, expected):
+    value = impl.loads(unhexlify(payload), immutable=True, **kwargs)
+    assert value == expected
+    assert type(value) is type(expected)
+    hash(value)
+
+
+def test_immutable_attr(impl):
+    decoder = impl.CBORDecoder(BytesIO(unhexlify("8101")), immutable=True)
+    assert decoder.immutable
+    assert decoder.decode() == (1,)
+    assert decoder.immutable
+
+
 def test_load_from_file(impl, tmpdir):
     path = tmpdir.join("testdata.cbor")
     path.write_binary(b"\x82\x01\x0a")
@@ -754,6 +978,13 @@ def test_huge_truncated_data(impl, dtype_prefix, will_overflow):
         impl.loads(unhexlify(dtype_prefix) + will_overflow)
 
 
+@pytest.mark.parametrize("dtype_prefix", ["7b", "5b"], ids=["string", "bytes"])
+def test_huge_string_length(impl, dtype_prefix):
+    huge_length = struct.pack(">Q", sys.maxsize + 1)
+    with pytest.raises(impl.CBORDecodeValueError):
+        impl.loads(unhexlify(dtype_prefix) + huge_length + b"abcd", map_type="pairs")
+
+
 @pytest.mark.parametrize("tag_dtype", ["7F7B", "5f5B"], ids=["string", "bytes"])
 def test_huge_truncated_indefinite_data(impl, tag_dtype, will_overflow):
     huge_index = struct.pack("Q", sys.maxsize + 1)
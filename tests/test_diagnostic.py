@@ -0,0 +1,116 @@
+from binascii import unhexlify
+from io import StringIO
+
+import pytest
+
+
+@pytest.mark.parametrize(
+    "payload, expected",
+    [
+        ("00", "0"),
+        ("17", "23"),
+        ("1817", "23_0"),
+        ("1900ff", "255_1"),
+        ("1b0000000100000000", "4294967296"),
+        ("20", "-1"),
+        ("3bffffffffffffffff", "-18446744073709551616"),
+        ("4401020304", "h'01020304'"),
+        ("40", "h''"),
+        ("6449455446", '"IETF"'),
+        ("62225c", '"\\"\\\\"'),
+        ("620a01", '"\\n\\u0001"'),
+        ("63e282ac", '"€"'),
+        ("5f42010243030405ff", "(_ h'0102', h'030405')"),
+        ("7f657374726561646d696e67ff", '(_ "strea", "ming")'),
+        ("5fff", "(_ )"),
+        ("80", "[]"),
+        ("83010203", "[1, 2, 3]"),
+        ("9803010203", "[_0 1, 2, 3]"),
+        ("9f018202039f0405ffff", "[_ 1, [2, 3], [_ 4, 5]]"),
+        ("a201020304", "{1: 2, 3: 4}"),
+        ("bf6346756ef563416d7421ff", '{_ "Fun": true, "Amt": -2}'),
+        ("c074323031332d30332d32315432303a30343a30305a", '0("2013-03-21T20:04:00Z")'),
+        ("d82076687474703a2f2f7777772e6578616d706c652e636f6d", '32("http://www.example.com")'),
+        ("d9001801", "24_1(1)"),
+        ("f4", "false"),
+        ("f5", "true"),
+        ("f6", "null"),
+        ("f7", "undefined"),
+        ("f0", "simple(16)"),
+        ("f8ff", "simple(255)"),
+        ("f90000", "0.0_1"),
+        ("f98000", "-0.0_1"),
+        ("f93c00", "1.0_1"),
+        ("f90001", "5.960464477539063e-08_1"),
+        ("fa47c35000", "100000.0_2"),
+        ("fb3ff199999999999a", "1.1_3"),
+        ("fb7e37e43c8800759c", "1e+300_3"),
+        ("f97c00", "Infinity_1"),
+        ("f9fc00", "-Infinity_1"),
+        ("f97e00", "NaN_1"),
+        ("fa7fc00000", "NaN_2"),
+    ],
+)
+def test_diagnose(impl, payload, expected):
+    assert impl.diagnose(unhexlify(payload)) == expected
+
+
+def test_diagnose_buffer_types(impl):
+    for data in (bytearray(b"\x82\x01\x02"), memoryview(b"\x00\x82\x01\x02")[1:]):
+        assert impl.diagnose(data) == "[1, 2]"
+
+
+def test_diagnose_invalid_utf8(impl):
+    assert impl.diagnose(unhexlify("62c328")) == '"\\xc3("'
+
+
+def test_diagnose_sequence(impl):
+    assert impl.diagnose(unhexlify("01820203f6"), sequence=True) == "1\n[2, 3]\nnull\n"
+    assert impl.diagnose(b"", sequence=True) == ""
+
+
+def test_diagnose_fp(impl):
+    data = unhexlify("9f") + unhexlify("6568656c6c6f") * 20000 + unhexlify("ff")
+    expected = "[_ " + ", ".join(['"hello"'] * 20000) + "]"
+    fp = StringIO()
+    assert impl.diagnose(data, fp=fp) is None
+    assert fp.getvalue() == expected
+
+
+@pytest.mark.parametrize(
+    "payload, sequence",
+    [
+        ("", False),
+        ("83", False),
+        ("8301", True),
+        ("6201", False),
+        ("bf61", False),
+        ("1a0000", True),
+    ],
+)
+def test_diagnose_eof(impl, payload, sequence):
+    with pytest.raises(impl.CBORDecodeEOF, match="premature end of stream"):
+        impl.diagnose(unhexlify(payload), sequence=sequence)
+
+
+@pytest.mark.parametrize(
+    "payload",
+    [
+        pytest.param("ff", id="lone_break"),
+        pytest.param("1c", id="reserved_ai"),
+        pytest.param("3f", id="indefinite_int"),
+        pytest.param("df01", id="indefinite_tag"),
+        pytest.param("f801", id="short_simple"),
+        pytest.param("5f01ff", id="bytes_chunk_type"),
+        pytest.param("7f5f", id="nested_indefinite_text"),
+        pytest.param("bf01ff", id="odd_map"),
+    ],
+)
+def test_diagnose_invalid(impl, payload):
+    with pytest.raises(impl.CBORDecodeValueError, match="invalid CBOR data"):
+        impl.diagnose(unhexlify(payload))
+
+
+def test_diagnose_trailing_data(impl):
+    with pytest.raises(impl.CBORDecodeValueError, match="2 bytes of trailing data"):
+        impl.diagnose(unhexlify("010203"))
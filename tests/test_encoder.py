@@ -1,12 +1,17 @@
+import mmap
 import re
+import sys
+from array import array
 from binascii import unhexlify
-from collections import OrderedDict
+from collections import ChainMap, OrderedDict
+from collections.abc import Mapping
 from datetime import date, datetime, timedelta, timezone
 from decimal import Decimal
 from email.mime.text import MIMEText
 from fractions import Fraction
 from io import BytesIO
 from ipaddress import ip_address, ip_network
+from types import MappingProxyType
 from uuid import UUID
 
 import pytest
@@ -162,6 +167,74 @@ def test_bytearray(impl):
     assert impl.dumps(bytearray(b"\x01\x02\x03\x04")) == expected
 
 
+class BytesSubclass(bytes):
+    pass
+
+
+@pytest.mark.parametrize(
+    "value",
+    [
+        memoryview(b"\x01\x02\x03\x04"),
+        memoryview(b"\x00\x01\x02\x03\x04\x05")[1:5],
+        memoryview(b"\x01\x02\x03\x04").cast("B", (2, 2)),
+        array("B", b"\x01\x02\x03\x04"),
+        array("h", b"\x01\x02\x03\x04"),
+        BytesSubclass(b"\x01\x02\x03\x04"),
+    ],
+    ids=["memoryview", "slice", "2d", "array", "array of shorts", "bytes subclass"],
+)
+def test_buffer(impl, value):
+    assert impl.dumps(value) == unhexlify("4401020304")
+    assert impl.dumps([value, value], string_referencing=True) == unhexlify(
+        "d90100824401020304d81900"
+    )
+
+
+def test_buffer_mmap(impl):
+    with mmap.mmap(-1, 4) as buf:
+        buf.write(b"\x01\x02\x03\x04")
+        assert impl.dumps(buf) == unhexlify("4401020304")
+
+
+def test_buffer_large(impl):
+    class Recorder:
+        def __init__(self):
+            self.chunks = []
+
+        def write(self, data):
+            self.chunks.append(data)
+
+    data = bytes(range(256)) * 1000
+    fp = Recorder()
+    impl.dump([memoryview(data), array("B", data)], fp)
+    # chunks are still intact after dump() is done with them
+    assert impl.loads(b"".join(bytes(chunk) for chunk in fp.chunks)) == [data, data]
+
+
+def test_buffer_write_bytes(impl):
+    class Recorder:
+        def __init__(self):
+            self.chunks = []
+
+        def write(self, data):
+            self.chunks.append(data)
+            return len(data)
+
+    value = array("i", range(10000))
+    fp = Recorder()
+    impl.dump(value, fp)
+    views = [chunk for chunk in fp.chunks if isinstance(chunk, memoryview)]
+    assert [(view.format, view.ndim, len(view)) for view in views] == [
+        ("B", 1, len(value) * value.itemsize)
+    ]
+    assert impl.loads(b"".join(bytes(chunk) for chunk in fp.chunks)) == value.tobytes()
+
+
+def test_buffer_noncontiguous(impl):
+    with pytest.raises(impl.CBOREncodeValueError, match="non-contiguous"):
+        impl.dumps(memoryview(b"\x01\x02\x03\x04")[::2])
+
+
 @pytest.mark.parametrize(
     "value, expected",
     [
@@ -178,6 +251,46 @@ def test_string(impl, value, expected):
     assert impl.dumps(value) == expected
 
 
+@pytest.mark.parametrize(
+    "char",
+    ["a", "é", "€", "\U0001f600"],
+    ids=["ascii", "latin1", "bmp", "astral"],
+)
+def test_string_kinds(impl, char):
+    # long enough to be passed to write() in several chunks, with ASCII runs
+    value = ("abcdefghij" + char) * 20000
+    expected = value.encode("utf-8")
+    with BytesIO() as stream:
+        impl.dump(value, stream)
+        assert stream.getvalue() == b"\x7a" + len(expected).to_bytes(4, "big") + expected
+
+    # encoding mustn't leave a UTF-8 copy attached to the string
+    value = "x" + char * 100
+    size = sys.getsizeof(value)
+    assert impl.loads(impl.dumps([value])) == [value]
+    assert sys.getsizeof(value) == size
+
+
+@pytest.mark.parametrize("length", [1, 3, 4, 5, 8, 9, 8195])
+def test_string_runs(impl, length):
+    # runs of one UTF-8 width of every length modulo the transcoder's block size, then mixed
+    for char in ["a", "\u00e9", "\u07ff", "\u0800", "\uffff", "\U00010000", "\U0010ffff"]:
+        for prefix in ["", "\u20ac", "\U0001f600"]:
+            value = prefix + char * length
+            expected = value.encode("utf-8")
+            assert impl.dumps(value)[-len(expected) :] == expected
+
+    value = "".join(chr(c) for c in [0x61, 0xE9, 0x20AC, 0x1F600, 0x7F, 0x800] * length)
+    assert impl.dumps(value)[-len(value.encode("utf-8")) :] == value.encode("utf-8")
+
+
+def test_string_surrogate(impl):
+    with pytest.raises(UnicodeEncodeError):
+        impl.dumps("\ud800")
+    with pytest.raises(UnicodeEncodeError):
+        impl.dumps("\U0001f600\udfff")
+
+
 @pytest.fixture(
     params=[(False, "f4"), (True, "f5"), (None, "f6"), ("undefined", "f7")],
     ids=["false", "true", "null", "undefined"],
@@ -271,6 +384,34 @@ def test_datetime(impl, value, as_timestamp, expected):
     )
 
 
+@pytest.mark.parametrize(
+    "value, expected",
+    [
+        (datetime(2013, 3, 21, 20, 4, 0, tzinfo=timezone.utc), "d903e9a1011a514b67b0"),
+        (
+            datetime(2013, 3, 21, 20, 4, 0, 123456, tzinfo=timezone.utc),
+            "d903e9a2011a514b67b0251a0001e240",
+        ),
+        (
+            datetime(2013, 3, 21, 22, 4, 0, tzinfo=timezone(timedelta(hours=2))),
+            "d903e9a1011a514b67b0",
+        ),
+        (datetime(2013, 3, 21, 20, 4, 0), "d903e9a1011a514b67b0"),
+        (
+            datetime(1960, 1, 1, 0, 0, 0, 500000, tzinfo=timezone.utc),
+            "d903e9a2013a12cff77f251a0007a120",
+        ),
+    ],
+    ids=["utc", "micro", "eet", "naive", "before epoch"],
+)
+def test_datetime_extended_time(impl, value, expected):
+    encoded = impl.dumps(
+        value, datetime_as_extended_time=True, datetime_as_timestamp=True, timezone=timezone.utc
+    )
+    assert encoded == unhexlify(expected)
+    assert impl.loads(encoded) == value.replace(tzinfo=value.tzinfo or timezone.utc)
+
+
 @pytest.mark.parametrize("tz", [None, timezone.utc], ids=["no timezone", "utc"])
 def test_date_fails(impl, tz):
     encoder = impl.CBOREncoder(BytesIO(b""), timezone=tz, date_as_datetime=False)
@@ -419,6 +560,25 @@ def test_cyclic_map_nosharing(impl):
         assert isinstance(exc, ValueError)
 
 
+@pytest.mark.parametrize("canonical", [False, True])
+def test_cyclic_nested_nosharing(impl, canonical):
+    """Test that cycles are detected however deep they start and whatever they pass through."""
+    a = [1]
+    a.append({"b": (impl.CBORTag(6000, [a]),)})
+    value = [[[a]]]
+    for _ in range(50):
+        value = [value]
+    with pytest.raises(impl.CBOREncodeValueError, match="cyclic data structure detected"):
+        impl.dumps(value, canonical=canonical)
+
+    # not cyclic, just deep and repetitive
+    leaf = []
+    value = leaf
+    for _ in range(100):
+        value = [leaf, value]
+    assert impl.dumps(value, canonical=canonical) == b"\x82\x80" * 100 + b"\x80"
+
+
 @pytest.mark.parametrize(
     "value_sharing, expected",
     [(False, "828080"), (True, "d81c82d81c80d81d01")],
@@ -479,6 +639,43 @@ def test_dump_to_file(impl, tmpdir):
     assert path.read_binary() == b"\x82\x01\x0a"
 
 
+def test_dump_in_chunks(impl):
+    class Recorder:
+        def __init__(self):
+            self.chunks = []
+
+        def write(self, data):
+            self.chunks.append(bytes(data))
+
+    # however the output is split up, it must all arrive in order
+    value = [b"x" * 100000, "y" * 3000, list(range(10000)), {"z": b"z" * 20000}]
+    fp = Recorder()
+    impl.dump(value, fp)
+    assert impl.loads(b"".join(fp.chunks)) == value
+
+
+def test_failed_encode_output(impl):
+    # output of a failed encode() is discarded as a whole rather than partly
+    # written, and doesn't leak into the next call
+    with BytesIO() as stream:
+        encoder = impl.CBOREncoder(stream)
+        with pytest.raises(impl.CBOREncodeTypeError):
+            encoder.encode([1, "foo", object()])
+        assert stream.getvalue() == b""
+        encoder.encode([1])
+        assert stream.getvalue() == b"\x81\x01"
+
+
+def test_default_output_order(impl):
+    def default(encoder, value):
+        encoder.encode_length(6, 100)
+        encoder.write(b"\x61x")
+        assert encoder.encode_to_bytes([value.args[0]]) == b"\x81" + bytes(value.args)
+
+    values = [1, ValueError(2), 3]
+    assert impl.dumps(values, default=default) == b"\x83\x01\xd8\x64\x61x\x03"
+
+
 @pytest.mark.parametrize(
     "value, expected",
     [
@@ -547,6 +744,70 @@ def test_dict_key(impl):
     assert impl.dumps({FrozenDict({2: 1}): ""}) == unhexlify("a1a1020160")
 
 
+@pytest.mark.parametrize("canonical", [False, True], ids=["plain", "canonical"])
+def test_mapping_types(impl, canonical):
+    def default(encoder, value):
+        if canonical:
+            encoder.encode_canonical_map(value)
+        else:
+            encoder.encode_map(value)
+
+    ordered = OrderedDict([("a", 1), ("b", 2), ("c", 3)])
+    ordered.move_to_end("a")
+    values = [
+        ordered,
+        ChainMap({"a": 1}, {"b": 2, "c": 3}),
+        MappingProxyType({"b": 2, "c": 3, "a": 1}),
+    ]
+    expected = "a3616202616303616101"
+    if canonical:
+        expected = "a3616101616202616303"
+    for value in values:
+        assert impl.dumps(value, default=default, canonical=canonical) == unhexlify(expected)
+
+
+@pytest.mark.parametrize("canonical", [False, True], ids=["plain", "canonical"])
+def test_mapping_size_mismatch(impl, canonical):
+    class Short(Mapping):
+        def __getitem__(self, key):
+            return {"a": 1, "b": 2}[key]
+
+        def __iter__(self):
+            return iter("ab")
+
+        def __len__(self):
+            return 1
+
+    def default(encoder, value):
+        if canonical:
+            encoder.encode_canonical_map(value)
+        else:
+            encoder.encode_map(value)
+
+    with pytest.raises(impl.CBOREncodeValueError, match="changed size"):
+        impl.dumps(Short(), default=default, canonical=canonical)
+
+
+def test_repeated_str_keys(impl):
+    keys = ["id", "naïve", "水", "\U0001f600", "k" * 100] + ["key%d" % i for i in range(300)]
+    records = [dict.fromkeys(keys, i) for i in range(3)]
+    # equal keys held in different objects
+    records.append({"".join(list(key)): 3 for key in keys})
+    expected = b"\x84" + b"".join(
+        b"\xb9\x01\x31"
+        + b"".join(impl.dumps(key) + impl.dumps(i) for key in keys)
+        for i in range(4)
+    )
+    with BytesIO() as stream:
+        encoder = impl.CBOREncoder(stream)
+        encoder.encode(records)
+        encoder.encode({"k": 1})
+        assert stream.getvalue() == expected + b"\xa1\x61\x6b\x01"
+
+    with pytest.raises(UnicodeEncodeError):
+        impl.dumps({"\ud800": 1})
+
+
 @pytest.mark.parametrize("frozen", [False, True], ids=["set", "frozenset"])
 def test_set(impl, frozen):
     value = {"a", "b", "c"}
@@ -0,0 +1,57 @@
+from binascii import unhexlify
+
+import pytest
+
+RECORDS = [{"id": i, "name": "record %d" % i, "tags": ["a"] * (i % 5)} for i in range(1003)]
+
+
+@pytest.mark.parametrize(
+    "payload, expected",
+    [
+        ("83018202030a", ("array", [1, 2, 5, 6], False)),
+        ("a261610161628102", ("map", [1, 3, 4, 6, 8], False)),
+        ("9f0102ff", ("array", [1, 2, 3], False)),
+        ("bf616101ff", ("map", [1, 3, 4], False)),
+        ("d9d9f7820102", ("array", [4, 5, 6], False)),
+        ("80", ("array", [1], False)),
+        ("8281d81c0181d81d00", ("array", [1, 5, 9], True)),
+        ("8201020304", ("array", [1, 2, 3], False)),
+    ],
+    ids=[
+        "array",
+        "map",
+        "indefinite array",
+        "indefinite map",
+        "self-describe",
+        "empty",
+        "shared",
+        "trailing data",
+    ],
+)
+def test_index_items(impl, payload, expected):
+    assert impl.index_items(unhexlify(payload)) == expected
+
+
+@pytest.mark.parametrize(
+    "payload, exception",
+    [
+        ("", "CBORDecodeEOF"),
+        ("01", "CBORDecodeValueError"),
+        ("c1820102", "CBORDecodeValueError"),
+        ("830102", "CBORDecodeEOF"),
+        ("9f01", "CBORDecodeEOF"),
+        ("82ff01", "CBORDecodeValueError"),
+    ],
+    ids=["empty", "integer", "tagged", "truncated", "unterminated", "break"],
+)
+def test_index_items_errors(impl, payload, exception):
+    with pytest.raises(getattr(impl, exception)):
+        impl.index_items(unhexlify(payload))
+
+
+def test_index_items_decode(impl):
+    data = b"\xd9\xd9\xf7\x9f" + b"".join(impl.dumps(record) for record in RECORDS) + b"\xff"
+    type_, offsets, shared = impl.index_items(data)
+    assert type_ == "array"
+    assert not shared
+    assert [impl.loads(data[start:end]) for start, end in zip(offsets, offsets[1:])] == RECORDS
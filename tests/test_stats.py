@@ -0,0 +1,84 @@
+from binascii import unhexlify
+
+import pytest
+
+
+def test_stats_structure(impl):
+    # {"a": [1, -1, h'0102'], "bb": 1(0)}
+    stats = impl.scan_stats(unhexlify("a26161830120420102626262c100"))
+    assert stats["items"] == 1
+    assert stats["bytes"] == 14
+    assert stats["major_types"] == {
+        "unsigned": 2,
+        "negative": 1,
+        "bytes": 1,
+        "text": 2,
+        "array": 1,
+        "map": 1,
+        "tag": 1,
+        "simple": 0,
+        "float": 0,
+    }
+    assert stats["tags"] == {1: 1}
+    assert stats["indefinite"] == 0
+    assert stats["max_depth"] == 2
+    assert stats["bytes_sizes"] == {2: 1}
+    assert stats["text_sizes"] == {1: 1, 2: 1}
+    assert stats["array_sizes"] == {2: 1}
+    assert stats["map_sizes"] == {2: 1}
+    assert stats["key_bytes"] == 5
+    assert stats["value_bytes"] == 8
+
+
+def test_stats_indefinite(impl):
+    # [_ (_ h'01', h'0203'), {_ "a": 1}]
+    stats = impl.scan_stats(unhexlify("9f5f4101420203ffbf616101ffff"))
+    assert stats["major_types"]["bytes"] == 1
+    assert stats["indefinite"] == 3
+    assert stats["bytes_sizes"] == {2: 1}
+    assert stats["array_sizes"] == {2: 1}
+    assert stats["map_sizes"] == {1: 1}
+    assert stats["max_depth"] == 2
+
+
+def test_stats_floats(impl):
+    # [1.5 as double, 0.1 as double, 100000.0 as double, 1.0 as half]
+    stats = impl.scan_stats(
+        unhexlify("84fb3ff8000000000000fb3fb999999999999afb40f86a0000000000f93c00")
+    )
+    assert stats["floats"] == {
+        "half": 1,
+        "single": 0,
+        "double": 3,
+        "shrinkable": 2,
+        "shrink_savings": 10,
+    }
+
+
+def test_stats_stringref(impl):
+    data = impl.dumps(["hello", "hello", "hello", "hi", "hi"])
+    stats = impl.scan_stats(data)
+    assert stats["repeated_strings"] == 2
+    assert stats["stringref_savings"] == len(data) - len(
+        impl.dumps(["hello", "hello", "hello", "hi", "hi"], string_referencing=True)
+    )
+    assert stats["packed_savings"] == 6
+
+
+def test_stats_sequence(impl):
+    stats = impl.scan_stats(unhexlify("0102f6"), sequence=True)
+    assert stats["items"] == 3
+    assert stats["major_types"]["unsigned"] == 2
+    assert stats["major_types"]["simple"] == 1
+    assert impl.scan_stats(b"", sequence=True)["items"] == 0
+
+
+def test_stats_trailing_data(impl):
+    with pytest.raises(impl.CBORDecodeValueError, match="2 bytes of trailing data"):
+        impl.scan_stats(unhexlify("010203"))
+
+
+@pytest.mark.parametrize("payload", ["", "8301", "a1"])
+def test_stats_eof(impl, payload):
+    with pytest.raises(impl.CBORDecodeEOF):
+        impl.scan_stats(unhexlify(payload))
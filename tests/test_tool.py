@@ -136,3 +136,51 @@ def test_ignore_tag(monkeypatch, tmpdir):
         m.setattr("sys.stdin", inbuf)
         cbor2.tool.main()
         assert f.read() == expected
+
+
+def test_diag(monkeypatch, tmpdir):
+    f = tmpdir.join("infile")
+    outfile = tmpdir.join("outfile")
+    f.write_binary(binascii.unhexlify("d8189f4101f97e00ff"))
+    argv = ["--diag", "-o", str(outfile), str(f)]
+    with monkeypatch.context() as m:
+        m.setattr("sys.argv", [""] + argv)
+        cbor2.tool.main()
+        assert outfile.read() == "24([_ h'01', NaN_1])\n"
+
+
+def test_diag_sequence(monkeypatch, tmpdir):
+    f = tmpdir.join("outfile")
+    argv = ["--diag", "--sequence", "-o", str(f)]
+    inbuf = TextIOWrapper(BytesIO(binascii.unhexlify("0218ff")))
+    with monkeypatch.context() as m:
+        m.setattr("sys.argv", [""] + argv)
+        m.setattr("sys.stdin", inbuf)
+        cbor2.tool.main()
+        assert f.read() == "2\n255\n"
+
+
+def test_diag_invalid(monkeypatch, tmpdir):
+    f = tmpdir.join("outfile")
+    argv = ["--diag", "-o", str(f)]
+    inbuf = TextIOWrapper(BytesIO(binascii.unhexlify("8301")))
+    with monkeypatch.context() as m:
+        m.setattr("sys.argv", [""] + argv)
+        m.setattr("sys.stdin", inbuf)
+        with pytest.raises(SystemExit, match="premature end of stream"):
+            cbor2.tool.main()
+
+
+def test_stats(monkeypatch, tmpdir):
+    f = tmpdir.join("outfile")
+    argv = ["--stats", "--sequence", "-o", str(f)]
+    inbuf = TextIOWrapper(BytesIO(binascii.unhexlify("a1616101d9271000")))
+    with monkeypatch.context() as m:
+        m.setattr("sys.argv", [""] + argv)
+        m.setattr("sys.stdin", inbuf)
+        cbor2.tool.main()
+    stats = json.loads(f.read())
+    assert stats["items"] == 2
+    assert stats["tags"] == {"10000": 1}
+    assert stats["key_bytes"] == 2
+    assert stats["value_bytes"] == 1
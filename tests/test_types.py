@@ -82,6 +82,33 @@ def test_tag_recursive(impl):
     assert not (tag != tag.value)
 
 
+def test_tag_hash(impl):
+    tag = impl.CBORTag(1, "foo")
+    assert hash(tag) == hash((1, "foo"))
+    assert tag in {impl.CBORTag(1, "foo")}
+    tag.value = "bar"
+    assert hash(tag) == hash((1, "bar"))
+    tag.tag = 2
+    assert hash(tag) == hash((2, "bar"))
+    assert tag not in {impl.CBORTag(1, "foo")}
+
+
+@pytest.mark.parametrize(
+    "wrap",
+    [lambda tag: tag, lambda tag: (1, tag), lambda tag: (("a", tag),)],
+    ids=["tag", "tuple", "nested tuple"],
+)
+def test_tag_hash_nested(impl, wrap):
+    # the inner tag can be changed without the outer one knowing about it
+    inner = impl.CBORTag(2, "foo")
+    tag = impl.CBORTag(1, wrap(inner))
+    assert hash(tag) == hash((1, wrap(impl.CBORTag(2, "foo"))))
+    inner.value = "bar"
+    assert hash(tag) == hash((1, wrap(impl.CBORTag(2, "bar"))))
+    inner.tag = 3
+    assert hash(tag) == hash((1, wrap(impl.CBORTag(3, "bar"))))
+
+
 def test_tag_repr(impl):
     assert repr(impl.CBORTag(600, "blah")) == "CBORTag(600, 'blah')"
 